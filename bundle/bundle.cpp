@@ -0,0 +1,207 @@
+#include "./bundle.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h> // strcasecmp()
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2UL*1024*1024)
+
+shared_store<bundle> bundle_store::m_store;
+
+std::shared_ptr<const bundle> bundle_store::current(){
+    return m_store.current();
+}
+
+void bundle_store::replace(std::shared_ptr<const bundle> b){
+    m_store.replace(b);
+}
+
+std::shared_ptr<const bundle> bundle_store::local(){
+    return m_store.local();
+}
+
+bundle::bundle():m_map(NULL),m_resident(false),m_map_size(0),m_header(NULL),m_entries(NULL),m_strings(NULL){
+}
+
+bundle::~bundle(){
+    if(m_map){
+        munmap(m_map,m_map_size);
+    }
+}
+
+// 把整个文件读入大页内存。MAP_HUGETLB需要预留大页，失败时退回透明大页
+static char *load_hugepage(int fd,size_t size,size_t &map_size){
+    map_size=(size+HUGE_PAGE_SIZE-1)&~(HUGE_PAGE_SIZE-1);
+    void *p=mmap(NULL,map_size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+    if(p==MAP_FAILED){
+        p=mmap(NULL,map_size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(p==MAP_FAILED){
+            return NULL;
+        }
+        madvise(p,map_size,MADV_HUGEPAGE);
+    }
+    size_t done=0;
+    while(done<size){
+        ssize_t n=pread(fd,(char *)p+done,size-done,done);
+        if(n<=0){
+            if(n==-1 && errno==EINTR){
+                continue;
+            }
+            munmap(p,map_size);
+            return NULL;
+        }
+        done+=n;
+    }
+    mprotect(p,map_size,PROT_READ); // 之后只读
+    return (char *)p;
+}
+
+std::shared_ptr<const bundle> bundle::load(const char *path,int flags,std::string &err){
+    int fd=open(path,O_RDONLY);
+    if(fd==-1){
+        err=std::string("open: ")+strerror(errno);
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd,&st)!=0 || (size_t)st.st_size<sizeof(bundle_header)){
+        close(fd);
+        err="file too small";
+        return NULL;
+    }
+
+    std::shared_ptr<bundle> b(new bundle());
+    if(flags & BUNDLE_HUGEPAGE){
+        b->m_map=load_hugepage(fd,st.st_size,b->m_map_size);
+    }else{
+        int map_flags=MAP_PRIVATE;
+        if(flags & BUNDLE_POPULATE){
+            map_flags|=MAP_POPULATE;
+        }
+        void *p=mmap(NULL,st.st_size,PROT_READ,map_flags,fd,0);
+        if(p!=MAP_FAILED){
+            b->m_map=(char *)p;
+            b->m_map_size=st.st_size;
+        }
+    }
+    close(fd);
+    if(!b->m_map){
+        err=std::string("mmap: ")+strerror(errno);
+        return NULL;
+    }
+    b->m_resident=(flags & (BUNDLE_POPULATE|BUNDLE_HUGEPAGE))!=0;
+
+    b->m_header=(const bundle_header *)b->m_map;
+    if(b->m_header->file_size!=(uint64_t)st.st_size){
+        err="size mismatch";
+        return NULL;
+    }
+    if(!b->validate(err)){
+        return NULL;
+    }
+    b->m_entries=(const bundle_entry *)(b->m_map+b->m_header->index_offset);
+    b->m_strings=b->m_map+b->m_header->strings_offset;
+    return b;
+}
+
+// 加载时一次性检查所有偏移，之后查找时不再做边界检查
+bool bundle::validate(std::string &err) const{
+    const bundle_header *h=m_header;
+    uint64_t size=h->file_size;
+    if(memcmp(h->magic,BUNDLE_MAGIC,8)!=0 || h->version!=BUNDLE_VERSION){
+        err="bad magic or version";
+        return false;
+    }
+    if(h->index_offset>size || h->entry_count>(size-h->index_offset)/sizeof(bundle_entry)
+        || h->strings_offset>size || h->strings_size>size-h->strings_offset
+        || h->data_offset>size || h->data_offset%BUNDLE_PAGE_SIZE!=0){
+        err="bad section offsets";
+        return false;
+    }
+    const bundle_entry *e=(const bundle_entry *)(m_map+h->index_offset);
+    const char *strings=m_map+h->strings_offset;
+    for(uint32_t i=0;i<h->entry_count;i++){
+        if((uint64_t)e[i].path_off+e[i].path_len>h->strings_size
+            || (uint64_t)e[i].mime_off+e[i].mime_len>h->strings_size
+            || (uint64_t)e[i].etag_off+e[i].etag_len>h->strings_size
+            || e[i].data_off>size || e[i].data_size>size-e[i].data_off
+            || e[i].gzip_off>size || e[i].gzip_size>size-e[i].gzip_off){
+            err="entry out of range";
+            return false;
+        }
+        // 检查是否有序，保证二分查找正确
+        if(i>0){
+            size_t a=e[i-1].path_len,b=e[i].path_len;
+            int c=memcmp(strings+e[i-1].path_off,strings+e[i].path_off,a<b?a:b);
+            if(c>0 || (c==0 && a>=b)){
+                err="index not sorted";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool bundle::find(const char *path,size_t len,asset &out) const{
+    uint32_t lo=0,hi=m_header->entry_count;
+    while(lo<hi){
+        uint32_t mid=lo+(hi-lo)/2;
+        const bundle_entry &e=m_entries[mid];
+        int c=memcmp(str(e.path_off),path,e.path_len<len?e.path_len:len);
+        if(c==0){
+            c=e.path_len<len?-1:(e.path_len>len?1:0);
+        }
+        if(c==0){
+            out.data=m_map+e.data_off;
+            out.size=e.data_size;
+            out.gzip_data=e.gzip_size?m_map+e.gzip_off:NULL;
+            out.gzip_size=e.gzip_size;
+            out.mime=str(e.mime_off);
+            out.mime_len=e.mime_len;
+            out.etag=str(e.etag_off);
+            out.etag_len=e.etag_len;
+            return true;
+        }
+        if(c<0){
+            lo=mid+1;
+        }else{
+            hi=mid;
+        }
+    }
+    return false;
+}
+
+const char *bundle_mime_type(const char *path){
+    static const struct{
+        const char *ext;
+        const char *mime;
+    } table[]={
+        {"html","text/html"},{"htm","text/html"},{"css","text/css"},
+        {"js","application/javascript"},{"json","application/json"},
+        {"txt","text/plain"},{"md","text/markdown"},{"xml","application/xml"},
+        {"jpg","image/jpeg"},{"jpeg","image/jpeg"},{"png","image/png"},
+        {"gif","image/gif"},{"ico","image/x-icon"},{"svg","image/svg+xml"},
+        {"webp","image/webp"},{"mp4","video/mp4"},{"woff2","font/woff2"},
+    };
+    const char *dot=strrchr(path,'.');
+    if(dot && !strchr(dot,'/')){
+        for(size_t i=0;i<sizeof(table)/sizeof(table[0]);i++){
+            if(strcasecmp(dot+1,table[i].ext)==0){
+                return table[i].mime;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+uint64_t bundle_hash(const char *data,size_t len){
+    uint64_t h=14695981039346656037ULL;
+    for(size_t i=0;i<len;i++){
+        h^=(unsigned char)data[i];
+        h*=1099511628211ULL;
+    }
+    return h;
+}
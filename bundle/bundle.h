@@ -0,0 +1,124 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <atomic>
+#include <string>
+
+#include "./shared_store.h"
+
+/*
+    资源包：把整个doc root打包成一个文件，启动时mmap一次，之后请求不再访问文件系统
+
+    文件布局（小端，所有偏移都相对于文件开头）：
+    +----------------------+ 0
+    | bundle_header        |
+    +----------------------+ sizeof(bundle_header)
+    | bundle_entry[count]  | 按路径字典序排序，二分查找
+    +----------------------+
+    | 字符串区             | 路径、MIME类型、ETag，不以'\0'结尾
+    +----------------------+ 按页对齐
+    | 数据区               | 每个资源（及其gzip版本）按BUNDLE_DATA_ALIGN对齐
+    +----------------------+
+*/
+
+#define BUNDLE_MAGIC "WSBUNDL1"
+#define BUNDLE_VERSION 1
+#define BUNDLE_PAGE_SIZE 4096
+#define BUNDLE_DATA_ALIGN 64 // 资源起始地址按cache line对齐
+
+struct bundle_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t index_offset; // bundle_entry数组
+    uint64_t strings_offset; // 字符串区
+    uint64_t strings_size;
+    uint64_t data_offset; // 数据区，页对齐
+    uint64_t file_size; // 整个文件大小，用于校验
+};
+
+struct bundle_entry{
+    uint32_t path_off; // 字符串区中的偏移，形如"/index.html"
+    uint32_t path_len;
+    uint32_t mime_off; // Content-Type
+    uint32_t mime_len;
+    uint32_t etag_off; // 带双引号的强ETag
+    uint32_t etag_len;
+    uint64_t data_off; // 原始内容
+    uint64_t data_size;
+    uint64_t gzip_off; // 预压缩版本，gzip_size为0表示没有
+    uint64_t gzip_size;
+};
+
+// 加载选项
+enum BUNDLE_FLAGS{
+    BUNDLE_POPULATE=1, // MAP_POPULATE，启动时一次性建立页表
+    BUNDLE_HUGEPAGE=2 // 拷贝到大页内存中，减少TLB miss
+};
+
+// 已加载（只读）的资源包。通过shared_ptr共享，正在发送的连接持有引用，
+// 所以SIGHUP替换后旧包会在最后一个连接发送完成时才解除映射
+class bundle{
+    public:
+        struct asset{
+            const char *data;
+            size_t size;
+            const char *gzip_data; // 没有预压缩版本时为NULL
+            size_t gzip_size;
+            const char *mime;
+            size_t mime_len;
+            const char *etag;
+            size_t etag_len;
+        };
+
+        ~bundle();
+
+        // 映射并校验资源包，失败返回空指针并把原因写入err
+        static std::shared_ptr<const bundle> load(const char *path,int flags,std::string &err);
+
+        // 按url路径查找资源，找不到返回false
+        bool find(const char *path,size_t len,asset &out) const;
+
+        uint32_t size() const { return m_header->entry_count; }
+        size_t mapped_size() const { return m_map_size; }
+        // 加载时已经全部读进内存（BUNDLE_POPULATE、BUNDLE_HUGEPAGE），发送前不用检查是否在page cache中
+        bool resident() const { return m_resident; }
+
+    private:
+        bundle();
+        bundle(const bundle &)=delete;
+        bundle &operator=(const bundle &)=delete;
+
+        bool validate(std::string &err) const;
+        const char *str(uint32_t off) const { return m_strings+off; }
+
+        char *m_map; // 映射的起始地址
+        bool m_resident;
+        size_t m_map_size;
+        const bundle_header *m_header;
+        const bundle_entry *m_entries;
+        const char *m_strings;
+};
+
+// 当前生效的资源包。工作线程读取，主线程在收到SIGHUP后整体替换，替换是原子的
+class bundle_store{
+    public:
+        static std::shared_ptr<const bundle> current();
+        static void replace(std::shared_ptr<const bundle> b);
+        // 当前线程自己的引用，见shared_store；替换时所有线程的引用一起释放
+        static std::shared_ptr<const bundle> local();
+
+    private:
+        static shared_store<bundle> m_store;
+};
+
+// 根据扩展名猜测Content-Type，packer打包时使用
+const char *bundle_mime_type(const char *path);
+
+// 64位FNV-1a，用作ETag
+uint64_t bundle_hash(const char *data,size_t len);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef SHARED_STORE_H
+#define SHARED_STORE_H
+
+#include <memory>
+#include <atomic>
+#include <vector>
+#include "../lock/locker.h"
+
+/*
+    整体原子替换的共享对象（资源包、固定响应）。
+    每个线程持有一个别名：和全局的引用指向同一个对象，但有自己的控制块，每个请求复制它时只修改本线程的计数，
+    不同的核不会争抢同一个缓存行。替换时由替换的线程清掉所有线程的别名，
+    空闲的线程不会一直拿着旧对象，旧的资源包在正在发送的响应都发完后就解除映射
+*/
+template <typename T>
+class shared_store{
+    public:
+        std::shared_ptr<const T> current(){ return std::atomic_load(&m_current); }
+        void replace(std::shared_ptr<const T> v);
+        // 当前线程的别名，替换后第一次调用时重新建立
+        std::shared_ptr<const T> local();
+
+    private:
+        struct slot{
+            locker m_lock; // 只有所属线程和替换的线程使用，基本没有争用
+            std::shared_ptr<const T> m_alias;
+            unsigned m_generation=0;
+        };
+        std::shared_ptr<const T> m_current;
+        std::atomic<unsigned> m_generation{0}; // 每次替换加一，没有对象时也不用每次都读全局的引用
+        locker m_slots_lock;
+        std::vector<slot *> m_slots;
+        static thread_local slot *t_slot;
+};
+
+template <typename T>
+thread_local typename shared_store<T>::slot *shared_store<T>::t_slot=NULL;
+
+template <typename T>
+void shared_store<T>::replace(std::shared_ptr<const T> v){
+    std::atomic_store(&m_current,v);
+    m_generation.fetch_add(1,std::memory_order_release);
+    std::vector<std::shared_ptr<const T>> old; // 在锁外释放，最后一个引用释放时可能要解除映射
+    m_slots_lock.lock();
+    for(size_t i=0;i<m_slots.size();i++){
+        slot *s=m_slots[i];
+        s->m_lock.lock();
+        old.push_back(std::move(s->m_alias));
+        s->m_alias.reset();
+        s->m_lock.unlock();
+    }
+    m_slots_lock.unlock();
+}
+
+template <typename T>
+std::shared_ptr<const T> shared_store<T>::local(){
+    slot *s=t_slot;
+    if(!s){ // 线程第一次使用时登记，线程不退出，不用注销
+        s=new slot();
+        m_slots_lock.lock();
+        m_slots.push_back(s);
+        m_slots_lock.unlock();
+        t_slot=s;
+    }
+    s->m_lock.lock();
+    unsigned g=m_generation.load(std::memory_order_acquire);
+    if(g!=s->m_generation || (!s->m_alias && g!=0)){
+        std::shared_ptr<const T> cur=current();
+        s->m_alias.reset();
+        if(cur){ // 新的控制块，删除器持有全局的引用
+            s->m_alias=std::shared_ptr<const T>(cur.get(),[cur](const T *){});
+        }
+        s->m_generation=g;
+    }
+    std::shared_ptr<const T> r=s->m_alias;
+    s->m_lock.unlock();
+    return r;
+}
+
+#endif
@@ -0,0 +1,244 @@
+#include "./config.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h> // getopt()
+#include <libgen.h> // basename()
+#include <string.h> // strcmp()
+#include <strings.h> // strcasecmp()
+
+config::config(){
+    m_port=-1;
+    m_doc_root="/home/parallels/Desktop/my_webserver/root";
+    m_bundle_populate=false;
+    m_bundle_hugepage=false;
+    m_io_threads=2;
+    m_autoindex=false;
+    m_edge_triggered=true;
+    m_inline_budget=64;
+    m_cores=0;
+    m_worker_spin_us=0;
+    m_busy_poll_us=0;
+    m_max_requests=1000;
+    m_access_log_rotate_mb=64;
+    // 内部接口没有访问控制，默认不提供
+    m_stats_path="";
+    m_profile_path="";
+    m_trace_every=1000;
+    m_slow_ms=0;
+    m_stall_ms=0;
+}
+
+int config::spin_us(int i) const{
+    if(m_spin_us.empty()){
+        return 0;
+    }
+    return i<(int)m_spin_us.size()?m_spin_us[i]:m_spin_us.back();
+}
+
+// 解析"50"或"50,0,20"形式的微秒数列表
+static bool parse_us_list(const char *s,std::vector<int> &out){
+    out.clear();
+    const char *p=s;
+    while(1){
+        char *end;
+        long v=strtol(p,&end,10);
+        if(end==p || v<0 || v>1000000){
+            return false;
+        }
+        out.push_back(v);
+        if(*end==','){
+            p=end+1;
+        }else{
+            return *end=='\0';
+        }
+    }
+}
+
+void config::usage(const char *prog){
+    std::cerr << "usage: " << basename((char *)prog) << " [options] port_number\n"
+              << "  -r doc_root    资源路径\n"
+              << "  -b bundle      从资源包提供服务（由packer生成，SIGHUP时重新加载）\n"
+              << "  -p             加载资源包时预先填充页表（MAP_POPULATE）\n"
+              << "  -H             资源包放入大页内存\n"
+              << "  -i io_threads  预读冷文件的I/O线程数，0表示不预读（默认2）\n"
+              << "  -l             请求目录时生成文件列表（分块传输）\n"
+              << "  -m LT|ET       触发模式：ET边缘触发，每个连接只注册一次（默认）；\n"
+              << "                 LT水平触发+EPOLLONESHOT，每个事件处理完都重新注册\n"
+              << "  -o             同-m LT\n"
+              << "  -f budget      主线程每轮直接处理的请求数上限（资源包、缓存命中），0表示全部交给线程池（默认64）\n"
+              << "  -s cores       shared-nothing模式：cores个线程各自监听（SO_REUSEPORT）、各自处理连接并绑定CPU，\n"
+              << "                 不使用线程池和I/O线程（-f、-i无效）\n"
+              << "  -R cpus        主线程绑定的CPU，如0或0-3,8\n"
+              << "  -W cpus        工作线程绑定的CPU；不指定而主线程绑定了时，用主线程所在NUMA节点的其他CPU\n"
+              << "  -q iface       主线程绑定到处理网卡iface中断最多的CPU（-R优先）\n"
+              << "  -S us[,us...]  事件循环阻塞前先自旋轮询最多us微秒（自适应缩短），第i个值给第i个循环\n"
+              << "                 （主线程为第0个，-s模式下为各个核），不够时用最后一个；0表示不自旋（默认）\n"
+              << "  -w us          线程池的线程睡眠前先自旋等任务us微秒（默认0）\n"
+              << "  -B us          开启内核忙轮询：连接设置SO_BUSY_POLL/SO_PREFER_BUSY_POLL，epoll设置忙轮询参数（需要网卡驱动支持）\n"
+              << "  -t opt=val,... TCP选项（默认backlog=4096,nodelay=1,incoming_cpu=1，其余不开）：\n"
+              << "                 backlog=n、defer=秒（TCP_DEFER_ACCEPT）、fastopen=队列长度、nodelay=0|1、\n"
+              << "                 cork=0|1（流式响应用TCP_CORK攒包）、sndbuf=字节、rcvbuf=字节、\n"
+              << "                 incoming_cpu=0|1（-s模式下按收包CPU分配连接）\n"
+              << "  -k requests    一个连接最多处理的请求数，之后的响应带Connection: close，0表示不限（默认1000）\n"
+              << "  -a path        二进制访问日志（用logview查看），SIGHUP时重新打开\n"
+              << "  -A mb          访问日志超过mb MB时轮转为path.1 ... path.4，0表示不轮转（默认64）\n"
+              << "  -M path        提供内部统计的路径（如/__stats，默认不提供），Prometheus文本格式，加?format=json为JSON\n"
+              << "  -P path        提供采样剖析的路径（如/__profile，默认不提供）：GET path?seconds=5&hz=99 按CPU时间\n"
+              << "                 对所有线程采样，返回带线程角色的折叠栈（flamegraph.pl可直接渲染）；\n"
+              << "                 在专门的剖析线程中进行，同时只能有一个\n"
+              << "  -e path        请求阶段追踪（连接、读取、排队、解析、处理、发送）写入path，Chrome trace-event格式，\n"
+              << "                 用Perfetto或chrome://tracing打开\n"
+              << "  -E n           每个线程每n个响应取一个追踪样本（默认1000）\n"
+              << "  -T ms          超过ms毫秒的慢请求打印各阶段耗时（每秒最多10条），开启了-e时也写入追踪\n"
+              << "  -C path        捕获收到的原始请求字节和到达时间写入path（覆盖），用tools/replay按原来的节奏重放\n"
+              << "  -D ms          卡顿监视：事件循环的一轮、线程池的一个任务超过ms毫秒时打印那个线程的调用栈和正在处理的请求\n"
+              << "                 （每秒最多10条），各角色的卡顿时长直方图加入内部统计；0表示不监视（默认）\n"
+              << "  SIGUSR1        打印每个事件循环的计数、自旋/空闲/处理时间占比、监听队列和连接复用率\n";
+}
+
+bool config::parse_arg(int argc,char *argv[]){
+    int opt;
+    // GNU getopt会把非选项参数（端口号）重排到最后，所以端口写在前后都可以
+    while((opt=getopt(argc,argv,"r:b:pHi:lm:of:s:R:W:q:S:w:B:t:k:a:A:M:P:e:E:T:C:D:"))!=-1){
+        switch(opt){
+            case 'r':
+                m_doc_root=optarg;
+                break;
+            case 'b':
+                m_bundle_path=optarg;
+                break;
+            case 'p':
+                m_bundle_populate=true;
+                break;
+            case 'H':
+                m_bundle_hugepage=true;
+                break;
+            case 'm':
+                if(strcasecmp(optarg,"ET")==0){
+                    m_edge_triggered=true;
+                }else if(strcasecmp(optarg,"LT")==0){
+                    m_edge_triggered=false;
+                }else{
+                    return false;
+                }
+                break;
+            case 'o':
+                m_edge_triggered=false;
+                break;
+            case 's':
+                m_cores=atoi(optarg);
+                if(m_cores<=0){
+                    return false;
+                }
+                break;
+            case 'R':
+                m_reactor_cpus=optarg;
+                break;
+            case 'W':
+                m_worker_cpus=optarg;
+                break;
+            case 'q':
+                m_nic=optarg;
+                break;
+            case 'S':
+                if(!parse_us_list(optarg,m_spin_us)){
+                    return false;
+                }
+                break;
+            case 'w':
+                m_worker_spin_us=atoi(optarg);
+                if(m_worker_spin_us<0){
+                    return false;
+                }
+                break;
+            case 't':{
+                std::string err;
+                if(!m_tcp.parse(optarg,err)){
+                    std::cerr << err << std::endl;
+                    return false;
+                }
+                break;
+            }
+            case 'k':
+                m_max_requests=atoi(optarg);
+                if(m_max_requests<0){
+                    return false;
+                }
+                break;
+            case 'a':
+                m_access_log=optarg;
+                break;
+            case 'A':
+                m_access_log_rotate_mb=atoi(optarg);
+                if(m_access_log_rotate_mb<0){
+                    return false;
+                }
+                break;
+            case 'M':
+                m_stats_path=strcmp(optarg,"off")==0?"":optarg;
+                if(!m_stats_path.empty() && m_stats_path[0]!='/'){
+                    return false;
+                }
+                break;
+            case 'P':
+                m_profile_path=strcmp(optarg,"off")==0?"":optarg;
+                if(!m_profile_path.empty() && m_profile_path[0]!='/'){
+                    return false;
+                }
+                break;
+            case 'e':
+                m_trace_path=optarg;
+                break;
+            case 'E':
+                m_trace_every=atoi(optarg);
+                if(m_trace_every<=0){
+                    return false;
+                }
+                break;
+            case 'C':
+                m_capture_path=optarg;
+                break;
+            case 'D':
+                m_stall_ms=atof(optarg);
+                if(m_stall_ms<0){
+                    return false;
+                }
+                break;
+            case 'T':
+                m_slow_ms=atof(optarg);
+                if(m_slow_ms<0){
+                    return false;
+                }
+                break;
+            case 'B':
+                m_busy_poll_us=atoi(optarg);
+                if(m_busy_poll_us<0){
+                    return false;
+                }
+                break;
+            case 'f':
+                m_inline_budget=atoi(optarg);
+                if(m_inline_budget<0){
+                    return false;
+                }
+                break;
+            case 'l':
+                m_autoindex=true;
+                break;
+            case 'i':
+                m_io_threads=atoi(optarg);
+                if(m_io_threads<0){
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    if(optind!=argc-1){
+        return false;
+    }
+    m_port=atoi(argv[optind]);
+    return m_port>0;
+}
@@ -0,0 +1,49 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+#include "../net/tcp_options.h"
+
+// 服务器启动参数，由命令行解析得到
+class config{
+    public:
+        config();
+
+        // 解析命令行：server.out [选项] port
+        // 解析失败返回false，调用者负责打印用法
+        bool parse_arg(int argc,char *argv[]);
+        static void usage(const char *prog);
+        // 第i个事件循环（主线程为0，shared-nothing模式下为各个核）的自旋时间
+        int spin_us(int i) const;
+
+        int m_port; // 监听端口
+        std::string m_doc_root; // 资源路径
+        std::string m_bundle_path; // 资源包路径，为空则直接从m_doc_root读文件
+        bool m_bundle_populate; // 加载资源包时预先建立全部页表（MAP_POPULATE）
+        bool m_bundle_hugepage; // 资源包放入大页内存
+        int m_io_threads; // 预读冷文件的I/O线程数，0表示不预读
+        bool m_autoindex; // 请求目录时生成文件列表
+        int m_cores; // shared-nothing模式的线程数（每个核一个独立的事件循环），0表示主线程+线程池
+        int m_inline_budget; // 主线程每轮epoll_wait最多直接处理的请求数，0表示全部交给线程池
+        std::string m_reactor_cpus; // 主线程的CPU列表，如"0"或"0-3,8"，为空则不绑定
+        std::string m_worker_cpus; // 工作线程（线程池、I/O线程、shared-nothing的各个核）的CPU列表
+        std::string m_nic; // 网卡名，主线程绑定到处理它中断的CPU
+        std::vector<int> m_spin_us; // 每个事件循环阻塞前自旋的微秒数，第i个给第i个循环，不够时用最后一个
+        int m_worker_spin_us; // 线程池的线程睡眠前自旋等任务的微秒数
+        int m_busy_poll_us; // 内核忙轮询（SO_BUSY_POLL）的微秒数，0表示不开
+        tcp_options m_tcp; // 监听套接字和连接的TCP选项
+        int m_max_requests; // 一个连接最多处理的请求数，0表示不限
+        std::string m_access_log; // 二进制访问日志的路径，为空则不记录
+        int m_access_log_rotate_mb; // 访问日志超过这么多MB就轮转，0表示不轮转
+        std::string m_stats_path; // 内部统计的路径，为空则不提供
+        std::string m_profile_path; // 采样剖析的路径，为空则不提供
+        std::string m_trace_path; // 请求阶段追踪的输出文件（Chrome trace-event格式），为空则不写
+        int m_trace_every; // 每个线程每多少个响应取一个追踪样本
+        double m_slow_ms; // 超过这么多毫秒的请求打印各阶段耗时（也写入追踪），0表示不检查
+        double m_stall_ms; // 事件循环的一轮或线程池的一个任务超过这么多毫秒算卡顿，打印调用栈，0表示不监视
+        std::string m_capture_path; // 流量捕获（收到的原始字节和到达时间）的输出文件，为空则不捕获
+        bool m_edge_triggered; // 触发模式：ET只注册一次（默认）；LT水平触发+EPOLLONESHOT，每个事件处理完都重新注册
+};
+
+#endif
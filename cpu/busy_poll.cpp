@@ -0,0 +1,125 @@
+#include "./busy_poll.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <iostream>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+// 旧的头文件中没有epoll的忙轮询参数，按内核的定义（include/uapi/linux/eventpoll.h）
+#ifndef EPIOCSPARAMS
+struct epoll_params{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPOLL_IOC_TYPE 0x8A
+#define EPIOCSPARAMS _IOW(EPOLL_IOC_TYPE,0x01,struct epoll_params)
+#endif
+
+#define BUSY_POLL_BUDGET 64 // 每次轮询最多处理的数据包数
+#define MIN_SPIN_US 1 // 自适应时自旋时间的下限
+
+uint64_t monotonic_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+busy_poll_stats::busy_poll_stats():m_spin_ns(0),m_idle_ns(0),m_polls(0),m_hits(0),m_sleeps(0),m_window_us(0){
+    m_start_ns=monotonic_ns();
+}
+
+busy_poller::busy_poller(int spin_us):m_max_spin_us(spin_us),m_spin_us(spin_us){
+    m_stats.m_window_us.store(spin_us,std::memory_order_relaxed);
+}
+
+int busy_poller::wait(int epollfd,epoll_event *events,int max,int timeout_ms){
+    uint64_t start=monotonic_ns();
+    if(m_max_spin_us>0){
+        uint64_t deadline=start+(uint64_t)m_spin_us*1000;
+        uint64_t polls=0;
+        uint64_t now;
+        while(1){
+            int n=epoll_wait(epollfd,events,max,0);
+            polls++;
+            now=monotonic_ns();
+            if(n!=0){
+                busy_poll_stats::add(m_stats.m_polls,polls);
+                busy_poll_stats::add(m_stats.m_spin_ns,now-start);
+                if(n>0){
+                    busy_poll_stats::add(m_stats.m_hits,1);
+                    // 自旋等到了事件，说明事件间隔比较短，下次可以多等一会
+                    m_spin_us=m_spin_us*2<m_max_spin_us?m_spin_us*2:m_max_spin_us;
+                    m_stats.m_window_us.store(m_spin_us,std::memory_order_relaxed);
+                }
+                return n;
+            }
+            if(now>=deadline){
+                break;
+            }
+            cpu_relax();
+        }
+        busy_poll_stats::add(m_stats.m_polls,polls);
+        busy_poll_stats::add(m_stats.m_spin_ns,now-start);
+        // 空闲期比自旋时间长，自旋只是浪费CPU，缩短下一次的自旋
+        m_spin_us=m_spin_us/2>MIN_SPIN_US?m_spin_us/2:MIN_SPIN_US;
+        m_stats.m_window_us.store(m_spin_us,std::memory_order_relaxed);
+        start=now;
+    }
+    int n=epoll_wait(epollfd,events,max,timeout_ms);
+    uint64_t idle=monotonic_ns()-start;
+    busy_poll_stats::add(m_stats.m_idle_ns,idle);
+    busy_poll_stats::add(m_stats.m_sleeps,1);
+    // 睡了不到最长自旋时间事件就来了，多自旋一会就能等到，把自旋时间加回去
+    if(m_max_spin_us>0 && idle<(uint64_t)m_max_spin_us*1000 && m_spin_us<m_max_spin_us){
+        m_spin_us=m_spin_us*2<m_max_spin_us?m_spin_us*2:m_max_spin_us;
+        m_stats.m_window_us.store(m_spin_us,std::memory_order_relaxed);
+    }
+    return n;
+}
+
+bool set_socket_busy_poll(int fd,int usec){
+    int one=1;
+    int budget=BUSY_POLL_BUDGET;
+    bool ok=setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,&usec,sizeof(usec))==0;
+    ok=setsockopt(fd,SOL_SOCKET,SO_PREFER_BUSY_POLL,&one,sizeof(one))==0 && ok;
+    ok=setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL_BUDGET,&budget,sizeof(budget))==0 && ok;
+    return ok;
+}
+
+bool set_epoll_busy_poll(int epollfd,int usec){
+    struct epoll_params p;
+    p.busy_poll_usecs=usec;
+    p.busy_poll_budget=BUSY_POLL_BUDGET;
+    p.prefer_busy_poll=1;
+    p.__pad=0;
+    return ioctl(epollfd,EPIOCSPARAMS,&p)==0;
+}
+
+void report_busy_poll(const char *name,const busy_poll_stats &st){
+    uint64_t total=monotonic_ns()-st.m_start_ns;
+    uint64_t spin=st.m_spin_ns.load(std::memory_order_relaxed);
+    uint64_t idle=st.m_idle_ns.load(std::memory_order_relaxed);
+    uint64_t busy=total>spin+idle?total-spin-idle:0;
+    uint64_t polls=st.m_polls.load(std::memory_order_relaxed);
+    uint64_t hits=st.m_hits.load(std::memory_order_relaxed);
+    uint64_t sleeps=st.m_sleeps.load(std::memory_order_relaxed);
+    char buf[256];
+    snprintf(buf,sizeof(buf),"%s: spin %.1f%% idle %.1f%% busy %.1f%%, polls %llu, spin hits %llu, sleeps %llu (hit rate %.1f%%), window %dus",
+             name,100.0*spin/total,100.0*idle/total,100.0*busy/total,
+             (unsigned long long)polls,(unsigned long long)hits,(unsigned long long)sleeps,
+             hits+sleeps?100.0*hits/(hits+sleeps):0.0,st.m_window_us.load(std::memory_order_relaxed));
+    std::cerr << buf << std::endl;
+}
@@ -0,0 +1,64 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <atomic>
+
+// 自旋等待时让出流水线，降低功耗，也让同一物理核上的另一个超线程跑得更快
+static inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+uint64_t monotonic_ns();
+
+// 事件循环的等待统计。只有所属线程修改，其他线程只读
+struct alignas(64) busy_poll_stats{
+    std::atomic<uint64_t> m_spin_ns; // 自旋轮询花的时间
+    std::atomic<uint64_t> m_idle_ns; // 阻塞在epoll_wait中的时间
+    std::atomic<uint64_t> m_polls; // timeout为0的epoll_wait次数
+    std::atomic<uint64_t> m_hits; // 自旋期间等到事件的次数
+    std::atomic<uint64_t> m_sleeps; // 阻塞等待的次数
+    std::atomic<int> m_window_us; // 当前的自旋时间
+    uint64_t m_start_ns; // 开始统计的时间，用来算处理事件的时间
+
+    busy_poll_stats();
+    static void add(std::atomic<uint64_t> &c,uint64_t v){ c.store(c.load(std::memory_order_relaxed)+v,std::memory_order_relaxed); }
+};
+
+/*
+    代替epoll_wait(epollfd,events,max,timeout_ms)的等待策略。
+    spin_us为0时直接阻塞；否则先用timeout为0的epoll_wait轮询最多spin_us微秒，
+    事件在这段时间内到达就省去了一次睡眠和唤醒。自旋时间是自适应的：
+    自旋到期还没有事件（空闲期比自旋时间长，白白烧CPU）就减半；
+    自旋期间等到了事件，或者睡眠不到spin_us事件就来了，就加倍，最多spin_us
+*/
+class busy_poller{
+    public:
+        explicit busy_poller(int spin_us);
+
+        int wait(int epollfd,epoll_event *events,int max,int timeout_ms=-1); // timeout_ms只限制阻塞的时间
+        const busy_poll_stats &stats() const { return m_stats; }
+
+    private:
+        int m_max_spin_us;
+        int m_spin_us;
+        busy_poll_stats m_stats;
+};
+
+/*
+    内核的忙轮询：socket上读不到数据时，在系统调用中直接轮询网卡队列，而不是等中断。
+    socket设置SO_BUSY_POLL（微秒）和SO_PREFER_BUSY_POLL；epoll实例用EPIOCSPARAMS（Linux 6.9）。
+    需要网卡驱动支持NAPI，内核不支持或没有权限时返回false，调用者只需要提示一次
+*/
+bool set_socket_busy_poll(int fd,int usec);
+bool set_epoll_busy_poll(int epollfd,int usec);
+
+// 打印一个事件循环的自旋、阻塞、处理事件的时间占比
+void report_busy_poll(const char *name,const busy_poll_stats &st);
+
+#endif
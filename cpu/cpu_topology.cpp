@@ -0,0 +1,361 @@
+#include "./cpu_topology.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <libgen.h> // basename()
+#include <limits.h> // PATH_MAX
+#include <pthread.h>
+#include <iostream>
+#include <set>
+#include <vector>
+
+bool parse_cpu_list(const char *s,cpu_set_t &set){
+    CPU_ZERO(&set);
+    const char *p=s;
+    while(*p){
+        char *end;
+        long a=strtol(p,&end,10);
+        if(end==p || a<0 || a>=CPU_SETSIZE){
+            return false;
+        }
+        long b=a;
+        p=end;
+        if(*p=='-'){
+            b=strtol(p+1,&end,10);
+            if(end==p+1 || b<a || b>=CPU_SETSIZE){
+                return false;
+            }
+            p=end;
+        }
+        for(long c=a;c<=b;c++){
+            CPU_SET(c,&set);
+        }
+        if(*p==','){
+            p++;
+        }else if(*p && *p!='\n'){
+            return false;
+        }else{
+            break;
+        }
+    }
+    return CPU_COUNT(&set)>0;
+}
+
+std::string format_cpu_list(const cpu_set_t &set){
+    std::string out;
+    char buf[32];
+    for(int c=0;c<CPU_SETSIZE;c++){
+        if(!CPU_ISSET(c,&set)){
+            continue;
+        }
+        int e=c;
+        while(e+1<CPU_SETSIZE && CPU_ISSET(e+1,&set)){
+            e++;
+        }
+        if(e==c){
+            snprintf(buf,sizeof(buf),"%d",c);
+        }else{
+            snprintf(buf,sizeof(buf),"%d-%d",c,e);
+        }
+        if(!out.empty()){
+            out+=',';
+        }
+        out+=buf;
+        c=e;
+    }
+    return out.empty()?"-":out;
+}
+
+void allowed_cpus(cpu_set_t &set){
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0,sizeof(set),&set)!=0 || CPU_COUNT(&set)==0){
+        CPU_SET(0,&set);
+    }
+}
+
+// 读取sysfs中的一行
+static bool read_line(const char *path,std::string &out){
+    FILE *fp=fopen(path,"r");
+    if(!fp){
+        return false;
+    }
+    char buf[4096];
+    bool ok=fgets(buf,sizeof(buf),fp)!=NULL;
+    fclose(fp);
+    if(ok){
+        out=buf;
+    }
+    return ok;
+}
+
+int cpu_node(int cpu){
+    char path[64];
+    snprintf(path,sizeof(path),"/sys/devices/system/cpu/cpu%d",cpu);
+    DIR *dir=opendir(path);
+    if(!dir){
+        return -1;
+    }
+    int node=-1;
+    struct dirent *de;
+    while((de=readdir(dir))!=NULL){
+        if(strncmp(de->d_name,"node",4)==0 && isdigit((unsigned char)de->d_name[4])){
+            node=atoi(de->d_name+4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool node_cpus(int node,cpu_set_t &set){
+    char path[64];
+    snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",node);
+    std::string line;
+    return read_line(path,line) && parse_cpu_list(line.c_str(),set);
+}
+
+bool bind_thread(const cpu_set_t &set){
+    return pthread_setaffinity_np(pthread_self(),sizeof(set),&set)==0;
+}
+
+// 设备目录下msi_irqs中的中断号（PCI设备，virtio网卡要看它的上一级）
+static void device_irqs(const std::string &dev,std::set<int> &irqs){
+    DIR *dir=opendir((dev+"/msi_irqs").c_str());
+    if(!dir){
+        return;
+    }
+    struct dirent *de;
+    while((de=readdir(dir))!=NULL){
+        if(isdigit((unsigned char)de->d_name[0])){
+            irqs.insert(atoi(de->d_name));
+        }
+    }
+    closedir(dir);
+}
+
+// name在desc中作为一个完整的词出现（后面不是数字），避免virtio3匹配到virtio30
+static bool has_name(const char *desc,const std::string &name){
+    if(name.empty()){
+        return false;
+    }
+    for(const char *p=strstr(desc,name.c_str());p;p=strstr(p+1,name.c_str())){
+        if(!isdigit((unsigned char)p[name.size()])){
+            return true;
+        }
+    }
+    return false;
+}
+
+int nic_irq_cpu(const char *iface,std::string &irqs){
+    irqs.clear();
+    std::string dev_name;
+    std::set<int> dev_irqs;
+    char link[PATH_MAX];
+    std::string dev=std::string("/sys/class/net/")+iface+"/device";
+    if(realpath(dev.c_str(),link)){
+        std::string real=link;
+        dev_name=basename(link);
+        device_irqs(real,dev_irqs);
+        device_irqs(real+"/..",dev_irqs);
+    }
+
+    FILE *fp=fopen("/proc/interrupts","r");
+    if(!fp){
+        return -1;
+    }
+    // 第一行是各列对应的CPU
+    std::vector<int> cols;
+    char line[8192];
+    if(fgets(line,sizeof(line),fp)){
+        for(char *tok=strtok(line," \t\n");tok;tok=strtok(NULL," \t\n")){
+            if(strncmp(tok,"CPU",3)==0){
+                cols.push_back(atoi(tok+3));
+            }
+        }
+    }
+    std::vector<unsigned long long> counts(CPU_SETSIZE,0);
+    int first_irq=-1;
+    while(fgets(line,sizeof(line),fp)){
+        char *p=line;
+        while(*p==' '){
+            p++;
+        }
+        if(!isdigit((unsigned char)*p)){ // NMI、LOC等不是设备中断
+            continue;
+        }
+        int irq=strtol(p,&p,10);
+        if(*p!=':'){
+            continue;
+        }
+        p++;
+        unsigned long long c[CPU_SETSIZE];
+        size_t n=0;
+        for(;n<cols.size();n++){
+            char *end;
+            c[n]=strtoull(p,&end,10);
+            if(end==p){
+                break;
+            }
+            p=end;
+        }
+        if(!dev_irqs.count(irq) && !has_name(p,iface) && !has_name(p,dev_name)){
+            continue;
+        }
+        char num[16];
+        snprintf(num,sizeof(num),"%s%d",irqs.empty()?"":",",irq);
+        irqs+=num;
+        if(first_irq==-1){
+            first_irq=irq;
+        }
+        for(size_t i=0;i<n;i++){
+            if(cols[i]>=0 && cols[i]<CPU_SETSIZE){
+                counts[cols[i]]+=c[i];
+            }
+        }
+    }
+    fclose(fp);
+    if(first_irq==-1){
+        return -1;
+    }
+    int best=-1;
+    for(int cpu=0;cpu<CPU_SETSIZE;cpu++){
+        if(counts[cpu]>0 && (best==-1 || counts[cpu]>counts[best])){
+            best=cpu;
+        }
+    }
+    if(best==-1){ // 还没有中断发生，按中断的亲和性
+        char path[64];
+        std::string aff;
+        cpu_set_t set;
+        snprintf(path,sizeof(path),"/proc/irq/%d/effective_affinity_list",first_irq);
+        if(read_line(path,aff) && parse_cpu_list(aff.c_str(),set)){
+            for(int cpu=0;cpu<CPU_SETSIZE && best==-1;cpu++){
+                if(CPU_ISSET(cpu,&set)){
+                    best=cpu;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+bool make_cpu_plan(const std::string &reactor_cpus,const std::string &worker_cpus,const std::string &nic,
+                   cpu_plan &plan,std::string &err){
+    cpu_set_t allowed;
+    allowed_cpus(allowed);
+    plan.m_bind_reactor=false;
+    plan.m_bind_workers=false;
+    CPU_ZERO(&plan.m_reactor);
+    CPU_ZERO(&plan.m_workers);
+    plan.m_nic_note.clear();
+
+    if(!reactor_cpus.empty()){
+        if(!parse_cpu_list(reactor_cpus.c_str(),plan.m_reactor)){
+            err="bad reactor cpu list: "+reactor_cpus;
+            return false;
+        }
+        plan.m_bind_reactor=true;
+    }
+    if(!nic.empty()){
+        std::string irqs;
+        int cpu=nic_irq_cpu(nic.c_str(),irqs);
+        if(cpu==-1){
+            plan.m_nic_note="nic "+nic+": no irq found";
+        }else{
+            plan.m_nic_note="nic "+nic+" irqs "+irqs+" -> cpu "+std::to_string(cpu);
+            if(!plan.m_bind_reactor && CPU_ISSET(cpu,&allowed)){ // 明确指定的CPU优先
+                CPU_SET(cpu,&plan.m_reactor);
+                plan.m_bind_reactor=true;
+            }
+        }
+    }
+    if(plan.m_bind_reactor){
+        CPU_AND(&plan.m_reactor,&plan.m_reactor,&allowed);
+        if(CPU_COUNT(&plan.m_reactor)==0){
+            err="reactor cpus not allowed for this process: "+reactor_cpus;
+            return false;
+        }
+    }
+
+    if(!worker_cpus.empty()){
+        if(!parse_cpu_list(worker_cpus.c_str(),plan.m_workers)){
+            err="bad worker cpu list: "+worker_cpus;
+            return false;
+        }
+        CPU_AND(&plan.m_workers,&plan.m_workers,&allowed);
+        if(CPU_COUNT(&plan.m_workers)==0){
+            err="worker cpus not allowed for this process: "+worker_cpus;
+            return false;
+        }
+        plan.m_bind_workers=true;
+    }else if(plan.m_bind_reactor){
+        // 工作线程放在主线程所在的节点上，尽量不和主线程挤在同一个CPU
+        int first=0;
+        while(!CPU_ISSET(first,&plan.m_reactor)){
+            first++;
+        }
+        cpu_set_t local;
+        int node=cpu_node(first);
+        if(node<0 || !node_cpus(node,local)){
+            local=allowed;
+        }
+        CPU_AND(&local,&local,&allowed);
+        CPU_XOR(&plan.m_workers,&local,&plan.m_reactor);
+        CPU_AND(&plan.m_workers,&plan.m_workers,&local);
+        if(CPU_COUNT(&plan.m_workers)==0){ // 节点上只有主线程的CPU，只能共用
+            plan.m_workers=local;
+        }
+        plan.m_bind_workers=true;
+    }
+    return true;
+}
+
+// CPU集合跨了哪些NUMA节点
+static std::string nodes_of(const cpu_set_t &set){
+    std::set<int> nodes;
+    for(int c=0;c<CPU_SETSIZE;c++){
+        if(CPU_ISSET(c,&set)){
+            nodes.insert(cpu_node(c));
+        }
+    }
+    std::string out;
+    for(std::set<int>::iterator it=nodes.begin();it!=nodes.end();++it){
+        if(!out.empty()){
+            out+=',';
+        }
+        out+=*it<0?"?":std::to_string(*it);
+    }
+    return out;
+}
+
+void report_cpu_plan(const cpu_plan &plan,const char *workers_desc){
+    cpu_set_t allowed;
+    allowed_cpus(allowed);
+    std::cerr << "cpu: allowed " << format_cpu_list(allowed) << " (node " << nodes_of(allowed) << ")" << std::endl;
+    for(int node=0;;node++){
+        cpu_set_t set;
+        if(!node_cpus(node,set)){
+            break;
+        }
+        std::cerr << "cpu: node " << node << ": " << format_cpu_list(set) << std::endl;
+    }
+    if(!plan.m_nic_note.empty()){
+        std::cerr << "cpu: " << plan.m_nic_note << std::endl;
+    }
+    if(plan.m_bind_reactor){
+        std::cerr << "cpu: reactor on " << format_cpu_list(plan.m_reactor)
+                  << " (node " << nodes_of(plan.m_reactor) << ")" << std::endl;
+    }else{
+        std::cerr << "cpu: reactor not bound" << std::endl;
+    }
+    if(plan.m_bind_workers){
+        std::cerr << "cpu: " << workers_desc << " on " << format_cpu_list(plan.m_workers)
+                  << " (node " << nodes_of(plan.m_workers) << ")" << std::endl;
+    }else{
+        std::cerr << "cpu: " << workers_desc << " not bound" << std::endl;
+    }
+}
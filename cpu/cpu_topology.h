@@ -0,0 +1,48 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <sched.h> // cpu_set_t
+#include <string>
+
+// 解析"0-3,8,10-11"形式的CPU列表（与/sys和taskset -c相同），格式不对返回false
+bool parse_cpu_list(const char *s,cpu_set_t &set);
+std::string format_cpu_list(const cpu_set_t &set);
+
+// 进程允许使用的CPU
+void allowed_cpus(cpu_set_t &set);
+// CPU所在的NUMA节点，不知道时返回-1
+int cpu_node(int cpu);
+// NUMA节点上的CPU
+bool node_cpus(int node,cpu_set_t &set);
+// 把当前线程绑定到set
+bool bind_thread(const cpu_set_t &set);
+
+/*
+    处理网卡iface中断最多的CPU，找不到返回-1。
+    按/proc/interrupts中的计数挑选，中断属于网卡的判断：描述里有网卡名或设备名（如virtio3），
+    或者中断号在设备的msi_irqs中。irqs返回找到的中断号，用于启动报告
+*/
+int nic_irq_cpu(const char *iface,std::string &irqs);
+
+/*
+    线程的放置方案：主线程（接受连接、分发事件）和工作线程（线程池、I/O线程、shared-nothing的各个核）
+    - 指定了CPU列表就用指定的
+    - 给了网卡时主线程放到处理网卡队列中断的CPU上，数据包的处理和读写在同一个核的缓存里
+    - 主线程绑定了而工作线程没有指定时，工作线程放在主线程所在NUMA节点的其他CPU上，
+      连接的内存不会在节点之间来回
+*/
+struct cpu_plan{
+    bool m_bind_reactor;
+    cpu_set_t m_reactor;
+    bool m_bind_workers;
+    cpu_set_t m_workers;
+    std::string m_nic_note; // 网卡中断的查找结果
+};
+
+// reactor_cpus、worker_cpus、nic为空表示不指定。失败时err说明原因
+bool make_cpu_plan(const std::string &reactor_cpus,const std::string &worker_cpus,const std::string &nic,
+                   cpu_plan &plan,std::string &err);
+// 启动时打印线程放到了哪些CPU、哪些NUMA节点上
+void report_cpu_plan(const cpu_plan &plan,const char *workers_desc);
+
+#endif
@@ -0,0 +1,56 @@
+#include "./arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <new> // std::bad_alloc
+
+const size_t arena::INLINE_SIZE;
+
+arena::arena():m_cur(m_inline),m_capacity(INLINE_SIZE),m_used(0),m_blocks(NULL){
+}
+
+arena::~arena(){
+    reset();
+}
+
+void *arena::alloc(size_t n,size_t align){
+    size_t off=(m_used+align-1)&~(align-1);
+    if(off+n>m_capacity){
+        // 至少翻倍，连续的小分配不会每次都malloc
+        size_t cap=m_capacity*2;
+        if(cap<n+align){
+            cap=n+align;
+        }
+        block *b=(block *)malloc(sizeof(block)+cap);
+        if(!b){
+            throw std::bad_alloc();
+        }
+        b->m_next=m_blocks;
+        b->m_capacity=cap;
+        m_blocks=b;
+        m_cur=(char *)(b+1);
+        m_capacity=cap;
+        off=0; // 块的数据区和malloc的结果一样按16字节对齐
+    }
+    m_used=off+n;
+    return m_cur+off;
+}
+
+std::string_view arena::concat(std::string_view a,std::string_view b){
+    char *p=(char *)alloc(a.size()+b.size()+1,1);
+    memcpy(p,a.data(),a.size());
+    memcpy(p+a.size(),b.data(),b.size());
+    p[a.size()+b.size()]='\0';
+    return std::string_view(p,a.size()+b.size());
+}
+
+void arena::reset(){
+    while(m_blocks){
+        block *next=m_blocks->m_next;
+        free(m_blocks);
+        m_blocks=next;
+    }
+    m_cur=m_inline;
+    m_capacity=INLINE_SIZE;
+    m_used=0;
+}
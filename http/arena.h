@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <string_view>
+
+/*
+    连接的请求内存：只分配不释放，reset()时整体清空。
+    先用嵌在对象里的一块，不够时再从堆上分配后续的块，reset()时释放。
+    请求的数据（拼接出的文件路径等）放在这里，普通大小的请求不调用malloc
+*/
+class arena{
+    public:
+        arena();
+        ~arena();
+        arena(const arena &)=delete;
+        arena &operator=(const arena &)=delete;
+
+        void *alloc(size_t n,size_t align=sizeof(void *)); // align是2的幂，不超过16
+        // 拼接a和b，以'\0'结尾
+        std::string_view concat(std::string_view a,std::string_view b);
+        void reset();
+        size_t used() const { return m_used; } // 当前块已用的字节数
+
+        static const size_t INLINE_SIZE=1024;
+
+    private:
+        struct block{
+            block *m_next;
+            size_t m_capacity;
+            // 数据紧跟在后面
+        };
+
+        alignas(16) char m_inline[INLINE_SIZE];
+        char *m_cur; // 当前块的数据区
+        size_t m_capacity; // 当前块的大小
+        size_t m_used;
+        block *m_blocks; // 堆上分配的块，最新的在前
+};
+
+#endif
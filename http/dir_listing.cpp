@@ -0,0 +1,88 @@
+#include "./dir_listing.h"
+
+#include <ctype.h>
+
+// 转义HTML中的特殊字符
+static void append_html(std::string &out,const char *s){
+    for(;*s;s++){
+        switch(*s){
+            case '&': out+="&amp;"; break;
+            case '<': out+="&lt;"; break;
+            case '>': out+="&gt;"; break;
+            case '"': out+="&quot;"; break;
+            default: out+=*s;
+        }
+    }
+}
+
+// url中除了非保留字符和'/'之外都用%XX编码
+static void append_url(std::string &out,const char *s){
+    static const char hex[]="0123456789ABCDEF";
+    for(;*s;s++){
+        unsigned char c=*s;
+        if(isalnum(c) || c=='-' || c=='_' || c=='.' || c=='~' || c=='/'){
+            out+=c;
+        }else{
+            out+='%';
+            out+=hex[c>>4];
+            out+=hex[c&0xf];
+        }
+    }
+}
+
+dir_listing *dir_listing::open(const char *path,const char *url){
+    DIR *dir=opendir(path);
+    if(!dir){
+        return NULL;
+    }
+    return new dir_listing(dir,url);
+}
+
+dir_listing::dir_listing(DIR *dir,const char *url):m_dir(dir),m_url(url),m_started(false){
+    if(m_url.empty() || m_url[m_url.size()-1]!='/'){
+        m_url+='/';
+    }
+}
+
+dir_listing::~dir_listing(){
+    closedir(m_dir);
+}
+
+bool dir_listing::produce(http_conn &conn){
+    m_buf.clear();
+    if(!m_started){
+        m_buf+="<html><head><title>Index of ";
+        append_html(m_buf,m_url.c_str());
+        m_buf+="</title></head><body><h1>Index of ";
+        append_html(m_buf,m_url.c_str());
+        m_buf+="</h1><ul>\n";
+        m_started=true;
+    }
+    for(int i=0;i<ENTRIES_PER_CHUNK;i++){
+        struct dirent *de=readdir(m_dir);
+        if(!de){
+            m_buf+="</ul></body></html>\n";
+            conn.write_chunk(m_buf.data(),m_buf.size());
+            conn.end_chunked();
+            return true;
+        }
+        if(de->d_name[0]=='.'){ // 不列出隐藏文件和./..
+            continue;
+        }
+        bool is_dir=de->d_type==DT_DIR;
+        m_buf+="<li><a href=\"";
+        append_url(m_buf,m_url.c_str());
+        append_url(m_buf,de->d_name);
+        if(is_dir){
+            m_buf+='/';
+        }
+        m_buf+="\">";
+        append_html(m_buf,de->d_name);
+        if(is_dir){
+            m_buf+='/';
+        }
+        m_buf+="</a></li>\n";
+    }
+    conn.write_chunk(m_buf.data(),m_buf.size());
+    return true;
+}
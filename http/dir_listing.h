@@ -0,0 +1,29 @@
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+#include <dirent.h>
+#include <string>
+
+#include "./http_conn.h"
+
+// 目录的文件列表页面，边读目录边分块发送，大目录也不需要先整个生成出来
+class dir_listing:public stream_source{
+    public:
+        // 打不开目录时返回NULL
+        static dir_listing *open(const char *path,const char *url);
+        ~dir_listing();
+
+        bool produce(http_conn &conn);
+
+    private:
+        dir_listing(DIR *dir,const char *url);
+
+        static const int ENTRIES_PER_CHUNK=64; // 每块最多多少个目录项
+
+        DIR *m_dir;
+        std::string m_url; // 以'/'结尾
+        bool m_started; // 是否已经发送了页面开头
+        std::string m_buf; // 拼接当前块，复用内存
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "./file_cache.h"
+
+#include <time.h>
+
+file_cache file_cache::m_shared;
+thread_local file_cache *file_cache::m_local=NULL;
+
+file_cache::file_cache():m_bytes(0){
+}
+
+// 粗粒度的单调时钟，只需要秒
+static long now_sec(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+    return ts.tv_sec;
+}
+
+static bool same_file(ino_t ino,off_t size,const struct timespec &mtime,const struct stat &st){
+    return ino==st.st_ino && size==st.st_size
+        && mtime.tv_sec==st.st_mtim.tv_sec && mtime.tv_nsec==st.st_mtim.tv_nsec;
+}
+
+bool file_cache::find(std::string_view url,entry &e){
+    long now=now_sec();
+    m_lock.lock();
+    std::unordered_map<std::string_view,item>::iterator it=m_items.find(url);
+    bool hit=it!=m_items.end() && it->second.m_expire>now;
+    if(hit){
+        e=it->second.m_entry;
+    }
+    m_lock.unlock();
+    return hit;
+}
+
+bool file_cache::revalidate(std::string_view url,const struct stat &st,entry &e){
+    bool ok=false;
+    m_lock.lock();
+    std::unordered_map<std::string_view,item>::iterator it=m_items.find(url);
+    if(it!=m_items.end() && same_file(it->second.m_ino,it->second.m_size,it->second.m_mtime,st)){
+        it->second.m_expire=now_sec()+FILE_CACHE_TTL;
+        e=it->second.m_entry;
+        ok=true;
+    }
+    m_lock.unlock();
+    return ok;
+}
+
+void file_cache::insert(std::string_view url,const struct stat &st,const entry &e){
+    if(e.size>FILE_CACHE_MAX_FILE){
+        return;
+    }
+    long now=now_sec();
+    m_lock.lock();
+    std::unordered_map<std::string_view,item>::iterator it=m_items.find(url);
+    if(it!=m_items.end()){ // 文件变了，替换旧的映射
+        m_bytes-=it->second.m_entry.size;
+        m_items.erase(it);
+    }
+    if(m_bytes+e.size>FILE_CACHE_MAX_BYTES){
+        for(it=m_items.begin();it!=m_items.end();){
+            if(it->second.m_expire<=now){
+                m_bytes-=it->second.m_entry.size;
+                it=m_items.erase(it);
+            }else{
+                ++it;
+            }
+        }
+    }
+    if(m_bytes+e.size<=FILE_CACHE_MAX_BYTES){
+        std::unique_ptr<std::string> key(new std::string(url));
+        std::string_view k(*key);
+        item &i=m_items[k];
+        i.m_url=std::move(key);
+        i.m_entry=e;
+        i.m_ino=st.st_ino;
+        i.m_size=st.st_size;
+        i.m_mtime=st.st_mtim;
+        i.m_expire=now+FILE_CACHE_TTL;
+        m_bytes+=e.size;
+    }
+    m_lock.unlock();
+}
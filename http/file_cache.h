@@ -0,0 +1,63 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../lock/locker.h"
+
+#define FILE_CACHE_MAX_FILE (64*1024) // 只缓存不超过这个大小的文件
+#define FILE_CACHE_MAX_BYTES (64*1024*1024) // 所有缓存文件的总大小
+#define FILE_CACHE_TTL 1 // 条目不检查文件就直接使用的时间（秒）
+
+/*
+    小文件的映射缓存：url -> 文件的映射。
+    主线程的快速路径只查这个缓存，不访问文件系统。条目在FILE_CACHE_TTL秒内直接使用，
+    过期后由工作线程重新stat：文件没变就续期，变了就重新映射。
+    映射由引用计数管理，条目被替换时正在发送的响应仍然持有旧的映射。
+    默认所有线程共用一份；shared-nothing模式下每个线程有自己的分片，互不访问
+*/
+class file_cache{
+    public:
+        struct entry{
+            const char *data;
+            size_t size;
+            std::shared_ptr<const void> owner;
+        };
+
+        file_cache();
+
+        // 查找没有过期的条目，查找不分配内存
+        bool find(std::string_view url,entry &e);
+        // 过期的条目：文件的inode、大小、修改时间都没变时续期并返回true
+        bool revalidate(std::string_view url,const struct stat &st,entry &e);
+        // 缓存满了并且清掉过期条目后仍然放不下时不缓存
+        void insert(std::string_view url,const struct stat &st,const entry &e);
+
+        // 当前线程使用的缓存：设置了本线程的分片就用分片，否则用共享的那一份
+        static file_cache &local(){ return m_local?*m_local:m_shared; }
+        static void set_local(file_cache *shard){ m_local=shard; }
+
+    private:
+        struct item{
+            std::unique_ptr<std::string> m_url; // 表的键指向这里，unique_ptr移动时字符串的内存不动
+            entry m_entry;
+            ino_t m_ino;
+            off_t m_size;
+            struct timespec m_mtime;
+            long m_expire; // 单调时钟的秒数
+        };
+
+        std::unordered_map<std::string_view,item> m_items;
+        size_t m_bytes;
+        locker m_lock; // 分片只有一个线程访问，加锁没有竞争
+
+        static file_cache m_shared;
+        static thread_local file_cache *m_local;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "./fixed_response.h"
+#include "./response_header.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// 定义http响应的一些状态信息
+static const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
+static const char *error_403_form = "You do not have permission to get file form this server.\n";
+static const char *error_404_form = "The requested file was not found on this server.\n";
+static const char *error_500_form = "There was an unusual problem serving the request file.\n";
+static const char *ok_empty_form = "<html><body></body></html>";
+
+shared_store<fixed_response_set> fixed_response_store::m_store;
+
+std::shared_ptr<const fixed_response_set> fixed_response_store::current(){
+    return m_store.current();
+}
+
+void fixed_response_store::replace(std::shared_ptr<const fixed_response_set> s){
+    m_store.replace(s);
+}
+
+std::shared_ptr<const fixed_response_set> fixed_response_store::local(){
+    return m_store.local();
+}
+
+// 读取自定义错误页：有资源包时从资源包中找，否则读doc root下的文件
+static bool load_page(const std::string &doc_root,const bundle *b,const char *path,std::string &out){
+    if(b){
+        bundle::asset a;
+        if(!b->find(path,strlen(path),a)){
+            return false;
+        }
+        out.assign(a.data,a.size);
+        return true;
+    }
+    FILE *fp=fopen((doc_root+path).c_str(),"rb");
+    if(!fp){
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    out.clear();
+    while((n=fread(buf,1,sizeof(buf),fp))>0){
+        out.append(buf,n);
+    }
+    fclose(fp);
+    return true;
+}
+
+static void serialize(fixed_response_set::blob &out,int status,const std::string &body,bool keep_alive){
+    char buf[256];
+    header_builder h(buf,sizeof(buf));
+    h.status_line(status);
+    out.head.assign(buf,h.size());
+
+    h.reset();
+    h.append("Content-Type: text/html\r\n");
+    h.header_uint("Content-Length",14,body.size());
+    if(keep_alive){
+        h.append("Connection: keep-alive\r\n");
+    }else{
+        h.append("Connection: close\r\n");
+    }
+    h.end();
+    out.tail.assign(buf,h.size());
+    out.tail+=body;
+}
+
+std::shared_ptr<const fixed_response_set> fixed_response_set::build(const std::string &doc_root,const bundle *b){
+    static const struct{
+        FIXED_RESPONSE kind;
+        int status;
+        const char *page; // 自定义页面路径
+        const char *form; // 默认正文
+    } table[FIXED_RESPONSE_COUNT]={
+        {FIXED_EMPTY_OK,200,NULL,ok_empty_form},
+        {FIXED_BAD_REQUEST,400,"/400.html",error_400_form},
+        {FIXED_FORBIDDEN,403,"/403.html",error_403_form},
+        {FIXED_NOT_FOUND,404,"/404.html",error_404_form},
+        {FIXED_INTERNAL_ERROR,500,"/500.html",error_500_form},
+    };
+    std::shared_ptr<fixed_response_set> s(new fixed_response_set());
+    for(int i=0;i<FIXED_RESPONSE_COUNT;i++){
+        std::string body;
+        if(!table[i].page || !load_page(doc_root,b,table[i].page,body)){
+            body=table[i].form;
+        }
+        serialize(s->m_blobs[table[i].kind][0],table[i].status,body,false);
+        serialize(s->m_blobs[table[i].kind][1],table[i].status,body,true);
+    }
+    return s;
+}
@@ -0,0 +1,51 @@
+#ifndef FIXED_RESPONSE_H
+#define FIXED_RESPONSE_H
+
+#include <string>
+#include <memory>
+
+#include "../bundle/bundle.h"
+
+// 内容固定的响应，启动时（以及SIGHUP时）整体序列化好，之后按引用发送
+enum FIXED_RESPONSE{
+    FIXED_EMPTY_OK, // 空文件：<html><body></body></html>
+    FIXED_BAD_REQUEST, // 400
+    FIXED_FORBIDDEN, // 403
+    FIXED_NOT_FOUND, // 404
+    FIXED_INTERNAL_ERROR, // 500
+    FIXED_RESPONSE_COUNT
+};
+
+/*
+    一组预先生成的响应，每种分keep-alive和close两个版本。
+    Date头部每秒都在变，所以不放进去：一个响应拆成两段，
+    head是状态行，tail是其余头部、空行和正文，发送时在中间插入线程缓存的Date行
+*/
+class fixed_response_set{
+    public:
+        struct blob{
+            std::string head;
+            std::string tail;
+        };
+
+        // 错误页优先使用资源包或doc root中的/400.html、/403.html、/404.html、/500.html
+        static std::shared_ptr<const fixed_response_set> build(const std::string &doc_root,const bundle *b);
+
+        const blob &get(FIXED_RESPONSE r,bool keep_alive) const { return m_blobs[r][keep_alive?1:0]; }
+
+    private:
+        blob m_blobs[FIXED_RESPONSE_COUNT][2];
+};
+
+// 当前生效的固定响应，与bundle_store一样整体原子替换
+class fixed_response_store{
+    public:
+        static std::shared_ptr<const fixed_response_set> current();
+        static void replace(std::shared_ptr<const fixed_response_set> s);
+        static std::shared_ptr<const fixed_response_set> local(); // 见bundle_store::local()
+
+    private:
+        static shared_store<fixed_response_set> m_store;
+};
+
+#endif
@@ -1,43 +1,130 @@
 
 
 #include "./http_conn.h"
-
-const std::string doc_root="/home/parallels/Desktop/my_webserver/root"; // 资源路径
-// 定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
-const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
-const char *error_403_title = "Forbidden";
-const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
-const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
-const char *error_500_form = "There was an unusual problem serving the request file.\n";
+#include "./page_cache.h"
+#include "./dir_listing.h"
+#include "../net/tcp_options.h"
+#include "../log/probes.h"
+#include "../log/profiler.h"
+#include "../log/watchdog.h"
+#include <strings.h> // strncasecmp()
+#include <assert.h>
+#include <iostream>
+#include <vector>
 
 // 静态成员变量必须在类外部进行定义，并且在类内部进行声明
-int http_conn::m_epollfd=-1;
-int http_conn::m_conn_count=0;
+std::atomic<int> http_conn::m_conn_count(0);
+std::atomic<int> http_conn::m_draining_conns(0);
+std::string http_conn::m_doc_root;
+threadpool<prefetch_task> *http_conn::m_io_pool=NULL;
+threadpool<http_conn> *http_conn::m_pool=NULL;
+bool http_conn::m_edge_triggered=true;
+bool http_conn::m_tcp_cork=false;
+int http_conn::m_max_requests=0;
+bool http_conn::m_autoindex=false;
+int http_conn::m_inline_budget=0;
+std::string http_conn::m_stats_path;
+std::string http_conn::m_profile_path;
+
+http_conn::http_conn():m_state(STATE_CLOSED),m_drain_deadline(0),m_capture_id(0),m_header(NULL,0){ // 按声明顺序
+    m_prefetch.m_conn=this;
+    m_profile.m_conn=this;
+}
+
+void prefetch_task::process(){
+    m_conn->prefetch();
+}
 
-void http_conn::init(int sockfd, const sockaddr_in &addr){
+void profile_task::finish(bool ok,std::string &out,const std::string &err){
+    m_conn->profile_done(ok,out,err);
+}
+
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd){
     m_sockfd=sockfd;
+    m_epollfd=epollfd;
     m_address=addr;
     m_conn_count++;
-    m_et_mode=false;
+    m_et_mode=m_edge_triggered;
+    m_readable=false;
+    m_writable=true; // 新连接的发送缓冲区是空的
+    m_draining=false;
+    m_drain_deadline.store(0,std::memory_order_relaxed);
     init();
+    if(trace_log::enabled()){
+        m_times.m_accept=monotonic_ns();
+    }
+    m_capture_id=capture_log::enabled()?capture_log::open_conn():0;
+    WS_PROBE3(conn_accept,sockfd,addr.sin_addr.s_addr,ntohs(addr.sin_port));
+    m_state.store(0,std::memory_order_release);
 }
 
 void http_conn::init(){
     m_read_idx=0;
-    m_write_idx=0;
+    m_served=0;
+    m_log_pending=false;
+    // 每个请求在解析请求行时按版本重新确定，不能在reset_request()中清掉：上一个响应可能还没发完
+    m_linger=false;
     memset(m_read_buf,'\0',READ_BUFFER_SIZE);
-    memset(m_write_buf,'\0',WRITE_BUFFER_SIZE);
+    m_pipelined=false;
+    m_out.clear();
+    reset_request();
+}
+
+void http_conn::reset_request(){
     m_parse_state=PARSE_STATE_LINE;
     m_body_len=0;
     m_check_idx=0;
     m_start_line=0;
-    m_iov_count=0;
-    bytes_to_send=0;
-    bytes_have_send=0;
+    m_request_end=0;
+    m_inline=false;
+    m_async_ret=NO_REQUEST;
+    m_http11=true;
+    m_chunked=true;
+    m_stream.reset();
+    m_stream_done=false;
+    m_file_address=NULL;
+    m_file_size=0;
+    m_file_owner.reset();
+    m_cold=false;
+    m_content_type="text/html";
+    m_content_type_len=9;
+    m_etag=NULL;
+    m_etag_len=0;
+    m_accept_gzip=false;
+    m_gzip=false;
+    m_etag_gz=false;
+    m_vary=false;
+    m_url=std::string_view();
+    m_version=std::string_view();
+    m_real_file=std::string_view();
+    m_if_none_match=std::string_view();
+    m_method=GET;
+    memset(&m_times,0,sizeof(m_times));
+    m_status=0;
+    m_arena.reset(); // 上一个请求的数据都不再使用，响应引用的是文件和输出队列自己的内存
+}
+
+/*
+    客户端可以不等响应就连续发送多个请求（流水线），一次read()可能读到不止一个请求。
+    响应发送完后把下一个请求的数据移到缓冲区开头，由run()接着处理：
+    边缘触发下这些数据不会再产生可读事件，不能等epoll通知。
+    请求的边界不在已读的数据内时（Content-Length不对）不移动，返回false，调用者关闭连接
+*/
+bool http_conn::next_request(){
+    if(m_request_end<0 || m_request_end>m_read_idx){
+        return false;
+    }
+    int left=m_read_idx-m_request_end;
+    if(left>0){
+        memmove(m_read_buf,m_read_buf+m_request_end,left);
+    }else{
+        left=0;
+    }
+    memset(m_read_buf+left,'\0',READ_BUFFER_SIZE-left);
+    m_read_idx=left;
+    m_pipelined=left>0;
+    reset_request();
+    return true;
 }
 
 // 对文件描述符设置非阻塞
@@ -80,6 +167,10 @@ void addfd(int epollfd,int fd,bool one_shot,bool et_mode){
     epoll_event ev;
     ev.data.fd=fd;
     ev.events=EPOLLIN | EPOLLRDHUP; // 检测：数据可读 ｜ 对方关闭连接的写半部分
+    if(!one_shot && et_mode){
+        // 只注册一次的边缘触发连接同时监听可写，之后不再修改
+        ev.events |= EPOLLOUT;
+    }
     if(one_shot){
         /* 设置某个文件描述符的事件为一次性的。
         这意味着一旦这个文件描述符上的事件被触发，它仍被保留在epoll集合中，但需要修改设置才能继续监视。
@@ -111,11 +202,13 @@ void modfd(int epollfd,int fd,int flag,bool et_mode){
 
 // 循环读取客户数据，直到无数据可读或者对方关闭连接
 bool http_conn::read() {
-    if( m_read_idx >= READ_BUFFER_SIZE ) {
-        return false;
-    }
     int bytes_read = 0;
     while(1) {
+        if( m_read_idx >= READ_BUFFER_SIZE ) {
+            // 缓冲区满了，socket中可能还有数据。边缘触发下不会再有通知，处理完当前请求后再接着读
+            m_readable=true;
+            break;
+        }
 /*
     ssize_t recv(int sockfd, void *buf, size_t len, int flags);
     -flags：用于控制接收操作的行为
@@ -136,101 +229,388 @@ bool http_conn::read() {
         } else if (bytes_read == 0) {   // 对方关闭连接
             return false;
         }
+        if(m_capture_id && !capture_log::data(m_capture_id,m_read_buf+m_read_idx,bytes_read)){
+            m_capture_id=0; // 环满了，这个连接之后的数据不再捕获
+        }
         m_read_idx += bytes_read;
+        if(m_times.m_read==0 && trace_log::enabled()){ // 请求的第一批数据
+            m_times.m_read=monotonic_ns();
+        }
     }
-    printf("%s",m_read_buf);
     return true;
 }
 
-// 将http响应内容写入文件描述符
-bool http_conn::write(){
-    if (bytes_to_send == 0){
-        modfd(m_epollfd, m_sockfd, EPOLLIN,m_et_mode); // 继续监听有无请求
-        init();
-        return true;
-    }
-    int ret;
-    while(1){   
 /*
-    ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
-    fd：要写入的文件描述符
-    iov：一个指向 iovec 结构体数组的指针，每个 iovec 结构体描述了一个要写入的内存块的位置和大小
-    iovcnt：表示 iov 数组中的 iovec 结构体的数量
-    返回成功写入的字节数，如果出现错误，则返回 -1 并设置 errno
+    连接的状态机（m_state），保证任一时刻只有一个线程访问http_conn：
+    - STATE_CLOSED：没有连接
+    - 0：空闲，等待事件
+    - STATE_BUSY：某个线程（主线程、工作线程或I/O线程）正在处理，只有它能访问连接
+    - PENDING_IN/PENDING_OUT：处理期间主线程又收到了可读/可写事件，由持有者在释放前接着处理
+
+    默认每个连接只注册一次（EPOLLIN|EPOLLOUT|EPOLLET），之后不再epoll_ctl：
+    事件到达时如果连接空闲，主线程直接接手；如果正忙，只是置上PENDING位，
+    持有者释放时发现有新事件就继续处理。所有交接都通过原子操作完成，不需要重新注册。
+    m_edge_triggered为false时使用水平触发+EPOLLONESHOT，每次处理完用modfd()重新注册
 */
-        // 把缓冲区中的数据写入文件描述符
-        ret=writev(m_sockfd,m_iov,m_iov_count);
-        if(ret==-1){
-            if( errno == EAGAIN || errno == EWOULDBLOCK ){
-                modfd(m_epollfd, m_sockfd, EPOLLOUT,m_et_mode); // 继续监听有无要继续发送的数据
-                return true;
-            }
-            munmap(m_file_address, m_file_info.st_size); // 解除内存映射
+bool http_conn::acquire(uint32_t pending){
+    uint32_t s=m_state.load(std::memory_order_acquire);
+    while(1){
+        if(s & STATE_CLOSED){ // 连接已经关闭，是过期的事件
             return false;
         }
-
-        bytes_have_send+=ret;
-        bytes_to_send-=ret;
-        if(bytes_to_send==0){ // 全部发送完毕
-            munmap(m_file_address, m_file_info.st_size);
-            modfd(m_epollfd, m_sockfd, EPOLLIN,m_et_mode); 
-            if (m_linger){
-                init();
-                return true;
-            }else{
+        if(s & STATE_BUSY){ // 有线程正在处理，留给它
+            if(m_state.compare_exchange_weak(s,s|pending,std::memory_order_acq_rel)){
                 return false;
             }
+            continue;
+        }
+        if(m_state.compare_exchange_weak(s,STATE_BUSY,std::memory_order_acq_rel)){
+            take_pending(pending);
+            return true;
+        }
+    }
+}
+
+void http_conn::take_pending(uint32_t pending){
+    if(pending & PENDING_IN){
+        m_readable=true;
+    }
+    if(pending & PENDING_OUT){
+        m_writable=true;
+    }
+}
+
+// 没有新事件就释放连接，返回false；有新事件则接着持有，返回true
+bool http_conn::release(){
+    if(!m_edge_triggered){
+        int fd=m_sockfd;
+        int ev=m_out.empty()?EPOLLIN:EPOLLOUT;
+        m_state.store(0,std::memory_order_release);
+        modfd(m_epollfd, fd, ev, m_et_mode); // 注册之后就不能再访问这个连接了
+        return false;
+    }
+    uint32_t s=STATE_BUSY;
+    if(m_state.compare_exchange_strong(s,0,std::memory_order_acq_rel)){
+        return false;
+    }
+    s=m_state.exchange(STATE_BUSY,std::memory_order_acq_rel);
+    take_pending(s);
+    return true;
+}
+
+// 主线程收到事件
+void http_conn::on_event(uint32_t events){
+    uint32_t pending=0;
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+        pending|=PENDING_IN;
+    }
+    if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR)){
+        pending|=PENDING_OUT;
+    }
+    if(acquire(pending)){
+        run(true);
+    }
+}
+
+/*
+    持有连接的线程根据就绪状态处理，直到没有事情可做再释放：
+    先把待发送的数据写完，再读新的请求。
+    主线程读完请求后先自己解析，资源包或文件缓存命中时直接生成响应并发送，
+    要访问文件系统或者本轮预算用完时才交给线程池，由工作线程处理并直接发送
+*/
+void http_conn::run(bool in_reactor){
+    watchdog::current(m_sockfd,m_url); // 持有连接之后才能读m_url，之前可能正被其他线程修改
+    while(1){
+        if(m_writable && !m_out.empty()){
+            if(!send()){
+                close_conn();
+                return;
+            }
+        }
+        if(m_draining){ // 不再处理请求，流水线上没处理的请求也丢弃
+            m_readable=false;
+            if(!drain()){
+                close_conn();
+                return;
+            }
+            if(!release()){
+                return;
+            }
+            continue;
+        }
+        // 输出队列发完才处理下一个请求，保证流水线上的响应按顺序发送
+        if((m_readable || m_pipelined) && m_out.empty()){
+            if(m_readable){
+                m_readable=false; // read()会一直读到EAGAIN
+                if(!read()){
+                    close_conn();
+                    return;
+                }
+            }
+            m_pipelined=false;
+            if(!handle_request(in_reactor)){ // 交给了其他线程或者连接已关闭
+                return;
+            }
+            continue;
         }
+        if(!release()){
+            return;
+        }
+    }
+}
 
-        if (bytes_have_send >= m_iov[0].iov_len){ // m_iov[0]发送完了
-            m_iov[0].iov_len = 0;
-            m_iov[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iov[1].iov_len = bytes_to_send;
-        }else{
-            m_iov[0].iov_base = m_write_buf + bytes_have_send;
-            m_iov[0].iov_len = m_iov[0].iov_len - bytes_have_send;
+/*
+    把输出队列写入socket，流式响应边生成边写。返回false表示连接要关闭
+    流式响应每次生成的数据不一定是整包，打开了m_tcp_cork时发送期间塞住连接，攒满整包再发；
+    返回前一定拔掉，否则最后不满一包的数据要等200ms
+*/
+bool http_conn::send(){
+    bool corked=m_tcp_cork && m_stream && !m_stream_done;
+    if(corked){
+        set_cork(m_sockfd,true);
+    }
+    while(1){
+        int ret=m_out.flush(m_sockfd);
+        if(ret==0){ // socket缓冲区满了，等可写事件
+            if(corked){
+                set_cork(m_sockfd,false);
+            }
+            m_writable=false;
+            return true;
         }
+        if(ret==-1){
+            unmap(); // 释放正在发送的文件
+            return false;
+        }
+        // 队列发完了，流式响应还没结束就继续生成
+        if(!m_stream || m_stream_done){
+            break;
+        }
+        if(!pump_stream()){
+            unmap();
+            return false;
+        }
+    }
+    // 全部发送完毕
+    if(corked){
+        set_cork(m_sockfd,false);
+    }
+    if(m_log_pending){
+        response_done(0);
+    }
+    unmap();
+    if(!m_linger){
+        start_drain();
         return true;
     }
+    // 流式响应、预读过的响应发完才轮到下一个请求，其他的在handle_request()中已经处理过
+    if(m_request_end!=0 && !next_request()){
+        return false;
+    }
+    return true;
 }
 
-// http的任务：解析请求报文 整合响应资源
-void http_conn::process(){
-    HTTP_CODE read_ret=process_read();
-    if(read_ret==NO_REQUEST){
-        modfd(m_epollfd,m_sockfd,EPOLLIN,m_et_mode); // 没接收到请求，继续监听
+/*
+    服务器要关闭连接时（达到-k的请求数、Connection: close、请求出错），对方可能已经发来了流水线上的后续请求。
+    这时直接close()，接收缓冲区中还有没读的数据，内核会发RST而不是FIN，
+    对方可能还没读到最后的响应就被RST丢弃了。所以先只关闭写方向，对方读到EOF后会关闭，
+    期间读到的数据都丢弃，对方关闭、出错或者DRAIN_TIMEOUT_MS后再close()
+*/
+void http_conn::start_drain(){
+    shutdown(m_sockfd,SHUT_WR);
+    m_draining=true;
+    m_readable=true; // 对方可能已经关闭了，先读一次
+    m_drain_deadline.store(monotonic_ns()+(uint64_t)DRAIN_TIMEOUT_MS*1000000,std::memory_order_relaxed);
+    m_draining_conns++;
+}
+
+bool http_conn::drain(){
+    while(1){
+        ssize_t n=recv(m_sockfd,m_read_buf,READ_BUFFER_SIZE,0);
+        if(n>0){
+            continue;
+        }
+        if(n==-1 && (errno==EAGAIN || errno==EWOULDBLOCK)){
+            break;
+        }
+        return false;
+    }
+    return monotonic_ns()<m_drain_deadline.load(std::memory_order_relaxed);
+}
+
+// 超时的连接交给on_event()：持有后drain()发现超时就关闭，正被其他线程持有时由持有者处理
+void http_conn::expire_draining(http_conn *conns,int n,uint64_t &next_check){
+    if(m_draining_conns.load(std::memory_order_relaxed)==0){
         return;
     }
-    bool write_ret=process_write(read_ret);
-    if(!write_ret){
-        close_conn(); //?????????????
+    uint64_t now=monotonic_ns();
+    if(now<next_check){
+        return;
+    }
+    next_check=now+(uint64_t)DRAIN_CHECK_MS*1000000;
+    for(int i=0;i<n;i++){
+        uint64_t deadline=conns[i].m_drain_deadline.load(std::memory_order_relaxed);
+        if(deadline!=0 && now>=deadline){
+            conns[i].on_event(EPOLLIN);
+        }
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_et_mode); // ?????????????????
+}
+
+// 工作线程的任务：解析请求报文 整合响应资源，然后接着处理这个连接上的事件
+void http_conn::process(){
+    watchdog::current(m_sockfd,m_url);
+    if(m_times.m_dispatched){
+        m_times.m_picked=monotonic_ns();
+    }
+    if(handle_request(false)){
+        run(false);
+    }
+}
+
+/*
+    解析请求并生成响应。返回false表示连接已经交给了I/O线程或者已经关闭
+    读缓冲区中已经有流水线上的下一个完整请求时，接着生成它的响应，追加到同一个输出队列，
+    几个响应用一次writev发出去，而不是一个响应一个小包（小包之间还会被Nagle算法拖住）
+*/
+bool http_conn::handle_request(bool in_reactor){
+    bool fast_only=in_reactor && m_pool; // 没有线程池时所有请求都在事件循环中处理
+    while(1){
+        if(fast_only && m_inline_budget<=0){ // 主线程本轮的预算用完了，不能让一个连接占住其他连接
+            return dispatch();
+        }
+        if(m_times.m_start==0){
+            m_times.m_start=monotonic_ns();
+        }
+        m_inline=fast_only;
+        HTTP_CODE read_ret=process_read();
+        m_inline=false;
+        if(read_ret==SLOW_REQUEST){
+            return dispatch();
+        }
+        if(read_ret==ASYNC_REQUEST){ // 连接仍然是STATE_BUSY，生成资源的线程接着处理
+            return false;
+        }
+        if(read_ret==NO_REQUEST){
+            if(m_read_idx<READ_BUFFER_SIZE){ // 请求还不完整，继续等数据
+                break;
+            }
+            // 缓冲区满了还不是一个完整的请求，不可能再解析成功
+            m_linger=false;
+            read_ret=BAD_REQUEST;
+        }
+        if(fast_only){
+            m_inline_budget--;
+        }
+        loop_stats &st=loop_stats::local();
+        loop_stats::inc(st.m_requests);
+        if(m_served>0){
+            loop_stats::inc(st.m_reused);
+        }
+        m_served++;
+        if(!m_linger){
+            if(read_ret!=BAD_REQUEST){
+                loop_stats::inc(st.m_close_client);
+            }
+        }else if(m_max_requests>0 && m_served>=m_max_requests){ // 在这个响应里告诉客户端连接要关闭了
+            m_linger=false;
+            loop_stats::inc(st.m_close_limit);
+        }
+        // 写缓冲区放不下响应头部时改为返回500，500的头部一定放得下
+        m_log_mark=m_out.bytes_sent()+m_out.bytes_pending();
+        bool write_ret=process_write(read_ret) || process_write(INTERNAL_ERROR);
+        if(!write_ret){
+            close_conn();
+            return false;
+        }
+        response_queued(fast_only);
+        // 文件不在page cache中时，发送会因为缺页阻塞在磁盘上。交给I/O线程预读，预读完再发送
+        if(m_cold && m_file_address){
+            if(m_io_pool->append(&m_prefetch)){
+                return false;
+            }
+        }
+        // 响应已经整个在输出队列中了，可以开始下一个请求；流式响应要等发完
+        if(m_stream || !m_linger){
+            break;
+        }
+        if(!next_request()){ // 发完这个响应就关闭
+            m_linger=false;
+            break;
+        }
+        if(!m_pipelined || m_out.bytes_pending()>=STREAM_HIGH_WATER){
+            break;
+        }
+        m_pipelined=false;
+    }
+    // 直接在当前线程发送，省去一次线程切换；写不完由可写事件驱动
+    m_writable=true;
+    return true;
+}
+
+// 让工作线程处理请求，连接仍然是STATE_BUSY。返回false
+bool http_conn::dispatch(){
+    m_times.m_dispatched=monotonic_ns();
+    if(!m_pool->append(this)){
+        close_conn();
+    }
+    return false;
+}
+
+// 在I/O线程中执行，连接仍然是STATE_BUSY，没有其他线程访问它
+void http_conn::prefetch(){
+    prefetch_pages(m_file_address,m_file_size);
+    m_writable=true;
+    run(false);
 }
 
 // 利用有限状态机解析整个请求报文，并请求资源
 http_conn::HTTP_CODE http_conn::process_read(){
+    if(m_parse_state==PARSE_STATE_DONE){ // 主线程解析完了，交给工作线程请求资源；或者异步生成的资源好了
+        if(m_async_ret!=NO_REQUEST){
+            HTTP_CODE ret=m_async_ret;
+            m_async_ret=NO_REQUEST;
+            return ret;
+        }
+        return do_request();
+    }
     while(1){
+        if(m_parse_state==PARSE_STATE_BODY){ // 请求体不按行解析，读够Content-Length个字节就完整了
+            if(parse_request_body()==GET_REQUEST){
+                m_request_end=m_check_idx+m_body_len;
+                m_parse_state=PARSE_STATE_DONE;
+                return do_request();
+            }
+            break;
+        }
         char *text=get_line();
-        if(find_next_line()!=LINE_OK){ // 正常情况下m_check_idx定位到下一行起始位置
+        LINE_STATUS line_status=find_next_line(); // 正常情况下m_check_idx定位到下一行起始位置
+        if(line_status==LINE_BAD){ // 后面的数据已经无法分出请求的边界，响应后关闭连接
+            m_linger=false;
+            return BAD_REQUEST;
+        }
+        if(line_status!=LINE_OK){
             break;
         }
         switch(m_parse_state){
             case PARSE_STATE_LINE:
                 if(parse_request_line(text)==BAD_REQUEST){
+                    m_linger=false;
                     return BAD_REQUEST;
                 }
                 break;
-            case PARSE_STATE_HEADER:
-                if(parse_request_headers(text)==GET_REQUEST){
+            case PARSE_STATE_HEADER:{
+                HTTP_CODE ret=parse_request_headers(text);
+                if(ret==GET_REQUEST){
+                    m_request_end=m_check_idx;
+                    m_parse_state=PARSE_STATE_DONE;
                     return do_request();
                 }
-                break;
-            case PARSE_STATE_BODY:
-                if(parse_request_body(text)==GET_REQUEST){
-                    return do_request();
+                if(ret==BAD_REQUEST){ // Content-Length不对，请求的边界也就不知道了
+                    m_linger=false;
+                    return BAD_REQUEST;
                 }
                 break;
+            }
             default:
                 return INTERNAL_ERROR; // 内部错误
         }
@@ -288,39 +668,47 @@ Connection: keep-alive
 
 {"key1": "value1", "key2": "value2"}
 */
+// 取出text中下一个以空白分隔的词，并在词尾写入'\0'，没有时返回空
+static std::string_view next_token(char *&text){
+    text+=strspn(text," \t");
+    char *start=text;
+    text+=strcspn(text," \t");
+    std::string_view tok(start,text-start);
+    if(*text){
+        *text++='\0';
+    }
+    return tok;
+}
+
 // 解析请求行
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text){
     // GET / HTTP/1.1
-    // 用正则表达式找到空白符，提取出每一个空白符前的词
-    std::string str=text; // char *转string以\0作为分割依据
-    str.push_back(' ');
-    std::__cxx11::regex pattern("\\s"); // \s代表所有空白符，多加一个\转义
-    std::vector<std::string> v;
-    std::__cxx11::sregex_iterator it(str.begin(),str.end(),pattern);
-    std::__cxx11::sregex_iterator end_it;
-    for(;it!=end_it;it++ ){
-        v.push_back(it->prefix().str());
-    }
+    // 按空白切出三个词，直接指向读缓冲区，不拷贝
+    std::string_view method=next_token(text);
+    m_url=next_token(text);
+    m_version=next_token(text);
     
-    // BAD_REQUEST:元素不全 or 不是get和post其一的请求方式 or 版本不是1.1
-    if(v.size()!=3){
+    // BAD_REQUEST:元素不全 or 不是get和post其一的请求方式 or 版本不是1.0/1.1
+    if(m_version.empty() || *(text+strspn(text," \t"))!='\0'){
         return BAD_REQUEST;
     }
 
-    if(v[0]=="GET"){
+    if(method=="GET"){
         m_method=GET;
-    }else if(v[0]=="POST"){
+    }else if(method=="POST"){
         m_method=POST;
     }else{
         return BAD_REQUEST;
     }
 
-    m_url=v[1];
-
-    m_version=v[2];
-    if(m_version!="HTTP/1.1"){
+    if(m_version=="HTTP/1.1"){
+        m_http11=true;
+    }else if(m_version=="HTTP/1.0"){
+        m_http11=false;
+    }else{
         return BAD_REQUEST;
     }
+    m_linger=m_http11; // 之后按Connection头部修改
 
     m_parse_state=PARSE_STATE_HEADER; // 状态转移
     return NO_REQUEST;
@@ -334,6 +722,9 @@ http_conn::HTTP_CODE http_conn::parse_request_headers(char *text){
     Content-Length: 25 // 如果请求体不为空，会有这一行
 */
     if(text[0]=='\0'){ // 到达空行，请求头部解析完了
+        if((size_t)m_check_idx+m_body_len>READ_BUFFER_SIZE){ // 整个请求要放在读缓冲区中，放不下的请求体永远读不完
+            return BAD_REQUEST;
+        }
         if(m_body_len!=0){
             m_parse_state=PARSE_STATE_BODY;
             return NO_REQUEST;
@@ -346,37 +737,113 @@ http_conn::HTTP_CODE http_conn::parse_request_headers(char *text){
     // if(regex_search(text,res,pattern)){
     //     res.suffix().str();
     // }
-    std::string s=text;
-    std::__cxx11::regex pattern1("Connection:\\s");
-    std::smatch res;
-    if(regex_search(s,res,pattern1)){
-        m_linger=res.suffix().str()=="keep-alive";
+    if(strncasecmp(text,"Connection:",11)==0){
+        parse_connection(text+11);
+        return NO_REQUEST;
     }
-    
-    std::__cxx11::regex pattern2("Content-Length:\\s");
-    if(regex_search(s,res,pattern2)){
-        m_body_len=stoi(res.suffix().str()); // string->int:stoi  char *->int:atoi
+
+    if(strncasecmp(text,"Content-Length:",15)==0){
+        char *end;
+        long len=strtol(text+15,&end,10);
+        // 超过读缓冲区的长度不可能读完，同时保证后面计算请求边界时不会溢出
+        if(end==text+15 || len<0 || len>READ_BUFFER_SIZE || *(end+strspn(end," \t"))!='\0'){
+            return BAD_REQUEST;
+        }
+        m_body_len=len;
+    }else if(strncasecmp(text,"Accept-Encoding:",16)==0){ // 资源包相关：协商预压缩版本、条件请求
+        m_accept_gzip=strstr(text+16,"gzip")!=NULL;
+    }else if(strncasecmp(text,"If-None-Match:",14)==0){
+        text+=14;
+        text+=strspn(text," \t");
+        m_if_none_match=std::string_view(text);
     }
     return NO_REQUEST;
 }
 
-// 解析请求体，实际只判断是否完整读入
-http_conn::HTTP_CODE http_conn::parse_request_body(char *text){
-    if (m_read_idx >= (m_body_len /*+ m_check_idx*/)) { // ？？？？？？？？？？
+/*
+    Connection头部是逗号分隔的选项列表，不区分大小写。有close就关闭；
+    HTTP/1.0要明确给出keep-alive才保持，HTTP/1.1默认保持
+*/
+void http_conn::parse_connection(const char *value){
+    bool close=false,keep_alive=false;
+    while(*value){
+        value+=strspn(value," \t,");
+        size_t len=strcspn(value," \t,");
+        if(len==5 && strncasecmp(value,"close",5)==0){
+            close=true;
+        }else if(len==10 && strncasecmp(value,"keep-alive",10)==0){
+            keep_alive=true;
+        }
+        value+=len;
+    }
+    if(close){
+        m_linger=false;
+    }else if(keep_alive){
+        m_linger=true;
+    }
+}
+
+// 解析请求体，实际只判断是否完整读入。请求体从m_check_idx开始
+http_conn::HTTP_CODE http_conn::parse_request_body(){
+    if((size_t)m_read_idx>=(size_t)m_check_idx+m_body_len){
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
+// If-None-Match是否等于选中版本的ETag，gzip版本为etag去掉结尾的引号加上-gz"
+static bool etag_matches(std::string_view inm,const char *etag,size_t len,bool gz){
+    if(!gz){
+        return inm.size()==len && memcmp(inm.data(),etag,len)==0;
+    }
+    return len>=2 && inm.size()==len+3 && memcmp(inm.data(),etag,len-1)==0 && inm.substr(len-1)=="-gz\"";
+}
+
 // 请求资源
 http_conn::HTTP_CODE http_conn::do_request(){
+    if(m_times.m_parsed==0){ // 主线程解析完交给工作线程时，这里会进来两次
+        m_times.m_parsed=monotonic_ns();
+        WS_PROBE4(request_parsed,m_sockfd,m_method,m_url.data(),m_url.size());
+        watchdog::current(m_sockfd,m_url);
+    }
+    if(!m_stats_path.empty() && m_url.substr(0,m_stats_path.size())==m_stats_path){
+        std::string_view query=m_url.substr(m_stats_path.size());
+        if(query.empty() || query=="?format=json" || query=="?format=prometheus"){
+            if(m_inline){ // 汇总所有线程的计数不算快，不占用主线程
+                return SLOW_REQUEST;
+            }
+            return do_stats_request();
+        }
+    }
+    if(!m_profile_path.empty() && m_url.substr(0,m_profile_path.size())==m_profile_path){
+        std::string_view query=m_url.substr(m_profile_path.size());
+        if(query.empty() || query[0]=='?'){
+            return do_profile_request();
+        }
+    }
     if(m_url=="/"){
-        m_url=doc_root+"/lingtang.html";
-    }else{
-        m_url=doc_root+m_url;
+        m_url="/lingtang.html";
+    }
+    // 加载了资源包时只从资源包中查找，不再访问文件系统
+    std::shared_ptr<const bundle> b=bundle_store::local();
+    if(b){
+        m_file_owner=b; // 资源包的内存要一直用到响应发送完
+        return do_bundle_request(*b);
+    }
+    // 缓存中的小文件不需要stat/open/mmap，主线程只能走这条路
+    file_cache &cache=file_cache::local();
+    file_cache::entry e;
+    if(cache.find(m_url,e)){
+        loop_stats::inc(loop_stats::local().m_cache_hits);
+        WS_PROBE2(cache_hit,m_url.data(),m_url.size());
+        use_cached(e);
+        return FILE_REQUEST;
+    }
+    if(m_inline){
+        return SLOW_REQUEST;
     }
-    // m_url=doc_root+m_url; // 拼接出完整路径
-    const char* file=m_url.c_str(); // str.c_str()将string转换为const char*
+    m_real_file=m_arena.concat(m_doc_root,m_url); // 拼接出完整路径
+    const char* file=m_real_file.data();
 /*
     int stat(const char *pathname, struct stat *statbuf);
     pathname：一个字符串，表示要查询信息的文件路径或目录路径
@@ -408,8 +875,28 @@ http_conn::HTTP_CODE http_conn::do_request(){
     }
     // 判断是否是目录
     if ( m_file_info.st_mode & S_IFDIR ) {
+        if(m_autoindex){ // 生成文件列表，分块发送
+            m_stream.reset(dir_listing::open(file,m_url.data()));
+            return m_stream?STREAM_REQUEST:FORBIDDEN_REQUEST;
+        }
         return BAD_REQUEST;
     }
+    // 文件没变时续用缓存的映射
+    if(m_file_info.st_size<=FILE_CACHE_MAX_FILE && cache.revalidate(m_url,m_file_info,e)){
+        loop_stats::inc(loop_stats::local().m_cache_revalidated);
+        WS_PROBE2(cache_revalidate,m_url.data(),m_url.size());
+        use_cached(e);
+        // 缓存中的页可能已经被回收，过期时顺便检查一次；没过期的命中不检查
+        m_cold=m_io_pool && m_file_address && !pages_resident(m_file_address,m_file_size);
+        return FILE_REQUEST;
+    }
+    loop_stats::inc(loop_stats::local().m_cache_misses);
+    WS_PROBE2(cache_miss,m_url.data(),m_url.size());
+    if(m_file_info.st_size==0){ // 长度为0的映射会失败，空文件不需要映射
+        m_file_address=NULL;
+        m_file_size=0;
+        return FILE_REQUEST;
+    }
     // 以只读方式打开文件
     int fd = open( file, O_RDONLY );
 /*
@@ -434,166 +921,478 @@ http_conn::HTTP_CODE http_conn::do_request(){
     // 创建内存映射 ？？？？？？？为什么要这样做
     m_file_address = ( char* )mmap( NULL, m_file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
     close( fd );
+    if(m_file_address==MAP_FAILED){
+        m_file_address=NULL;
+        return INTERNAL_ERROR;
+    }
+    m_file_size=m_file_info.st_size;
+    // 映射区的生命周期交给引用计数，输出队列中最后一段引用释放时解除映射
+    size_t map_size=m_file_size;
+    m_file_owner=std::shared_ptr<const void>(m_file_address,[map_size](char *p){ munmap(p,map_size); });
+    if(m_file_size>=SEQUENTIAL_FILE_SIZE){
+        advise_sequential(m_file_address,m_file_size);
+    }
+    m_cold=m_io_pool && !pages_resident(m_file_address,m_file_size);
+    if(m_file_size<=FILE_CACHE_MAX_FILE){
+        e.data=m_file_address;
+        e.size=m_file_size;
+        e.owner=m_file_owner;
+        cache.insert(m_url,m_file_info,e);
+    }
     return FILE_REQUEST;
 }
 
+void http_conn::use_cached(const file_cache::entry &e){
+    m_file_address=(char *)e.data;
+    m_file_size=e.size;
+    m_file_owner=e.owner;
+}
+
+// 从资源包中查找资源，地址直接指向资源包的映射区，不需要stat/open/mmap
+http_conn::HTTP_CODE http_conn::do_bundle_request(const bundle &b){
+    bundle::asset a;
+    if(!b.find(m_url.data(),m_url.size(),a)){
+        loop_stats::inc(loop_stats::local().m_bundle_misses);
+        WS_PROBE2(bundle_miss,m_url.data(),m_url.size());
+        return NO_RESOURCE;
+    }
+    loop_stats::inc(loop_stats::local().m_bundle_hits);
+    WS_PROBE2(bundle_hit,m_url.data(),m_url.size());
+    m_content_type=a.mime;
+    m_content_type_len=a.mime_len;
+    m_etag=a.etag;
+    m_etag_len=a.etag_len;
+    m_vary=a.gzip_data!=NULL;
+    m_etag_gz=m_accept_gzip && a.gzip_data;
+    if(etag_matches(m_if_none_match,a.etag,a.etag_len,m_etag_gz)){
+        return NOT_MODIFIED;
+    }
+    if(m_etag_gz){
+        m_file_address=(char *)a.gzip_data;
+        m_file_size=a.gzip_size;
+        m_gzip=true;
+    }else{
+        m_file_address=(char *)a.data;
+        m_file_size=a.size;
+    }
+    // 预先填充或者拷贝到大页内存中的资源包一直在内存中，不用检查
+    m_cold=m_io_pool && !b.resident() && m_file_size>0 && !pages_resident(m_file_address,m_file_size);
+    return FILE_REQUEST;
+}
+
+// 释放正在发送的文件：丢弃输出队列并释放引用，文件在最后一个引用释放时解除映射
+void http_conn::unmap(){
+    m_out.clear();
+    m_stream.reset();
+    m_stream_done=false;
+    m_file_address=NULL;
+    m_file_owner.reset();
+}
+
 // 整合响应资源
 bool http_conn::process_write(HTTP_CODE ret){
+    // 头部直接写进输出队列的内存块，成功后才提交
+    m_header.attach(m_out.reserve(WRITE_BUFFER_SIZE),WRITE_BUFFER_SIZE);
     switch(ret){
         case FILE_REQUEST:
-            if(!add_response_line(200,ok_200_title)){
+            if(!add_response_line(200)){
                 return false;
             }
-            if(m_file_info.st_size!=0){
-                if(!add_response_headers(m_file_info.st_size)){
+            if(m_file_size!=0){
+                if(!add_response_headers(m_file_size)){
                     return false;
                 }
-                m_iov[0].iov_base=m_write_buf;
-                m_iov[0].iov_len=m_write_idx;
-                m_iov[1].iov_base = m_file_address;
-                m_iov[1].iov_len = m_file_info.st_size;
-                m_iov_count = 2;
-                bytes_to_send = m_write_idx + m_file_info.st_size;
+                m_out.commit(m_header.size());
+                m_out.push_ref(m_file_address,m_file_size,m_file_owner);
                 return true;
-            }else{
-                const char *ok_string="<html><body></body></html>";
-                if(!add_response_headers(strlen(ok_string))){
-                    return false;
-                }
-                if(!add_response_body(ok_string)){
+            }else if(!m_etag){
+                return add_fixed_response(FIXED_EMPTY_OK);
+            }else{ // 资源包中的空文件，要带上ETag
+                if(!add_response_headers(0)){
                     return false;
                 }
             }
             break;
-        case BAD_REQUEST: case NO_RESOURCE:
-            if(!add_response_line(404, error_404_title)){
+        case NOT_MODIFIED:
+            if(!add_response_line(304)){
                 return false;
             }
-            if(!add_response_headers(strlen(error_404_form))){
+            if(!m_header.date() || !add_entity_headers() || !add_connection() || !add_blank_line()){
                 return false;
             }
-            if (!add_response_body(error_404_form))
-                return false;
             break;
-        case FORBIDDEN_REQUEST:
-            if(!add_response_line(403, error_403_title)){
-                return false;
+        case STREAM_REQUEST:
+            // HTTP/1.0的客户端不认识分块传输，直接发送数据，以关闭连接表示结束
+            m_chunked=m_http11;
+            if(!m_chunked){
+                m_linger=false;
             }
-            if(!add_response_headers(strlen(error_403_form))){
+            if(!add_response_line(200) || !m_header.date() || !add_content_type()
+                || (m_chunked && !m_header.append("Transfer-Encoding: chunked\r\n")) || !add_connection() || !add_blank_line()){
                 return false;
             }
-            if (!add_response_body(error_403_form))
-                return false;
-            break;
-        case INTERNAL_ERROR:
-            if(!add_response_line(500, error_500_title)){
-                return false;
-            }
-            if(!add_response_headers(strlen(error_500_form))){
+            m_out.commit(m_header.size());
+            // 先生成一部分，还没有发送任何数据，出错时可以改为返回500。
+            // 只撤回这个响应，流水线上前面的响应已经在输出队列中了
+            if(!pump_stream()){
+                m_out.truncate(m_log_mark);
+                m_stream.reset();
+                m_stream_done=false;
                 return false;
             }
-            if (!add_response_body(error_500_form)){
-                return false;
-            }  
-            break;
+            return true;
+        case BAD_REQUEST:
+            return add_fixed_response(FIXED_BAD_REQUEST);
+        case NO_RESOURCE:
+            return add_fixed_response(FIXED_NOT_FOUND);
+        case FORBIDDEN_REQUEST:
+            return add_fixed_response(FIXED_FORBIDDEN);
+        case INTERNAL_ERROR:
+            return add_fixed_response(FIXED_INTERNAL_ERROR);
         default:
             return false;
     }
-    m_iov[0].iov_base = m_write_buf;
-    m_iov[0].iov_len = m_write_idx;
-    m_iov_count = 1;
-    bytes_to_send = m_write_idx;
+    m_out.commit(m_header.size());
     return true;
 }
 
-// 按照传入格式写数据到写缓冲区
-bool http_conn::format_write(const char *format,...){
-    if(m_write_idx >= WRITE_BUFFER_SIZE){
-        return false;
-    }
-    va_list arg_list; // 存储可变参数，通常是一个指向参数列表的指针
 /*
-    void va_start(va_list ap, last);
-    -ap：va_start 函数将初始化这个对象，以便后续可以使用 va_arg 来逐个获取参数。
-    -last：这是最后一个已知的参数。va_start 将根据这个参数的地址来定位可变参数的起始位置。
+    记录这个响应的状态码和解析、排队、处理的耗时，开启了访问日志时生成日志记录，发完时再补上发送时间和实际字节数。
+    流水线上前一个响应还没发就又生成了一个时，两个响应会一起写出去，前一个的记录直接写入日志
 */
-    va_start(arg_list,format); // 把可变参数放到arg_list里
+void http_conn::response_queued(bool in_reactor){
+    if(m_log_pending){
+        response_done(ACCESS_BATCHED);
+    }
+    uint64_t now=monotonic_ns();
+    const request_times &t=m_times;
+    uint64_t parsed=t.m_parsed?t.m_parsed:now; // 解析出错的请求没有请求资源
+    uint64_t queue=t.m_picked?t.m_picked-t.m_dispatched:0;
+    uint64_t process=now-parsed>queue?now-parsed-queue:0;
+    loop_stats &st=loop_stats::local();
+    st.count_status(m_status);
+    st.m_latency[STAGE_PARSE].record(parsed-t.m_start);
+    if(t.m_picked){
+        st.m_latency[STAGE_QUEUE].record(queue);
+    }
+    st.m_latency[STAGE_PROCESS].record(process);
+    m_log_queued=now;
+    m_log_start=t.m_start;
+    m_log_pending=true;
+    m_log.m_bytes=m_out.bytes_sent()+m_out.bytes_pending()-m_log_mark; // 合并发送时用这个长度
+    WS_PROBE4(response_start,m_sockfd,m_status,m_log.m_bytes,in_reactor);
+    if(trace_log::enabled()){
+        trace_sample &s=m_trace;
+        s.m_accept=t.m_accept;
+        s.m_read=t.m_read;
+        s.m_start=t.m_start;
+        s.m_parsed=t.m_parsed;
+        s.m_dispatched=t.m_dispatched;
+        s.m_picked=t.m_picked;
+        s.m_queued=now;
+        s.m_fd=m_sockfd;
+        s.m_thread=trace_log::thread_id();
+        s.m_status=m_status;
+        s.m_method=m_method;
+        s.m_flags=in_reactor?ACCESS_INLINE:0;
+        s.m_sampled=trace_log::sample();
+        s.m_path_len=m_url.size();
+        memcpy(s.m_path,m_url.data(),m_url.size()<TRACE_PATH_MAX?m_url.size():TRACE_PATH_MAX);
+    }
+    if(!access_log::enabled()){
+        return;
+    }
+    access_record &r=m_log;
+    r.m_time_ns=access_log::realtime(t.m_start);
+    r.m_path_hash=path_hash(m_url.data(),m_url.size());
+    r.m_parse_ns=parsed-t.m_start;
+    r.m_queue_ns=queue;
+    r.m_process_ns=process;
+    r.m_send_ns=0;
+    r.m_peer_ip=m_address.sin_addr.s_addr;
+    r.m_peer_port=m_address.sin_port;
+    r.m_status=m_status;
+    r.m_fd=m_sockfd;
+    r.m_thread=0;
+    r.m_method=m_method;
+    r.m_flags=(m_linger?ACCESS_KEEP_ALIVE:0)|(m_http11?ACCESS_HTTP11:0)|(m_gzip?ACCESS_GZIP:0)
+             |(in_reactor?ACCESS_INLINE:0);
+    r.m_path_len=m_url.size();
+    size_t n=m_url.size()<ACCESS_LOG_PATH_MAX?m_url.size():ACCESS_LOG_PATH_MAX;
+    memcpy(r.m_path,m_url.data(),n);
+    memset(r.m_path+n,0,ACCESS_LOG_PATH_MAX-n);
+}
+
 /*
-    int vsnprintf(char *str, size_t size, const char *format, va_list ap);
-    -str：vsnprintf 会将格式化后的结果写入该字符数组。
-    -size：这是字符数组 str 的大小，也就是能够存储的最大字符数。函数会确保输出的字符不超过这个限制。
-    -format：这是一个格式化字符串，类似于 printf 中的格式化字符串，用于指定输出的格式。
-    -ap：这是一个 va_list 对象，用于存储可变参数的信息。vsnprintf 会根据 format 中的格式化指令和 ap 中的参数来生成格式化后的字符串。
-    -返回值：
-        函数的返回值是生成的字符数，但不包括末尾的 null 字符。
-        如果生成的字符数（包括 null 字符）超过了 size，则函数会返回一个负数，表示缓冲区不足以存储结果。
+    合并发送的响应分不出各自的发送时间，只计字节数（放进队列时的长度），追踪中按放进队列时发完算；
+    流式响应边发边生成，发完才知道总长度
 */
-    int len=vsnprintf(m_write_buf+m_write_idx,WRITE_BUFFER_SIZE-m_write_idx,format,arg_list); // 按格式写入，注意第一个参数
-    if(len<0){
-        // void va_end(va_list ap); 用于释放 va_list 对象占用的资源
-        va_end(arg_list);
-        return false;
+void http_conn::response_done(uint8_t flags){
+    m_log_pending=false;
+    loop_stats &st=loop_stats::local();
+    uint64_t done=m_log_queued;
+    if(!(flags & ACCESS_BATCHED)){
+        uint64_t total=m_out.bytes_sent()+m_out.bytes_pending();
+        done=monotonic_ns();
+        st.m_latency[STAGE_SEND].record(done-m_log_queued);
+        st.m_latency[STAGE_TOTAL].record(done-m_log_start);
+        m_log.m_bytes=total>m_log_mark?total-m_log_mark:0;
+        m_log.m_send_ns=done-m_log_queued;
+    }
+    loop_stats::add(st.m_bytes_out,m_log.m_bytes);
+    WS_PROBE4(response_done,m_sockfd,m_log.m_bytes,done-m_log_queued,flags);
+    if(trace_log::enabled()){
+        trace_sample &s=m_trace;
+        s.m_done=done;
+        s.m_bytes=m_log.m_bytes;
+        s.m_flags|=flags;
+        s.m_slow=trace_log::slow_ns() && done-s.first()>=trace_log::slow_ns();
+        if(s.m_sampled || s.m_slow){
+            trace_log::append(s);
+        }
+    }
+    if(!access_log::enabled()){
+        return;
+    }
+    m_log.m_flags|=flags;
+    access_log::append(m_log);
+}
+
+// 内部统计：抓取时才汇总各线程的计数和直方图，生成的内容由引用计数管理，发完释放
+http_conn::HTTP_CODE http_conn::do_stats_request(){
+    stats_snapshot st;
+    st.collect();
+    st.m_active=m_conn_count.load(std::memory_order_relaxed);
+    st.m_queue_depth=m_pool?m_pool->queue_depth():0;
+    st.m_io_queue_depth=m_io_pool?m_io_pool->queue_depth():0;
+    bool json=m_url.substr(m_stats_path.size())=="?format=json";
+    std::shared_ptr<std::string> body=std::make_shared<std::string>(json?format_json(st):format_prometheus(st));
+    m_file_address=&(*body)[0];
+    m_file_size=body->size();
+    m_file_owner=body;
+    m_content_type=json?"application/json":"text/plain; version=0.0.4";
+    m_content_type_len=strlen(m_content_type);
+    return FILE_REQUEST;
+}
+
+// 剖析的参数：?seconds=5&hz=99，都可以省略
+static bool parse_profile_query(std::string_view query,double &seconds,int &hz){
+    if(!query.empty()){
+        query.remove_prefix(1); // '?'
+    }
+    while(!query.empty()){
+        size_t amp=query.find('&');
+        std::string param(query.substr(0,amp));
+        query=amp==std::string_view::npos?std::string_view():query.substr(amp+1);
+        char *end;
+        if(param.compare(0,8,"seconds=")==0){
+            seconds=strtod(param.c_str()+8,&end);
+        }else if(param.compare(0,3,"hz=")==0){
+            hz=strtol(param.c_str()+3,&end,10);
+        }else{
+            return false;
+        }
+        if(*end!='\0'){
+            return false;
+        }
+    }
+    return seconds>0 && seconds<=PROFILE_MAX_SECONDS && hz>0 && hz<=PROFILE_MAX_HZ;
+}
+
+// 采样剖析：交给剖析线程，不占用事件循环和工作线程；已经有剖析在进行时马上返回500
+http_conn::HTTP_CODE http_conn::do_profile_request(){
+    double seconds=5;
+    int hz=99;
+    if(!parse_profile_query(m_url.substr(m_profile_path.size()),seconds,hz)){
+        return BAD_REQUEST;
+    }
+    std::string err;
+    if(!profiler::submit(seconds,hz,&m_profile,err)){
+        std::cerr << "profile: " << err << std::endl;
+        return INTERNAL_ERROR;
+    }
+    return ASYNC_REQUEST;
+}
+
+void http_conn::profile_done(bool ok,std::string &out,const std::string &err){
+    if(ok){
+        std::shared_ptr<std::string> body=std::make_shared<std::string>();
+        body->swap(out);
+        m_file_address=body->empty()?NULL:&(*body)[0];
+        m_file_size=body->size();
+        m_file_owner=body;
+        m_content_type="text/plain";
+        m_content_type_len=strlen(m_content_type);
+        m_async_ret=FILE_REQUEST;
+    }else{
+        std::cerr << "profile: " << err << std::endl;
+        m_async_ret=INTERNAL_ERROR;
     }
-    m_write_idx+=len;
-    va_end(arg_list);
+    process();
+}
+
+// 发送预先生成好的响应：状态行 + 本线程缓存的Date行 + 其余头部和正文，只有Date行需要拷贝
+bool http_conn::add_fixed_response(FIXED_RESPONSE r){
+    std::shared_ptr<const fixed_response_set> set=fixed_response_store::local();
+    static const int status[FIXED_RESPONSE_COUNT]={200,400,403,404,500};
+    m_status=status[r];
+    const fixed_response_set::blob &b=set->get(r,m_linger);
+    m_out.push_ref(b.head.data(),b.head.size(),set);
+    char date[64];
+    header_builder h(date,sizeof(date));
+    h.date();
+    m_out.push_copy(date,h.size());
+    m_out.push_ref(b.tail.data(),b.tail.size(),set);
     return true;
 }
 
 /*
     HTTP/1.1 200 OK
+    Date: Sun, 06 Nov 1994 08:49:37 GMT
     Content-Type: text/html
     Content-Length: 123
     Connection: keep-alive
 
     ...
 */
-// 添加响应行
-bool http_conn::add_response_line(int status, const char *title){
-    return format_write("%s %d %s\r\n","HTTP/1.1",status,title);
+// 添加响应行，状态行是预先生成好的
+bool http_conn::add_response_line(int status){
+    m_status=status;
+    return m_header.status_line(status);
 }
 
 // 添加响应头部和空行
-bool http_conn::add_response_headers(int content_length){
-    if(!add_content_type()){
-        return false;
-    }
-    if(!add_content_length(content_length)){
-        return false;
+bool http_conn::add_response_headers(size_t content_length){
+    return m_header.date()
+        && add_content_type()
+        && add_content_length(content_length)
+        && add_entity_headers()
+        && add_connection()
+        && add_blank_line();
+}
+
+// 内容类型
+bool http_conn::add_content_type(){
+    return m_header.header("Content-Type",12,m_content_type,m_content_type_len);
+}
+// ETag、Content-Encoding和Vary，只有资源包中的资源才有。gzip版本的ETag是"<hash>-gz"，和原始版本不同
+bool http_conn::add_entity_headers(){
+    if(m_etag){
+        if(!m_etag_gz){
+            if(!m_header.header("ETag",4,m_etag,m_etag_len)){
+                return false;
+            }
+        }else if(!m_header.append("ETag: ") || !m_header.append(m_etag,m_etag_len-1) || !m_header.append("-gz\"\r\n")){
+            return false;
+        }
     }
-    if(!add_connection()){
+    if(m_gzip && !m_header.append("Content-Encoding: gzip\r\n")){
         return false;
     }
-    if(!add_blank_line()){
+    if(m_vary && !m_header.append("Vary: Accept-Encoding\r\n")){
         return false;
     }
     return true;
 }
-
-// 内容类型
-bool http_conn::add_content_type(){
-    return format_write("Content-Type: %s\r\n","text/html");
-}
 // 内容长度
-bool http_conn::add_content_length(int len){
-    return format_write("Content-Length: %d\r\n",len);
+bool http_conn::add_content_length(size_t len){
+    return m_header.header_uint("Content-Length",14,len);
 }
-// 是否保持连接
+// 是否保持连接。限制了请求数时用Keep-Alive头部告诉客户端还能发几个，预先生成的固定响应不带
 bool http_conn::add_connection(){
-    return format_write("Connection: %s\r\n",m_linger?"keep-alive":"close");
-} 
+    if(!m_linger){
+        return m_header.append("Connection: close\r\n");
+    }
+    if(!m_header.append("Connection: keep-alive\r\n")){
+        return false;
+    }
+    if(m_max_requests>0){
+        return m_header.append("Keep-Alive: max=") && m_header.append_uint(m_max_requests-m_served) && m_header.append("\r\n");
+    }
+    return true;
+}
 // 空行
 bool http_conn::add_blank_line(){
-    return format_write("%s","\r\n");
+    return m_header.end();
+}
+
+// 让数据源继续生成数据，直到输出队列超过高水位或者生成完毕
+bool http_conn::pump_stream(){
+    while(!m_stream_done && m_out.bytes_pending()<STREAM_HIGH_WATER){
+        if(!m_stream->produce(*this)){
+            return false;
+        }
+    }
+    return true;
 }
 
-// 响应正文
-bool http_conn::add_response_body(const char* body){
-    return format_write("%s",body);
+// 块长度（十六进制）+ CRLF
+void http_conn::chunk_size_line(size_t len){
+    static const char hex[]="0123456789abcdef";
+    char buf[24];
+    char *p=buf+sizeof(buf);
+    *--p='\n';
+    *--p='\r';
+    do{
+        *--p=hex[len&0xf];
+        len>>=4;
+    }while(len);
+    m_out.push_copy(p,buf+sizeof(buf)-p);
+}
+
+void http_conn::write_chunk(const char *data,size_t len){
+    if(len==0){ // 长度为0的块表示结束，不能用来发送空数据
+        return;
+    }
+    if(!m_chunked){
+        m_out.push_copy(data,len);
+        return;
+    }
+    chunk_size_line(len);
+    m_out.push_copy(data,len);
+    m_out.push_copy("\r\n",2);
+}
+
+void http_conn::write_chunk_ref(const char *data,size_t len,std::shared_ptr<const void> owner){
+    if(len==0){
+        return;
+    }
+    if(!m_chunked){
+        m_out.push_ref(data,len,std::move(owner));
+        return;
+    }
+    chunk_size_line(len);
+    m_out.push_ref(data,len,std::move(owner));
+    m_out.push_copy("\r\n",2);
+}
+
+void http_conn::end_chunked(){
+    if(m_chunked){
+        m_out.push_copy("0\r\n\r\n",5);
+    }
+    m_stream_done=true;
 }
 
 // 关闭这个http连接
 void http_conn::close_conn(){
-    delfd(m_epollfd,m_sockfd);
+    unmap();
+    int fd=m_sockfd;
     m_sockfd=-1; // 重置文件描述符
     m_conn_count--;
+    if(m_draining){
+        m_draining=false;
+        m_drain_deadline.store(0,std::memory_order_relaxed);
+        m_draining_conns--;
+    }
+    if(m_log_pending){ // 输出队列已经丢弃，记录的是实际发出去的字节数
+        response_done(ACCESS_ABORTED);
+    }
+    loop_stats::inc(loop_stats::local().m_closed);
+    WS_PROBE2(conn_close,fd,m_served);
+    if(m_capture_id){
+        capture_log::close_conn(m_capture_id);
+        m_capture_id=0;
+    }
+    m_state.store(STATE_CLOSED,std::memory_order_release); // 之后到达的事件都是过期的
+    delfd(m_epollfd,fd); // 最后才关闭：关闭后主线程可能马上accept到同一个fd并重新初始化这个对象
 }
\ No newline at end of file
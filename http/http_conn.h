@@ -1,20 +1,75 @@
+#ifndef HTTP_CONN_H
+#define HTTP_CONN_H
+
 #include <sys/epoll.h> // epoll
 #include <unistd.h> // 创建新进程/管道，获取进程id，exec()系列，读写...
 #include <fcntl.h> // 与文件相关的操作
 #include <iostream>
 #include <cstring> // 包含memset()
 #include <netinet/in.h> // 包含sockaddr_in结构体
-#include <regex> //正则表达式
+#include <string_view>
 #include <vector>
 #include <sys/stat.h> // 获取文件的相关的状态信息stat
 #include <sys/mman.h> // 内存映射mmap
-#include <stdarg.h> // 处理可变参数
-#include <sys/uio.h> // writev() 从多个缓冲区写入
+#include <memory> // shared_ptr
+#include <atomic>
+
+#include "../bundle/bundle.h"
+#include "./response_header.h"
+#include "./fixed_response.h"
+#include "./out_queue.h"
+#include "./file_cache.h"
+#include "./arena.h"
+#include "./metrics.h"
+#include "../log/access_log.h"
+#include "../log/trace_log.h"
+#include "../log/capture_log.h"
+#include "../log/profiler.h"
+#include "../threadpool/threadpool.h"
+
+class http_conn;
+
+// 冷文件预读任务，放到I/O线程池中执行。嵌在http_conn中，不需要单独分配
+struct prefetch_task{
+    http_conn *m_conn;
+    void process();
+};
+
+// 剖析请求，交给剖析线程，结束后在剖析线程中生成响应。同样嵌在http_conn中
+struct profile_task:public profile_job{
+    http_conn *m_conn;
+    void finish(bool ok,std::string &out,const std::string &err) override;
+};
+
+/*
+    流式响应的数据源。响应以Transfer-Encoding: chunked发送，不需要预先知道长度。
+    输出队列低于高水位时调用produce()，它用write_chunk()写入一些数据，
+    全部生成完后调用end_chunked()。socket写不动时不会再调用，由可写事件驱动
+*/
+class stream_source{
+    public:
+        virtual ~stream_source(){}
+        // 每次至少写入一块数据或者结束，返回false表示出错，连接会被关闭
+        virtual bool produce(http_conn &conn)=0;
+};
 
 class http_conn{
     public:
-        static int m_epollfd; // 监听套接字的文件描述符
-        static int m_conn_count; // http连接数
+        static std::atomic<int> m_conn_count; // http连接数，工作线程关闭连接时也会修改
+        static std::string m_doc_root; // 资源路径
+        static threadpool<prefetch_task> *m_io_pool; // 预读冷文件的I/O线程池，为NULL时不预读
+        static bool m_autoindex; // 请求目录时是否生成文件列表
+        static threadpool<http_conn> *m_pool; // 解析请求的工作线程池，为NULL时（shared-nothing模式）全部在事件循环中处理
+        static bool m_edge_triggered; // true：边缘触发，只注册一次；false：水平触发+EPOLLONESHOT，每次处理完重新注册
+        static bool m_tcp_cork; // 流式响应发送期间打开TCP_CORK
+        static int m_max_requests; // 一个连接最多处理的请求数，0表示不限
+        static int m_inline_budget; // 主线程本轮还能直接处理的请求数，main每次epoll_wait后重置，用完后都交给线程池
+        static std::string m_stats_path; // 内部统计的路径，为空时不提供
+        static std::string m_profile_path; // 采样剖析的路径，为空时不提供
+        static std::atomic<int> m_draining_conns; // 关闭了写方向、等对方关闭的连接数
+
+        static const int DRAIN_TIMEOUT_MS=2000; // 关闭写方向后最多等对方这么久
+        static const int DRAIN_CHECK_MS=250; // 有连接在等对方关闭时，事件循环隔这么久检查一次超时
 
         enum METHOD {GET,POST}; // 请求类型
         enum HTTP_CODE { // ？？？？？？解析请求报文所得的结果 给每个都写个注释吧
@@ -24,6 +79,10 @@ class http_conn{
             NO_RESOURCE,
             FORBIDDEN_REQUEST,
             FILE_REQUEST,
+            NOT_MODIFIED, // If-None-Match与资源包中的ETag一致
+            STREAM_REQUEST, // 动态内容，由m_stream分块生成
+            SLOW_REQUEST, // 主线程的快速路径处理不了（要访问文件系统），交给工作线程
+            ASYNC_REQUEST, // 资源由其他线程生成（剖析），连接交给它，生成完由它接着处理
             INTERNAL_ERROR, 
             CLOSED_CONNECTION //?????
         };
@@ -31,63 +90,129 @@ class http_conn{
         {
             PARSE_STATE_LINE,
             PARSE_STATE_HEADER,
-            PARSE_STATE_BODY
+            PARSE_STATE_BODY,
+            PARSE_STATE_DONE // 请求已经完整解析，只差请求资源
         };
         enum LINE_STATUS{
             LINE_OK,
             LINE_OPEN,
             LINE_BAD
         };
+        enum CONN_STATE{ // m_state的各个位，见acquire()
+            STATE_CLOSED=1,
+            STATE_BUSY=2,
+            PENDING_IN=4,
+            PENDING_OUT=8
+        };
 
-        void init(int sockfd, const sockaddr_in &addr);
+        http_conn();
+
+        void init(int sockfd, const sockaddr_in &addr, int epollfd);
         void init();
 
-        bool read(); // 将http请求内容读入缓冲区
-        bool write(); // 将http响应内容写入文件描述符
+        // 主线程调用：连接上有事件
+        void on_event(uint32_t events);
 
-        // http的任务：解析请求报文 整合响应资源
+        // 工作线程的任务：解析请求报文 整合响应资源，并直接发送
         void process();
+        // I/O线程的任务：把要发送的文件读进page cache，然后开始发送
+        void prefetch();
+        // 剖析线程：剖析结束，用结果生成响应，然后接着处理这个连接
+        void profile_done(bool ok,std::string &out,const std::string &err);
 
         void close_conn(); // 关闭这个http连接
 
+        // 事件循环的等待时间：有连接在等对方关闭时不能一直阻塞，否则超时的连接没人关闭
+        static int drain_wait_ms(){ return m_draining_conns.load(std::memory_order_relaxed)>0?DRAIN_CHECK_MS:-1; }
+        // 事件循环每轮调用：关闭conns[0,n)中等对方关闭超时的连接，每DRAIN_CHECK_MS最多检查一次
+        static void expire_draining(http_conn *conns,int n,uint64_t &next_check);
+
+        // 流式响应：stream_source在produce()中调用
+        void write_chunk(const char *data,size_t len); // 拷贝一块数据
+        void write_chunk_ref(const char *data,size_t len,std::shared_ptr<const void> owner); // 引用一块数据
+        void end_chunked(); // 最后一块
+
     private:
         int m_sockfd; // 该http连接的socket文件描述符
+        int m_epollfd; // 监听这个连接的epoll实例
         sockaddr_in m_address; // 客户端的ip地址+端口号信息
         bool m_et_mode; // 是否设置为边缘触发模式
+        std::atomic<uint32_t> m_state; // CONN_STATE
+        bool m_readable; // 有数据可读（还没读到EAGAIN），只有持有者访问
+        bool m_writable; // 可以继续写（上次写没有遇到EAGAIN），只有持有者访问
+        bool m_draining; // 最后一个响应已经发完并关闭了写方向，只丢弃读到的数据，只有持有者访问
+        std::atomic<uint64_t> m_drain_deadline; // 等对方关闭的截止时间，0表示没有在等；事件循环检查超时时读
 
         PARSE_STATE m_parse_state;
 
         METHOD m_method; // http请求类型
-        std::string m_url; // 请求的url
-        std::string m_version; // http版本
-        bool m_linger; // 是否保持连接
+        std::string_view m_url; // 请求的url，指向读缓冲区中的请求行（以'\0'结尾）
+        std::string_view m_version; // http版本，指向读缓冲区
+        std::string_view m_real_file; // 文件的完整路径，在m_arena中（以'\0'结尾）
+        bool m_http11; // HTTP/1.1默认保持连接，HTTP/1.0默认关闭
+        bool m_linger; // 是否保持连接，每个请求按版本和Connection头部重新确定
+        int m_served; // 这个连接已经处理的请求数
+        bool m_chunked; // 流式响应是否分块传输，HTTP/1.0不支持分块，改为发完关闭连接
         int m_body_len; // 请求体长度
         struct stat m_file_info; // 文件的相关的状态信息
         char *m_file_address; // 内存映射后目标文件在内存中的起始地址
+        size_t m_file_size; // 要发送的文件内容大小
+
+        std::shared_ptr<const void> m_file_owner; // 保证m_file_address有效：文件的映射或者资源包
+        const char *m_content_type; // 不一定以'\0'结尾
+        int m_content_type_len;
+        const char *m_etag; // 为NULL则不发送ETag
+        int m_etag_len;
+        bool m_accept_gzip; // 客户端是否接受gzip编码
+        bool m_gzip; // 响应正文是否是预压缩的gzip版本
+        bool m_etag_gz; // 选中的是gzip版本（包括304），ETag加"-gz"和原始版本区分
+        bool m_vary; // 资源有gzip版本，两种版本的响应都要带Vary: Accept-Encoding
+        std::string_view m_if_none_match; // 指向读缓冲区中的头部行
+        prefetch_task m_prefetch;
+        bool m_cold; // 新映射的文件有页不在page cache中，发送前要预读；只在映射或过期检查时用mincore判断
+        profile_task m_profile;
+        HTTP_CODE m_async_ret; // ASYNC_REQUEST的结果，生成完之前为NO_REQUEST
+        std::unique_ptr<stream_source> m_stream; // 流式响应的数据源
+        bool m_stream_done; // 数据源是否已经生成完
+        static const size_t STREAM_HIGH_WATER=64*1024; // 输出队列超过这么多字节就先不生成（流式响应、流水线请求），等socket可写
 
         // 限定读写缓冲区的大小
         static const int READ_BUFFER_SIZE=2048;
-        static const int WRITE_BUFFER_SIZE=1024;
+        static const int WRITE_BUFFER_SIZE=1024; // 响应头部的最大长度
         
         char m_read_buf[READ_BUFFER_SIZE]; // 读缓冲区
         int m_read_idx; // 读缓冲区中0～m_read_idx-1有读到的数据
         int m_check_idx; // 找下一行时，此时检查的位置
         int m_start_line; // 每次解析报文时，一行的起始位置（一行一行解析
+        int m_request_end; // 当前请求（包括请求体）在读缓冲区中的结束位置，之后是流水线上的下一个请求
+        bool m_pipelined; // 读缓冲区中还留有下一个请求的数据，不需要等可读事件就要处理
+        bool m_inline; // 正在主线程中处理，do_request()不能阻塞
     
-        char m_write_buf[WRITE_BUFFER_SIZE];
-        int m_write_idx;
-/*
-    struct iovec {
-        void  *iov_base; // 指向数据缓冲区的指针
-        size_t iov_len;  // 缓冲区的大小（以字节为单位）
-    };
-    iovec 结构体允许你构建一个数组，其中每个元素描述了一个不同的数据缓冲区及其大小。
-    可以使用readv和writev一次性操作多个不连续的内存区域，而无需将它们合并成单个连续的缓冲区。
-*/
-        struct iovec m_iov[2]; // 两个缓冲区，分别是写缓冲区和文件的内存映射区（不一定有
-        int m_iov_count; // 实际用到几个缓冲区
-        int bytes_to_send; // 需要发送多少字节的数据
-        int bytes_have_send; // 已经发送多少字节的数据
+        arena m_arena; // 请求用到的内存，每个请求开始时清空
+
+        // 请求各阶段的时间（单调时钟，纳秒），用于延迟直方图、访问日志和追踪
+        struct request_times{
+            uint64_t m_accept; // 建立连接，只有连接上的第一个请求有（开启了追踪时才取时间，m_read同）
+            uint64_t m_read; // 读到请求的第一批数据，流水线上已经在缓冲区中的请求没有
+            uint64_t m_start; // 开始解析
+            uint64_t m_parsed; // 解析完，开始请求资源
+            uint64_t m_dispatched; // 交给线程池
+            uint64_t m_picked; // 工作线程取到
+        };
+        request_times m_times;
+        int m_status; // 响应的状态码
+        uint64_t m_log_mark; // 响应在输出队列中的起点：之前已发送和待发送的字节数
+        uint64_t m_log_queued; // 响应放进输出队列的时间
+        uint64_t m_log_start; // 响应对应的请求开始解析的时间，发完之前m_times可能已经属于下一个请求了
+        access_record m_log; // 还没发完的响应的记录，发完或者被下一个响应合并发送时写入日志
+        bool m_log_pending; // 有响应还没发完，发完时记录发送时间
+        trace_sample m_trace; // 还没发完的响应的各阶段时间，选为样本或者成为慢请求时交给追踪
+        uint32_t m_capture_id; // 流量捕获中的连接编号，0表示不捕获
+        header_builder m_header; // 拼接响应头部
+        out_queue m_out; // 待发送的数据
+
+        void reset_request(); // 重置单个请求的状态，不动读缓冲区
+        bool next_request(); // 响应发送完，把剩下的数据移到读缓冲区开头，准备解析下一个请求；边界不对时返回false
 
         HTTP_CODE process_read(); // 利用有限状态机解析整个请求报文，并请求资源
 
@@ -97,21 +222,44 @@ class http_conn{
         // 解析http请求
         HTTP_CODE parse_request_line(char *text); // 解析请求行
         HTTP_CODE parse_request_headers(char *text); // 请求头部
-        HTTP_CODE parse_request_body(char *text); // 请求体
+        HTTP_CODE parse_request_body(); // 请求体是否完整
+        void parse_connection(const char *value); // Connection头部
 
         HTTP_CODE do_request(); // 请求资源
+        void use_cached(const file_cache::entry &e); // 响应缓存中的文件
+        HTTP_CODE do_bundle_request(const bundle &b); // 从资源包中查找资源
+        void unmap(); // 释放正在发送的文件
+        bool read(); // 将http请求内容读入缓冲区，读到EAGAIN或者缓冲区满为止
+        bool send(); // 将输出队列写入socket，写到EAGAIN或写完为止
+        void start_drain(); // 响应发完后关闭写方向，等对方关闭
+        bool drain(); // 丢弃读到的数据，对方关闭、出错或超时时返回false
+
+        bool acquire(uint32_t pending); // 尝试持有连接，连接正忙时只记录事件
+        void take_pending(uint32_t pending);
+        bool release(); // 没有新事件时释放连接
+        void run(bool in_reactor); // 持有连接时处理所有就绪的事件
+        bool handle_request(bool in_reactor); // 解析请求并生成响应
+        bool dispatch(); // 交给线程池
+        bool pump_stream(); // 让数据源生成数据直到高水位
+        void chunk_size_line(size_t len); // 块长度行
 
         bool process_write(HTTP_CODE ret); // 拼接http响应
+        void response_queued(bool in_reactor); // 响应放进了输出队列，记录各阶段耗时，生成日志记录
+        void response_done(uint8_t flags); // 响应发完或者放弃，记录发送耗时，写入日志记录
+        HTTP_CODE do_stats_request(); // 生成/__stats的内容
+        HTTP_CODE do_profile_request(); // 剖析一段时间，返回折叠栈
 
-        bool format_write(const char *format,...); // 按照传入格式写数据到写缓冲区
         // 响应行
-        bool add_response_line(int status, const char *title);
+        bool add_response_line(int status);
         // 响应头部和空行
-        bool add_response_headers(int content_length); 
+        bool add_response_headers(size_t content_length); 
         bool add_content_type(); // 内容类型
-        bool add_content_length(int len); // 内容长度
-        bool add_connection(); // 是否保持连接
+        bool add_entity_headers(); // ETag、Content-Encoding等资源相关的头部
+        bool add_content_length(size_t len); // 内容长度
+        bool add_connection(); // 是否保持连接，保持时带上还能处理的请求数
         bool add_blank_line(); // 空行
-        // 响应正文
-        bool add_response_body(const char* body);
-};
\ No newline at end of file
+        // 整个响应都是预先生成好的
+        bool add_fixed_response(FIXED_RESPONSE r);
+};
+
+#endif
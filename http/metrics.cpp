@@ -0,0 +1,313 @@
+#include "./metrics.h"
+#include "../lock/locker.h"
+#include "../cpu/busy_poll.h"
+#include "../log/watchdog.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+thread_local loop_stats *loop_stats::m_local=NULL;
+static locker all_stats_lock;
+static std::vector<loop_stats *> all_stats; // 所有线程的计数，线程退出后也保留
+static const uint64_t start_ns=monotonic_ns();
+
+static const int HALF=1<<(hdr_histogram::SUB_BITS-1);
+
+hdr_histogram::hdr_histogram():m_count(0),m_sum(0),m_max(0){
+    for(int i=0;i<BUCKETS;i++){
+        m_counts[i].store(0,std::memory_order_relaxed);
+    }
+}
+
+/*
+    小于2^SUB_BITS的值每个值一格；更大的值取最高的SUB_BITS位（范围是[HALF,2*HALF)），
+    右移的位数决定段，v>>shift决定段内的格，各段首尾相接
+*/
+int hdr_histogram::index(uint64_t v){
+    if(v<(1ull<<SUB_BITS)){
+        return (int)v;
+    }
+    int shift=63-__builtin_clzll(v)-(SUB_BITS-1);
+    return shift*HALF+(int)(v>>shift);
+}
+
+uint64_t hdr_histogram::lower_bound(int i){
+    if(i<(1<<SUB_BITS)){
+        return i;
+    }
+    int shift=i/HALF-1;
+    return (uint64_t)(i%HALF+HALF)<<shift;
+}
+
+void hdr_histogram::record(uint64_t v){
+    loop_stats::inc(m_counts[index(v)]);
+    loop_stats::inc(m_count);
+    loop_stats::add(m_sum,v);
+    if(v>m_max.load(std::memory_order_relaxed)){
+        m_max.store(v,std::memory_order_relaxed);
+    }
+}
+
+hdr_snapshot::hdr_snapshot():m_count(0),m_sum(0),m_max(0){
+    memset(m_counts,0,sizeof(m_counts));
+}
+
+void hdr_snapshot::add(const hdr_histogram &h){
+    for(int i=0;i<hdr_histogram::BUCKETS;i++){
+        m_counts[i]+=h.m_counts[i].load(std::memory_order_relaxed);
+    }
+    m_count+=h.m_count.load(std::memory_order_relaxed);
+    m_sum+=h.m_sum.load(std::memory_order_relaxed);
+    uint64_t max=h.m_max.load(std::memory_order_relaxed);
+    if(max>m_max){
+        m_max=max;
+    }
+}
+
+uint64_t hdr_snapshot::percentile(double q) const{
+    uint64_t total=0;
+    for(int i=0;i<hdr_histogram::BUCKETS;i++){ // 各个计数分开读的，总数以格子之和为准
+        total+=m_counts[i];
+    }
+    if(total==0){
+        return 0;
+    }
+    uint64_t rank=(uint64_t)(q*total+0.5);
+    if(rank<1){
+        rank=1;
+    }
+    uint64_t seen=0;
+    for(int i=0;i<hdr_histogram::BUCKETS;i++){
+        seen+=m_counts[i];
+        if(seen>=rank){
+            uint64_t upper=i+1<hdr_histogram::BUCKETS?hdr_histogram::lower_bound(i+1)-1:UINT64_MAX;
+            return upper<m_max?upper:m_max;
+        }
+    }
+    return m_max;
+}
+
+loop_stats::loop_stats():m_accepted(0),m_closed(0),m_requests(0),m_reused(0),m_close_client(0),m_close_limit(0),
+                         m_bytes_out(0),m_cache_hits(0),m_cache_revalidated(0),m_cache_misses(0),
+                         m_bundle_hits(0),m_bundle_misses(0){
+    for(int i=0;i<STATUS_COUNT;i++){
+        m_status[i].store(0,std::memory_order_relaxed);
+    }
+}
+
+void loop_stats::count_status(int status){
+    int c;
+    switch(status){
+        case 200: c=STATUS_200; break;
+        case 304: c=STATUS_304; break;
+        case 400: c=STATUS_400; break;
+        case 403: c=STATUS_403; break;
+        case 404: c=STATUS_404; break;
+        case 500: c=STATUS_500; break;
+        default: c=STATUS_OTHER; break;
+    }
+    inc(m_status[c]);
+}
+
+void loop_stats::attach(loop_stats *st){
+    m_local=st;
+    all_stats_lock.lock();
+    all_stats.push_back(st);
+    all_stats_lock.unlock();
+}
+
+loop_stats &loop_stats::local(){
+    if(!m_local){
+        attach(new loop_stats());
+    }
+    return *m_local;
+}
+
+stats_snapshot::stats_snapshot():m_accepted(0),m_closed(0),m_requests(0),m_reused(0),m_close_client(0),m_close_limit(0),
+                                 m_bytes_out(0),m_cache_hits(0),m_cache_revalidated(0),m_cache_misses(0),
+                                 m_bundle_hits(0),m_bundle_misses(0),m_watchdog(false),m_uptime_ns(0),
+                                 m_active(0),m_queue_depth(0),m_io_queue_depth(0){
+    memset(m_status,0,sizeof(m_status));
+}
+
+static uint64_t get(const std::atomic<uint64_t> &c){
+    return c.load(std::memory_order_relaxed);
+}
+
+void stats_snapshot::collect(){
+    all_stats_lock.lock();
+    for(size_t i=0;i<all_stats.size();i++){
+        const loop_stats *st=all_stats[i];
+        m_accepted+=get(st->m_accepted);
+        m_closed+=get(st->m_closed);
+        m_requests+=get(st->m_requests);
+        m_reused+=get(st->m_reused);
+        m_close_client+=get(st->m_close_client);
+        m_close_limit+=get(st->m_close_limit);
+        m_bytes_out+=get(st->m_bytes_out);
+        for(int j=0;j<STATUS_COUNT;j++){
+            m_status[j]+=get(st->m_status[j]);
+        }
+        m_cache_hits+=get(st->m_cache_hits);
+        m_cache_revalidated+=get(st->m_cache_revalidated);
+        m_cache_misses+=get(st->m_cache_misses);
+        m_bundle_hits+=get(st->m_bundle_hits);
+        m_bundle_misses+=get(st->m_bundle_misses);
+        for(int j=0;j<STAGE_COUNT;j++){
+            m_latency[j].add(st->m_latency[j]);
+        }
+    }
+    all_stats_lock.unlock();
+    m_watchdog=watchdog::enabled();
+    if(m_watchdog){
+        watchdog::collect(m_stalls);
+    }
+    m_uptime_ns=monotonic_ns()-start_ns;
+}
+
+void loop_stats::report(){
+    stats_snapshot st;
+    st.collect();
+    char buf[256];
+    snprintf(buf,sizeof(buf),"connections: accepted %llu closed %llu, requests %llu (%.1f per connection), "
+             "reused %llu (%.1f%%), closed by client %llu, by limit %llu",
+             (unsigned long long)st.m_accepted,(unsigned long long)st.m_closed,(unsigned long long)st.m_requests,
+             st.m_accepted?(double)st.m_requests/st.m_accepted:0.0,
+             (unsigned long long)st.m_reused,st.m_requests?100.0*st.m_reused/st.m_requests:0.0,
+             (unsigned long long)st.m_close_client,(unsigned long long)st.m_close_limit);
+    std::cerr << buf << std::endl;
+}
+
+static const char *stage_names[STAGE_COUNT]={"parse","queue","process","send","total"};
+static const char *status_names[STATUS_COUNT]={"200","304","400","403","404","500","other"};
+static const double quantiles[]={0.5,0.9,0.99,0.999};
+static const char *quantile_names[]={"0.5","0.9","0.99","0.999"};
+static const char *quantile_keys[]={"p50","p90","p99","p999"};
+static const int QUANTILES=sizeof(quantiles)/sizeof(quantiles[0]);
+
+static void append(std::string &out,const char *fmt,...) __attribute__((format(printf,2,3)));
+static void append(std::string &out,const char *fmt,...){
+    char buf[512];
+    va_list ap;
+    va_start(ap,fmt);
+    int n=vsnprintf(buf,sizeof(buf),fmt,ap);
+    va_end(ap);
+    out.append(buf,n<(int)sizeof(buf)?n:sizeof(buf)-1);
+}
+
+static void prometheus_metric(std::string &out,const char *name,const char *type,const char *help,uint64_t v){
+    append(out,"# HELP webserver_%s %s\n# TYPE webserver_%s %s\nwebserver_%s %llu\n",
+           name,help,name,type,name,(unsigned long long)v);
+}
+
+std::string format_prometheus(const stats_snapshot &s){
+    std::string out;
+    out.reserve(8192);
+    append(out,"# HELP webserver_uptime_seconds Seconds since the server started.\n"
+               "# TYPE webserver_uptime_seconds gauge\nwebserver_uptime_seconds %.3f\n",s.m_uptime_ns/1e9);
+    prometheus_metric(out,"connections_accepted_total","counter","Accepted connections.",s.m_accepted);
+    prometheus_metric(out,"connections_closed_total","counter","Closed connections.",s.m_closed);
+    prometheus_metric(out,"connections_active","gauge","Open connections.",s.m_active);
+    prometheus_metric(out,"requests_total","counter","Parsed requests.",s.m_requests);
+    prometheus_metric(out,"requests_reused_total","counter","Requests on a connection that had served one before.",s.m_reused);
+    prometheus_metric(out,"connections_closed_by_client_total","counter","Connections closed on the client's request.",s.m_close_client);
+    prometheus_metric(out,"connections_closed_by_limit_total","counter","Connections closed at the per-connection request limit.",s.m_close_limit);
+    prometheus_metric(out,"queue_depth","gauge","Requests waiting in the worker pool queue.",s.m_queue_depth);
+    prometheus_metric(out,"io_queue_depth","gauge","Responses waiting in the prefetch pool queue.",s.m_io_queue_depth);
+    prometheus_metric(out,"response_bytes_total","counter","Response bytes sent.",s.m_bytes_out);
+
+    out+="# HELP webserver_responses_total Responses by status code.\n# TYPE webserver_responses_total counter\n";
+    for(int i=0;i<STATUS_COUNT;i++){
+        append(out,"webserver_responses_total{code=\"%s\"} %llu\n",status_names[i],(unsigned long long)s.m_status[i]);
+    }
+
+    out+="# HELP webserver_cache_lookups_total File cache and bundle lookups by result.\n# TYPE webserver_cache_lookups_total counter\n";
+    append(out,"webserver_cache_lookups_total{cache=\"file\",result=\"hit\"} %llu\n",(unsigned long long)s.m_cache_hits);
+    append(out,"webserver_cache_lookups_total{cache=\"file\",result=\"revalidated\"} %llu\n",(unsigned long long)s.m_cache_revalidated);
+    append(out,"webserver_cache_lookups_total{cache=\"file\",result=\"miss\"} %llu\n",(unsigned long long)s.m_cache_misses);
+    append(out,"webserver_cache_lookups_total{cache=\"bundle\",result=\"hit\"} %llu\n",(unsigned long long)s.m_bundle_hits);
+    append(out,"webserver_cache_lookups_total{cache=\"bundle\",result=\"miss\"} %llu\n",(unsigned long long)s.m_bundle_misses);
+
+    // 分位数由直方图算出，用summary表示；需要跨实例聚合时用JSON中的原始分位数自行处理
+    out+="# HELP webserver_request_stage_seconds Time spent in each request stage.\n# TYPE webserver_request_stage_seconds summary\n";
+    for(int i=0;i<STAGE_COUNT;i++){
+        const hdr_snapshot &h=s.m_latency[i];
+        for(int j=0;j<QUANTILES;j++){
+            append(out,"webserver_request_stage_seconds{stage=\"%s\",quantile=\"%s\"} %.9f\n",
+                   stage_names[i],quantile_names[j],h.percentile(quantiles[j])/1e9);
+        }
+        append(out,"webserver_request_stage_seconds_sum{stage=\"%s\"} %.9f\n",stage_names[i],h.m_sum/1e9);
+        append(out,"webserver_request_stage_seconds_count{stage=\"%s\"} %llu\n",stage_names[i],(unsigned long long)h.m_count);
+    }
+    if(s.m_watchdog){
+        out+="# HELP webserver_stall_seconds Event loop iterations and pool tasks that ran past the watchdog threshold.\n"
+             "# TYPE webserver_stall_seconds summary\n";
+        for(int i=0;i<THREAD_ROLE_COUNT;i++){
+            const hdr_snapshot &h=s.m_stalls[i];
+            const char *role=thread_registry::role_name(i);
+            for(int j=0;j<QUANTILES;j++){
+                append(out,"webserver_stall_seconds{role=\"%s\",quantile=\"%s\"} %.9f\n",
+                       role,quantile_names[j],h.percentile(quantiles[j])/1e9);
+            }
+            append(out,"webserver_stall_seconds_sum{role=\"%s\"} %.9f\n",role,h.m_sum/1e9);
+            append(out,"webserver_stall_seconds_count{role=\"%s\"} %llu\n",role,(unsigned long long)h.m_count);
+        }
+    }
+    return out;
+}
+
+std::string format_json(const stats_snapshot &s){
+    std::string out;
+    out.reserve(4096);
+    double uptime=s.m_uptime_ns/1e9;
+    append(out,"{\"uptime_seconds\":%.3f,", uptime);
+    append(out,"\"connections\":{\"accepted\":%llu,\"closed\":%llu,\"active\":%d,\"accept_rate\":%.1f,"
+               "\"closed_by_client\":%llu,\"closed_by_limit\":%llu},",
+           (unsigned long long)s.m_accepted,(unsigned long long)s.m_closed,s.m_active,uptime>0?s.m_accepted/uptime:0.0,
+           (unsigned long long)s.m_close_client,(unsigned long long)s.m_close_limit);
+    append(out,"\"requests\":{\"total\":%llu,\"reused\":%llu,\"rate\":%.1f},",
+           (unsigned long long)s.m_requests,(unsigned long long)s.m_reused,uptime>0?s.m_requests/uptime:0.0);
+    append(out,"\"queue\":{\"depth\":%d,\"io_depth\":%d},",s.m_queue_depth,s.m_io_queue_depth);
+    append(out,"\"bytes_out\":%llu,",(unsigned long long)s.m_bytes_out);
+    out+="\"responses\":{";
+    for(int i=0;i<STATUS_COUNT;i++){
+        append(out,"%s\"%s\":%llu",i?",":"",status_names[i],(unsigned long long)s.m_status[i]);
+    }
+    out+="},";
+    uint64_t lookups=s.m_cache_hits+s.m_cache_revalidated+s.m_cache_misses;
+    uint64_t bundle=s.m_bundle_hits+s.m_bundle_misses;
+    append(out,"\"cache\":{\"file\":{\"hits\":%llu,\"revalidated\":%llu,\"misses\":%llu,\"hit_ratio\":%.4f},"
+               "\"bundle\":{\"hits\":%llu,\"misses\":%llu,\"hit_ratio\":%.4f}},",
+           (unsigned long long)s.m_cache_hits,(unsigned long long)s.m_cache_revalidated,(unsigned long long)s.m_cache_misses,
+           lookups?(double)(s.m_cache_hits+s.m_cache_revalidated)/lookups:0.0,
+           (unsigned long long)s.m_bundle_hits,(unsigned long long)s.m_bundle_misses,
+           bundle?(double)s.m_bundle_hits/bundle:0.0);
+    out+="\"latency_us\":{";
+    for(int i=0;i<STAGE_COUNT;i++){
+        const hdr_snapshot &h=s.m_latency[i];
+        append(out,"%s\"%s\":{\"count\":%llu,\"mean\":%.3f",i?",":"",stage_names[i],
+               (unsigned long long)h.m_count,h.m_count?h.m_sum/1e3/h.m_count:0.0);
+        for(int j=0;j<QUANTILES;j++){
+            append(out,",\"%s\":%.3f",quantile_keys[j],h.percentile(quantiles[j])/1e3);
+        }
+        append(out,",\"max\":%.3f}",h.m_max/1e3);
+    }
+    out+="}";
+    if(s.m_watchdog){
+        out+=",\"stalls_ms\":{";
+        for(int i=0;i<THREAD_ROLE_COUNT;i++){
+            const hdr_snapshot &h=s.m_stalls[i];
+            append(out,"%s\"%s\":{\"count\":%llu",i?",":"",thread_registry::role_name(i),(unsigned long long)h.m_count);
+            for(int j=0;j<QUANTILES;j++){
+                append(out,",\"%s\":%.3f",quantile_keys[j],h.percentile(quantiles[j])/1e6);
+            }
+            append(out,",\"max\":%.3f}",h.m_max/1e6);
+        }
+        out+="}";
+    }
+    out+="}\n";
+    return out;
+}
@@ -0,0 +1,134 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "../log/thread_registry.h" // THREAD_ROLE_COUNT
+
+/*
+    HDR（高动态范围）直方图：按2的幂分段，每段再线性分成16格，相对误差不超过1/16，
+    整个64位的取值范围用同一张976格的表，记录只是算下标加几次计数，不需要锁和内存分配。
+    只有所属线程记录，其他线程只读
+*/
+class hdr_histogram{
+    public:
+        static const int SUB_BITS=5; // 值小于2^SUB_BITS时每个值一格
+        static const int BUCKETS=(64-SUB_BITS+2)*(1<<(SUB_BITS-1));
+
+        hdr_histogram();
+        void record(uint64_t v);
+
+        static int index(uint64_t v);
+        static uint64_t lower_bound(int i); // 第i格中最小的值
+
+    private:
+        friend struct hdr_snapshot;
+        std::atomic<uint64_t> m_counts[BUCKETS];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_max;
+};
+
+// 几个线程的直方图之和，在抓取时汇总
+struct hdr_snapshot{
+    uint64_t m_counts[hdr_histogram::BUCKETS];
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_max;
+
+    hdr_snapshot();
+    void add(const hdr_histogram &h);
+    uint64_t percentile(double q) const; // q在0到1之间，返回所在格的上界（不超过最大值）
+};
+
+// 请求各阶段的耗时
+enum STAGE{
+    STAGE_PARSE=0, // 从开始解析到解析完请求
+    STAGE_QUEUE, // 在线程池队列中等待的时间
+    STAGE_PROCESS, // 查找资源、生成响应
+    STAGE_SEND, // 响应放进输出队列到发送完
+    STAGE_TOTAL, // 从开始解析到发送完
+    STAGE_COUNT
+};
+
+// 单独计数的状态码，其余的计入STATUS_OTHER
+enum STATUS_CLASS{
+    STATUS_200=0,
+    STATUS_304,
+    STATUS_400,
+    STATUS_403,
+    STATUS_404,
+    STATUS_500,
+    STATUS_OTHER,
+    STATUS_COUNT
+};
+
+/*
+    一个线程的计数。只有所属线程修改，其他线程只读；按缓存行对齐，不同线程的计数不会互相干扰
+    每个线程第一次计数时创建自己的一份并登记，抓取时才汇总所有线程的
+*/
+struct alignas(64) loop_stats{
+    std::atomic<uint64_t> m_accepted; // 接受的连接
+    std::atomic<uint64_t> m_closed; // 关闭的连接
+    std::atomic<uint64_t> m_requests; // 处理的请求
+    std::atomic<uint64_t> m_reused; // 在已经处理过请求的连接上到达的请求，省掉了一次握手
+    std::atomic<uint64_t> m_close_client; // 客户端要求关闭（Connection: close或HTTP/1.0没有keep-alive）
+    std::atomic<uint64_t> m_close_limit; // 连接上的请求数达到上限后关闭
+    std::atomic<uint64_t> m_bytes_out; // 发出的响应字节数
+    std::atomic<uint64_t> m_status[STATUS_COUNT];
+    std::atomic<uint64_t> m_cache_hits; // 文件缓存命中
+    std::atomic<uint64_t> m_cache_revalidated; // 缓存过期但文件没变，续用映射
+    std::atomic<uint64_t> m_cache_misses; // 要打开并映射文件
+    std::atomic<uint64_t> m_bundle_hits;
+    std::atomic<uint64_t> m_bundle_misses;
+    hdr_histogram m_latency[STAGE_COUNT]; // 纳秒
+
+    loop_stats();
+    // 只有一个写者，不需要带lock前缀的原子加
+    static void inc(std::atomic<uint64_t> &c){ c.store(c.load(std::memory_order_relaxed)+1,std::memory_order_relaxed); }
+    static void add(std::atomic<uint64_t> &c,uint64_t v){ c.store(c.load(std::memory_order_relaxed)+v,std::memory_order_relaxed); }
+    void count_status(int status);
+
+    static loop_stats &local(); // 当前线程的计数，没有时创建
+    static void attach(loop_stats *st); // 当前线程使用st计数（shared-nothing模式下每个核绑定CPU后自己创建，指针放在core_arg中）
+    static void report(); // 打印连接复用情况
+
+    private:
+        static thread_local loop_stats *m_local;
+};
+
+// 所有线程的计数之和
+struct stats_snapshot{
+    uint64_t m_accepted;
+    uint64_t m_closed;
+    uint64_t m_requests;
+    uint64_t m_reused;
+    uint64_t m_close_client;
+    uint64_t m_close_limit;
+    uint64_t m_bytes_out;
+    uint64_t m_status[STATUS_COUNT];
+    uint64_t m_cache_hits;
+    uint64_t m_cache_revalidated;
+    uint64_t m_cache_misses;
+    uint64_t m_bundle_hits;
+    uint64_t m_bundle_misses;
+    hdr_snapshot m_latency[STAGE_COUNT];
+    bool m_watchdog; // 开启了卡顿监视
+    hdr_snapshot m_stalls[THREAD_ROLE_COUNT]; // 各个角色超过阈值的工作时长
+    uint64_t m_uptime_ns; // 从启动到汇总时的时间，用来算速率
+
+    // 抓取时才知道的瞬时值，由调用者填写
+    int m_active; // 当前连接数
+    int m_queue_depth; // 线程池队列中等待的请求
+    int m_io_queue_depth; // I/O线程池队列中等待预读的响应
+
+    stats_snapshot();
+    void collect(); // 汇总所有线程的计数
+};
+
+// /__stats的两种格式
+std::string format_prometheus(const stats_snapshot &s);
+std::string format_json(const stats_snapshot &s);
+
+#endif
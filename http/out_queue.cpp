@@ -0,0 +1,134 @@
+#include "./out_queue.h"
+
+#include <errno.h>
+#include <limits.h> // IOV_MAX
+#include <string.h>
+#include <sys/uio.h>
+
+const size_t out_queue::CHUNK_SIZE;
+
+out_queue::out_queue():m_head(0),m_pending(0),m_sent(0){
+}
+
+void out_queue::clear(){
+    m_segs.clear();
+    m_head=0;
+    m_pending=0;
+    // 没有段再引用当前内存块时，直接从头复用，keep-alive连接不需要每个响应都分配内存
+    if(m_tail && m_tail.use_count()==1){
+        m_tail->m_used=0;
+    }
+}
+
+void out_queue::truncate(uint64_t mark){
+    uint64_t keep=mark>m_sent?mark-m_sent:0;
+    while(m_pending>keep && m_segs.size()>m_head){
+        segment &last=m_segs.back();
+        size_t drop=m_pending-keep<last.m_len?m_pending-keep:last.m_len;
+        // 内存块末尾的自有字节还给内存块
+        if(last.m_owner==m_tail && last.m_data+last.m_len==m_tail->m_data+m_tail->m_used){
+            m_tail->m_used-=drop;
+        }
+        m_pending-=drop;
+        if(drop==last.m_len){
+            m_segs.pop_back();
+        }else{
+            last.m_len-=drop;
+        }
+    }
+    if(empty()){
+        clear();
+    }
+}
+
+void out_queue::push_ref(const char *data,size_t len,std::shared_ptr<const void> owner){
+    if(len==0){
+        return;
+    }
+    segment seg;
+    seg.m_data=data;
+    seg.m_len=len;
+    seg.m_owner=std::move(owner);
+    m_segs.push_back(std::move(seg));
+    m_pending+=len;
+}
+
+char *out_queue::reserve(size_t n){
+    if(!m_tail || m_tail->m_capacity-m_tail->m_used<n){
+        if(m_tail && m_tail.use_count()==1 && empty() && m_tail->m_capacity>=n){
+            m_tail->m_used=0;
+        }else{
+            m_tail=std::make_shared<chunk>(n>CHUNK_SIZE?n:CHUNK_SIZE);
+        }
+    }
+    return m_tail->m_data+m_tail->m_used;
+}
+
+void out_queue::commit(size_t n){
+    if(n==0){
+        return;
+    }
+    char *p=m_tail->m_data+m_tail->m_used;
+    m_tail->m_used+=n;
+    m_pending+=n;
+    // 和上一段在同一内存块中且相邻时直接合并
+    if(!empty()){
+        segment &last=m_segs.back();
+        if(last.m_owner==m_tail && last.m_data+last.m_len==p){
+            last.m_len+=n;
+            return;
+        }
+    }
+    segment seg;
+    seg.m_data=p;
+    seg.m_len=n;
+    seg.m_owner=m_tail;
+    m_segs.push_back(std::move(seg));
+}
+
+void out_queue::push_copy(const char *data,size_t len){
+    if(len==0){
+        return;
+    }
+    memcpy(reserve(len),data,len);
+    commit(len);
+}
+
+int out_queue::flush(int fd){
+    struct iovec iov[IOV_MAX];
+    while(!empty()){
+        int cnt=0;
+        for(size_t i=m_head;i<m_segs.size() && cnt<IOV_MAX;i++,cnt++){
+            iov[cnt].iov_base=(void *)m_segs[i].m_data;
+            iov[cnt].iov_len=m_segs[i].m_len;
+        }
+        ssize_t ret=writev(fd,iov,cnt);
+        if(ret==-1){
+            if(errno==EINTR){
+                continue;
+            }
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+                return 0;
+            }
+            return -1;
+        }
+        m_sent+=ret;
+        m_pending-=ret;
+        // 丢掉发送完的段，最后一段可能只发送了一部分
+        size_t n=ret;
+        while(n>0){
+            segment &seg=m_segs[m_head];
+            if(n>=seg.m_len){
+                n-=seg.m_len;
+                seg.m_owner.reset();
+                m_head++;
+            }else{
+                seg.m_data+=n;
+                seg.m_len-=n;
+                n=0;
+            }
+        }
+    }
+    clear();
+    return 1;
+}
@@ -0,0 +1,66 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+/*
+    输出队列：一个连接待发送的数据由若干段组成，每段是一块只读内存和保证它有效的引用：
+    - 自有字节：头部、Date行等，写在队列自己的内存块里
+    - 静态数据：预先生成的固定响应，引用fixed_response_set
+    - 文件区间：mmap的文件或资源包中的一段，引用对应的映射
+    flush()一次writev最多IOV_MAX段，部分发送后只调整剩余段的起始位置，不需要额外的记账
+*/
+class out_queue{
+    public:
+        out_queue();
+
+        bool empty() const { return m_head==m_segs.size(); }
+        uint64_t bytes_pending() const { return m_pending; }
+        uint64_t bytes_sent() const { return m_sent; }
+
+        void clear(); // 丢弃所有未发送的数据，保留已分配的内存以便复用
+        // 丢弃累计字节数（bytes_sent()+bytes_pending()）超过mark的部分，用来撤回还没发送的最后一个响应
+        void truncate(uint64_t mark);
+
+        // 引用外部内存，owner为空表示数据是静态的
+        void push_ref(const char *data,size_t len,std::shared_ptr<const void> owner);
+        // 拷贝到队列自己的内存块中
+        void push_copy(const char *data,size_t len);
+
+        // 在队列的内存块中预留至少n字节连续空间，写好后用commit()提交实际长度
+        char *reserve(size_t n);
+        void commit(size_t n);
+
+        /*
+            把队列中的数据写入fd，直到写完或者socket缓冲区满
+            返回值：1 全部写完；0 EAGAIN，还有数据；-1 出错（errno）
+        */
+        int flush(int fd);
+
+    private:
+        struct chunk{
+            explicit chunk(size_t cap):m_data(new char[cap]),m_capacity(cap),m_used(0){}
+            ~chunk(){ delete[] m_data; }
+            char *m_data;
+            size_t m_capacity;
+            size_t m_used;
+        };
+        struct segment{
+            const char *m_data;
+            size_t m_len;
+            std::shared_ptr<const void> m_owner;
+        };
+
+        static const size_t CHUNK_SIZE=4096;
+
+        std::vector<segment> m_segs; // m_head之前的段已经发送完
+        size_t m_head;
+        std::shared_ptr<chunk> m_tail; // 当前用于写入自有字节的内存块
+        uint64_t m_pending; // 还没发送的字节数
+        uint64_t m_sent; // 累计发送的字节数
+};
+
+#endif
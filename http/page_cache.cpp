@@ -0,0 +1,64 @@
+#include "./page_cache.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static size_t page_size(){
+    static const size_t size=sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// mincore/madvise要求起始地址按页对齐
+static void page_range(const void *addr,size_t len,char *&start,size_t &span){
+    uintptr_t mask=page_size()-1;
+    start=(char *)((uintptr_t)addr & ~mask);
+    span=((uintptr_t)addr+len-(uintptr_t)start+mask) & ~mask;
+}
+
+bool pages_resident(const void *addr,size_t len){
+    if(!addr || len==0){
+        return true;
+    }
+    char *start;
+    size_t span;
+    page_range(addr,len,start,span);
+    // 每次检查一段，避免为大文件分配很大的数组
+    unsigned char vec[1024];
+    size_t chunk=sizeof(vec)*page_size();
+    for(size_t off=0;off<span;off+=chunk){
+        size_t n=span-off<chunk?span-off:chunk;
+        if(mincore(start+off,n,vec)!=0){
+            return false; // 查不到就当作不在内存中，交给I/O线程
+        }
+        for(size_t i=0;i<(n+page_size()-1)/page_size();i++){
+            if(!(vec[i]&1)){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void prefetch_pages(const void *addr,size_t len){
+    if(!addr || len==0){
+        return;
+    }
+    char *start;
+    size_t span;
+    page_range(addr,len,start,span);
+    madvise(start,span,MADV_WILLNEED);
+    // 逐页读一个字节，缺页在这里（I/O线程）发生，而不是在发送的时候
+    const volatile char *p=(const volatile char *)addr;
+    for(size_t off=0;off<len;off+=page_size()){
+        (void)p[off];
+    }
+    (void)p[len-1];
+}
+
+void advise_sequential(const void *addr,size_t len){
+    char *start;
+    size_t span;
+    page_range(addr,len,start,span);
+    madvise(start,span,MADV_SEQUENTIAL);
+}
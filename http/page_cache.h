@@ -0,0 +1,18 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stddef.h>
+
+// 大于这个大小的文件按顺序访问处理（MADV_SEQUENTIAL），内核会加大预读窗口并及时回收
+#define SEQUENTIAL_FILE_SIZE (256*1024)
+
+// 用mincore检查映射区的页是否都在page cache中，有一页不在就返回false
+bool pages_resident(const void *addr,size_t len);
+
+// 在I/O线程中调用：先MADV_WILLNEED发起异步预读，再逐页访问，等所有页都读进内存后返回
+void prefetch_pages(const void *addr,size_t len);
+
+// 对大文件设置MADV_SEQUENTIAL
+void advise_sequential(const void *addr,size_t len);
+
+#endif
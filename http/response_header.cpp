@@ -0,0 +1,149 @@
+#include "./response_header.h"
+
+#include <time.h>
+
+// 00~99的两位数字表
+static const char digits2[201]=
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int u64_to_ascii(uint64_t v,char *out){
+    char tmp[20];
+    char *p=tmp+20;
+    while(v>=100){
+        unsigned i=(v%100)*2;
+        v/=100;
+        p-=2;
+        p[0]=digits2[i];
+        p[1]=digits2[i+1];
+    }
+    if(v>=10){
+        p-=2;
+        p[0]=digits2[v*2];
+        p[1]=digits2[v*2+1];
+    }else{
+        *--p='0'+v;
+    }
+    int len=tmp+20-p;
+    memcpy(out,p,len);
+    return len;
+}
+
+bool header_builder::append_uint(uint64_t v){
+    char tmp[20];
+    return append(tmp,u64_to_ascii(v,tmp));
+}
+
+bool header_builder::header(const char *name,size_t name_len,const char *value,size_t value_len){
+    // 一次检查容量，再连续拷贝
+    size_t n=name_len+2+value_len+2;
+    if(m_overflow || n>m_capacity-m_len){
+        m_overflow=true;
+        return false;
+    }
+    char *p=m_buf+m_len;
+    memcpy(p,name,name_len);
+    p+=name_len;
+    *p++=':';
+    *p++=' ';
+    memcpy(p,value,value_len);
+    p+=value_len;
+    *p++='\r';
+    *p++='\n';
+    m_len+=n;
+    return true;
+}
+
+bool header_builder::header_uint(const char *name,size_t name_len,uint64_t value){
+    char tmp[20];
+    return header(name,name_len,tmp,u64_to_ascii(value,tmp));
+}
+
+// 状态码表，状态行在程序启动时一次性生成
+static const struct{
+    int status;
+    const char *reason;
+} status_reasons[]={
+    {100,"Continue"},{101,"Switching Protocols"},
+    {200,"OK"},{201,"Created"},{202,"Accepted"},{204,"No Content"},{206,"Partial Content"},
+    {301,"Moved Permanently"},{302,"Found"},{303,"See Other"},{304,"Not Modified"},
+    {307,"Temporary Redirect"},{308,"Permanent Redirect"},
+    {400,"Bad Request"},{401,"Unauthorized"},{403,"Forbidden"},{404,"Not Found"},
+    {405,"Method Not Allowed"},{408,"Request Timeout"},{411,"Length Required"},
+    {413,"Content Too Large"},{414,"URI Too Long"},{416,"Range Not Satisfiable"},
+    {429,"Too Many Requests"},{431,"Request Header Fields Too Large"},
+    {500,"Internal Server Error"},{501,"Not Implemented"},{503,"Service Unavailable"},
+    {505,"HTTP Version Not Supported"},
+};
+
+#define STATUS_MIN 100
+#define STATUS_MAX 599
+#define STATUS_LINE_MAX 48
+
+struct status_line_table{
+    char line[STATUS_MAX-STATUS_MIN+1][STATUS_LINE_MAX];
+    unsigned char len[STATUS_MAX-STATUS_MIN+1]; // 0表示未定义的状态码
+    const char *reason[STATUS_MAX-STATUS_MIN+1];
+
+    status_line_table(){
+        memset(len,0,sizeof(len));
+        memset(reason,0,sizeof(reason));
+        for(size_t i=0;i<sizeof(status_reasons)/sizeof(status_reasons[0]);i++){
+            int idx=status_reasons[i].status-STATUS_MIN;
+            char *p=line[idx];
+            memcpy(p,"HTTP/1.1 ",9);
+            u64_to_ascii(status_reasons[i].status,p+9);
+            p[12]=' ';
+            size_t n=strlen(status_reasons[i].reason);
+            memcpy(p+13,status_reasons[i].reason,n);
+            p[13+n]='\r';
+            p[14+n]='\n';
+            len[idx]=15+n;
+            reason[idx]=status_reasons[i].reason;
+        }
+    }
+};
+static const status_line_table status_lines;
+
+const char *header_builder::reason(int status){
+    if(status<STATUS_MIN || status>STATUS_MAX || !status_lines.reason[status-STATUS_MIN]){
+        return "Unknown";
+    }
+    return status_lines.reason[status-STATUS_MIN];
+}
+
+bool header_builder::status_line(int status){
+    if(status<STATUS_MIN || status>STATUS_MAX || !status_lines.len[status-STATUS_MIN]){
+        status=500; // 未定义的状态码按内部错误处理
+    }
+    int idx=status-STATUS_MIN;
+    return append(status_lines.line[idx],status_lines.len[idx]);
+}
+
+// 每个线程一份Date头部缓存，秒数变化时才重新格式化
+struct date_cache{
+    time_t sec;
+    char line[64];
+    size_t len;
+};
+static thread_local date_cache t_date={-1,{0},0};
+
+bool header_builder::date(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE,&ts); // vDSO，不陷入内核
+    if(ts.tv_sec!=t_date.sec){
+        struct tm tm;
+        gmtime_r(&ts.tv_sec,&tm);
+        t_date.len=strftime(t_date.line,sizeof(t_date.line),"Date: %a, %d %b %Y %H:%M:%S GMT\r\n",&tm);
+        t_date.sec=ts.tv_sec;
+    }
+    return append(t_date.line,t_date.len);
+}
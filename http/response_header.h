@@ -0,0 +1,58 @@
+#ifndef RESPONSE_HEADER_H
+#define RESPONSE_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    响应头部拼接器，替代vsnprintf：
+    - 只追加，不解析格式串
+    - 状态行全部预先生成好，直接memcpy
+    - 整数两位两位地转成字符
+    - Date头部每个线程缓存一份，每秒最多格式化一次
+    缓冲区放不下时不会截断，而是标记失败，之后的追加全部失败
+*/
+class header_builder{
+    public:
+        header_builder(char *buf,size_t capacity):m_buf(buf),m_capacity(capacity),m_len(0),m_overflow(false){}
+
+        void reset(){ m_len=0; m_overflow=false; }
+        // 换一块缓冲区重新开始拼接
+        void attach(char *buf,size_t capacity){ m_buf=buf; m_capacity=capacity; reset(); }
+        size_t size() const { return m_len; }
+        bool failed() const { return m_overflow; }
+
+        bool append(const char *s,size_t n){
+            if(m_overflow || n>m_capacity-m_len){
+                m_overflow=true;
+                return false;
+            }
+            memcpy(m_buf+m_len,s,n);
+            m_len+=n;
+            return true;
+        }
+        // 字符串字面量，长度在编译期确定
+        template <size_t N>
+        bool append(const char (&s)[N]){ return append(s,N-1); }
+        bool append_uint(uint64_t v);
+
+        bool status_line(int status); // "HTTP/1.1 200 OK\r\n"
+        bool header(const char *name,size_t name_len,const char *value,size_t value_len); // "name: value\r\n"
+        bool header_uint(const char *name,size_t name_len,uint64_t value);
+        bool date(); // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+        bool end(){ return append("\r\n"); } // 空行
+
+        static const char *reason(int status); // 状态码对应的原因短语
+
+    private:
+        char *m_buf;
+        size_t m_capacity;
+        size_t m_len;
+        bool m_overflow;
+};
+
+// 把v转成十进制写入out（至少20字节），返回长度，不写'\0'
+int u64_to_ascii(uint64_t v,char *out);
+
+#endif
@@ -63,6 +63,11 @@ class sem{
             return sem_wait(&m_sem)==0;
         }
 
+        // 不阻塞，计数为零时直接返回false
+        bool try_wait(){
+            return sem_trywait(&m_sem)==0;
+        }
+
         // V 操作（释放操作），增加信号量的计数
         bool post(){
             return sem_post(&m_sem)==0;
@@ -0,0 +1,135 @@
+#include "./access_log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <iostream>
+
+#include "./log_ring.h"
+#include "../cpu/busy_poll.h" // monotonic_ns()
+
+#define RING_SIZE 4096 // 每个线程的环能放的记录数，2的幂
+
+bool access_log::m_enabled=false;
+uint64_t access_log::m_realtime_offset=0;
+std::atomic<bool> access_log::m_reopen(false);
+
+static ring_log rings(RING_SIZE*sizeof(access_record));
+
+static std::string log_path;
+static uint64_t log_rotate_bytes;
+static int log_fd=-1;
+static uint64_t log_size; // 当前文件的大小
+
+static uint64_t realtime_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+// 打开（追加）日志文件，新文件先写文件头
+static bool open_file(std::string &err){
+    int fd=::open(log_path.c_str(),O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+    if(fd==-1){
+        err=log_path+": "+strerror(errno);
+        return false;
+    }
+    off_t size=lseek(fd,0,SEEK_END);
+    if(size==0){
+        access_log_header h;
+        memset(&h,0,sizeof(h));
+        memcpy(h.m_magic,ACCESS_LOG_MAGIC,8);
+        h.m_version=ACCESS_LOG_VERSION;
+        h.m_record_size=sizeof(access_record);
+        h.m_created_ns=realtime_ns();
+        if(write(fd,&h,sizeof(h))!=(ssize_t)sizeof(h)){
+            err=log_path+": "+strerror(errno);
+            close(fd);
+            return false;
+        }
+        size=sizeof(h);
+    }
+    if(log_fd!=-1){
+        close(log_fd);
+    }
+    log_fd=fd;
+    log_size=size;
+    return true;
+}
+
+// path.KEEP被覆盖，其余依次后移，当前文件变成path.1
+static void rotate(){
+    for(int i=access_log::KEEP-1;i>=1;i--){
+        std::string from=log_path+"."+std::to_string(i);
+        std::string to=log_path+"."+std::to_string(i+1);
+        rename(from.c_str(),to.c_str());
+    }
+    rename(log_path.c_str(),(log_path+".1").c_str());
+    std::string err;
+    if(!open_file(err)){
+        std::cerr << "access log rotate: " << err << std::endl;
+    }
+}
+
+// 写线程写出一批记录，超过大小时先轮转；SIGHUP后重新打开
+class access_sink:public log_sink{
+    public:
+        void write(const char *buf,size_t len) override{
+            if(log_rotate_bytes>0 && log_size>sizeof(access_log_header) && log_size+len>log_rotate_bytes){
+                rotate();
+            }
+            while(len>0){
+                ssize_t n=::write(log_fd,buf,len);
+                if(n==-1){
+                    if(errno==EINTR){
+                        continue;
+                    }
+                    perror("access log write");
+                    return; // 磁盘满等情况下丢掉这一批，不能让环一直满着
+                }
+                buf+=n;
+                len-=n;
+                log_size+=n;
+            }
+        }
+        bool need_reopen() override{ return access_log::take_reopen(); }
+        void reopen() override{
+            std::string err;
+            if(!open_file(err)){
+                std::cerr << "access log reopen: " << err << std::endl;
+            }
+        }
+};
+
+static access_sink sink;
+
+bool access_log::open(const std::string &path,uint64_t rotate_bytes,std::string &err){
+    log_path=path;
+    log_rotate_bytes=rotate_bytes;
+    if(!open_file(err)){
+        return false;
+    }
+    if(!rings.start(&sink,err)){
+        return false;
+    }
+    m_realtime_offset=realtime_ns()-monotonic_ns();
+    m_enabled=true;
+    return true;
+}
+
+void access_log::append(const access_record &r){
+    access_record rec=r;
+    rec.m_thread=rings.thread_id();
+    rings.push(&rec,sizeof(rec),NULL,0,sizeof(rec));
+}
+
+void access_log::report(){
+    uint64_t dropped;
+    size_t threads;
+    rings.stats(dropped,threads);
+    std::cerr << "access log: " << rings.written()/sizeof(access_record) << " records written, "
+              << dropped << " dropped, " << threads << " threads" << std::endl;
+}
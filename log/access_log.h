@@ -0,0 +1,97 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+/*
+    二进制访问日志。每个请求一条定长记录，经ring_log（log_ring.h）由后台线程攒成大块，
+    一次write()写入文件，文件超过大小后轮转。
+    用tools/logview把日志渲染成文本
+*/
+
+#define ACCESS_LOG_MAGIC "WSACLOG1"
+#define ACCESS_LOG_VERSION 1
+#define ACCESS_LOG_PATH_MAX 54 // 记录中保留的路径前缀长度，更长的路径靠m_path_hash区分
+
+// 记录的标志位
+enum ACCESS_FLAG{
+    ACCESS_KEEP_ALIVE=1, // 响应后保持连接
+    ACCESS_HTTP11=2,
+    ACCESS_GZIP=4, // 发送的是预压缩版本
+    ACCESS_INLINE=8, // 在事件循环中直接处理，没有经过线程池
+    ACCESS_BATCHED=16, // 和流水线上后面的响应一起发送，发送时间算在最后一个响应上
+    ACCESS_ABORTED=32 // 连接在响应发完之前关闭
+};
+
+// 文件开头，之后全部是access_record
+struct access_log_header{
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_record_size;
+    uint64_t m_created_ns; // 创建文件的时间（CLOCK_REALTIME）
+    char m_pad[40];
+};
+
+// 一个请求，128字节，两个缓存行
+struct access_record{
+    uint64_t m_time_ns; // 开始处理请求的时间（CLOCK_REALTIME，纳秒）
+    uint64_t m_path_hash; // url的FNV-1a哈希
+    uint64_t m_bytes; // 响应的字节数
+    uint64_t m_parse_ns; // 开始解析到解析完
+    uint64_t m_queue_ns; // 在线程池队列中等待的时间，没有经过线程池为0
+    uint64_t m_process_ns; // 查找资源、生成响应头部
+    uint64_t m_send_ns; // 响应放进输出队列到全部写入socket
+    uint32_t m_peer_ip; // 网络字节序
+    uint16_t m_peer_port; // 网络字节序
+    uint16_t m_status;
+    int32_t m_fd;
+    uint16_t m_thread; // 写入记录的线程（环的编号）
+    uint8_t m_method; // 0 GET，1 POST
+    uint8_t m_flags; // ACCESS_FLAG
+    uint16_t m_path_len; // 完整路径的长度
+    char m_path[ACCESS_LOG_PATH_MAX]; // 路径前缀，不以'\0'结尾
+};
+
+static_assert(sizeof(access_log_header)==64,"access_log_header must be 64 bytes");
+static_assert(sizeof(access_record)==128,"access_record must be 128 bytes");
+
+// FNV-1a，路径很短，比通用哈希快
+static inline uint64_t path_hash(const char *p,size_t n){
+    uint64_t h=14695981039346656037ull;
+    for(size_t i=0;i<n;i++){
+        h^=(unsigned char)p[i];
+        h*=1099511628211ull;
+    }
+    return h;
+}
+
+class access_log{
+    public:
+        /*
+            打开日志文件并启动写线程，必须在处理请求的线程开始之前调用。
+            文件超过rotate_bytes时轮转：path -> path.1 -> ... -> path.ACCESS_LOG_KEEP，0表示不轮转
+        */
+        static bool open(const std::string &path,uint64_t rotate_bytes,std::string &err);
+        static bool enabled(){ return m_enabled; }
+        // 单调时钟的时间换算成CLOCK_REALTIME，请求处理中只取单调时钟
+        static uint64_t realtime(uint64_t monotonic_ns){ return monotonic_ns+m_realtime_offset; }
+        // 写入当前线程的环，环满时丢弃
+        static void append(const access_record &r);
+        // 下一次写入前重新打开文件（SIGHUP，配合外部的logrotate）
+        static void reopen(){ m_reopen.store(true,std::memory_order_relaxed); }
+        // 写线程取走重新打开的请求
+        static bool take_reopen(){ return m_reopen.exchange(false,std::memory_order_relaxed); }
+        // 打印写入和丢弃的记录数
+        static void report();
+
+        static const int KEEP=4; // 轮转时保留的旧文件数
+
+    private:
+        static bool m_enabled;
+        static uint64_t m_realtime_offset;
+        static std::atomic<bool> m_reopen;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "./capture_log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <iostream>
+
+#include "./log_ring.h"
+#include "../cpu/busy_poll.h" // monotonic_ns()
+
+#define RING_BYTES (1024*1024) // 每个线程的环的字节数，2的幂
+
+bool capture_log::m_enabled=false;
+uint64_t capture_log::m_start_ns=0;
+std::atomic<uint32_t> capture_log::m_next_conn(1);
+
+static ring_log rings(RING_BYTES);
+static int capture_fd=-1;
+
+class capture_sink:public log_sink{
+    public:
+        void write(const char *buf,size_t len) override{
+            while(len>0){
+                ssize_t n=::write(capture_fd,buf,len);
+                if(n==-1){
+                    if(errno==EINTR){
+                        continue;
+                    }
+                    perror("capture write");
+                    return; // 磁盘满等情况下丢掉这一批，不能让环一直满着
+                }
+                buf+=n;
+                len-=n;
+            }
+        }
+};
+
+static capture_sink sink;
+
+bool capture_log::open(const std::string &path,std::string &err){
+    capture_fd=::open(path.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+    if(capture_fd==-1){
+        err=path+": "+strerror(errno);
+        return false;
+    }
+    capture_header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.m_magic,CAPTURE_MAGIC,8);
+    h.m_version=CAPTURE_VERSION;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    h.m_created_ns=(uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+    if(write(capture_fd,&h,sizeof(h))!=(ssize_t)sizeof(h)){
+        err=path+": "+strerror(errno);
+        return false;
+    }
+    m_start_ns=monotonic_ns();
+    if(!rings.start(&sink,err)){
+        return false;
+    }
+    m_enabled=true;
+    return true;
+}
+
+bool capture_log::append(uint32_t conn,uint8_t type,const char *buf,size_t len){
+    capture_record r;
+    r.m_time_ns=monotonic_ns()-m_start_ns;
+    r.m_conn=conn;
+    r.m_len=len;
+    r.m_type=type;
+    r.m_pad=0;
+    return rings.push(&r,sizeof(r),buf,len,capture_size(len)); // 补齐的字节不用清零，读的时候跳过
+}
+
+uint32_t capture_log::open_conn(){
+    uint32_t conn=m_next_conn.fetch_add(1,std::memory_order_relaxed);
+    return append(conn,CAPTURE_OPEN,NULL,0)?conn:0;
+}
+
+bool capture_log::data(uint32_t conn,const char *buf,size_t len){
+    return append(conn,CAPTURE_DATA,buf,len);
+}
+
+void capture_log::close_conn(uint32_t conn){
+    append(conn,CAPTURE_CLOSE,NULL,0);
+}
+
+void capture_log::report(){
+    uint64_t dropped;
+    size_t threads;
+    rings.stats(dropped,threads);
+    std::cerr << "capture: " << rings.written() << " bytes written, "
+              << dropped << " connections truncated, " << threads << " threads" << std::endl;
+}
@@ -0,0 +1,69 @@
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+/*
+    流量捕获：记录每个连接收到的原始字节和到达时间，tools/replay按原来的连接结构和时间间隔重放。
+    和访问日志一样经ring_log（log_ring.h）由后台线程批量写文件；记录是变长的（头部+数据，补齐到8字节）。环满时这个连接之后的数据都不再记录，
+    重放时连接在最后一个完整的请求处结束，不会出现中间缺一段的字节流
+*/
+
+#define CAPTURE_MAGIC "WSCAPT01"
+#define CAPTURE_VERSION 1
+
+// 文件开头，之后全部是capture_record
+struct capture_header{
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_pad0;
+    uint64_t m_created_ns; // 开始捕获的时间（CLOCK_REALTIME）
+    char m_pad[40];
+};
+
+enum CAPTURE_EVENT{
+    CAPTURE_OPEN=1, // 接受连接
+    CAPTURE_DATA, // 一次recv()读到的数据
+    CAPTURE_CLOSE // 服务器关闭连接
+};
+
+// 记录头部，16字节，后面跟着m_len字节的数据，补齐到8字节
+struct capture_record{
+    uint64_t m_time_ns; // 从开始捕获算起的时间
+    uint32_t m_conn; // 连接编号，从1开始，文件内唯一
+    uint16_t m_len; // 数据长度，一次recv()不超过读缓冲区的大小
+    uint8_t m_type; // CAPTURE_EVENT
+    uint8_t m_pad;
+};
+
+static_assert(sizeof(capture_header)==64,"capture_header must be 64 bytes");
+static_assert(sizeof(capture_record)==16,"capture_record must be 16 bytes");
+
+// 记录占的字节数
+static inline size_t capture_size(size_t len){
+    return sizeof(capture_record)+((len+7)&~(size_t)7);
+}
+
+class capture_log{
+    public:
+        // 打开文件并启动写线程，必须在处理请求的线程开始之前调用
+        static bool open(const std::string &path,std::string &err);
+        static bool enabled(){ return m_enabled; }
+        // 新连接，返回连接编号
+        static uint32_t open_conn();
+        // 连接上读到的数据，环满时返回false，调用者不再记录这个连接
+        static bool data(uint32_t conn,const char *buf,size_t len);
+        static void close_conn(uint32_t conn);
+        // 打印写入的字节数和放弃的连接数
+        static void report();
+
+    private:
+        static bool append(uint32_t conn,uint8_t type,const char *buf,size_t len);
+        static bool m_enabled;
+        static uint64_t m_start_ns; // 开始捕获的时间（单调时钟）
+        static std::atomic<uint32_t> m_next_conn;
+};
+
+#endif
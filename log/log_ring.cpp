@@ -0,0 +1,143 @@
+#include "./log_ring.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "./thread_registry.h"
+#include "../cpu/busy_poll.h" // monotonic_ns()
+
+#define WRITE_BATCH (1024*1024) // 攒够这么多字节就写一次
+#define FLUSH_INTERVAL_NS 1000000000ull // 不够一批时最多等这么久也写出去
+#define IDLE_SLEEP_US 10000 // 所有环都空时写线程的睡眠时间
+
+static std::atomic<int> ring_logs(0);
+static thread_local log_ring *local_rings[RING_LOG_MAX];
+
+log_ring::log_ring(size_t bytes):m_head(0),m_cached_tail(0),m_dropped(0),m_id(0),m_data(new char[bytes]),m_tail(0){
+}
+
+ring_log::ring_log(size_t ring_bytes):m_ring_bytes(ring_bytes),m_index(ring_logs++),m_sink(NULL),m_written(0){
+    if(m_index>=RING_LOG_MAX){
+        abort();
+    }
+}
+
+log_ring *ring_log::local(){
+    log_ring *ring=local_rings[m_index];
+    if(!ring){ // 线程第一次写记录时创建自己的环
+        ring=new log_ring(m_ring_bytes);
+        m_lock.lock();
+        ring->m_id=m_rings.size();
+        m_rings.push_back(ring);
+        m_lock.unlock();
+        local_rings[m_index]=ring;
+    }
+    return ring;
+}
+
+void ring_log::put(log_ring *r,uint64_t pos,const void *src,size_t len){
+    size_t off=pos&(m_ring_bytes-1);
+    size_t first=len<m_ring_bytes-off?len:m_ring_bytes-off;
+    memcpy(r->m_data+off,src,first);
+    memcpy(r->m_data,(const char *)src+first,len-first);
+}
+
+void ring_log::get(const log_ring *r,uint64_t pos,char *dst,size_t len){
+    size_t off=pos&(m_ring_bytes-1);
+    size_t first=len<m_ring_bytes-off?len:m_ring_bytes-off;
+    memcpy(dst,r->m_data+off,first);
+    memcpy(dst+first,r->m_data,len-first);
+}
+
+bool ring_log::push(const void *head,size_t head_len,const void *data,size_t data_len,size_t size){
+    log_ring *ring=local();
+    uint64_t pos=ring->m_head.load(std::memory_order_relaxed);
+    if(pos+size-ring->m_cached_tail>m_ring_bytes){
+        ring->m_cached_tail=ring->m_tail.load(std::memory_order_acquire);
+        if(pos+size-ring->m_cached_tail>m_ring_bytes){
+            ring->m_dropped.store(ring->m_dropped.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+            return false;
+        }
+    }
+    put(ring,pos,head,head_len);
+    if(data_len>0){
+        put(ring,pos+head_len,data,data_len);
+    }
+    ring->m_head.store(pos+size,std::memory_order_release);
+    return true;
+}
+
+// 写线程：把各个环中的记录拷到批量缓冲区，攒够一批或者到时间就写出去
+void *ring_log::writer(void *arg){
+    ring_log *log=(ring_log *)arg;
+    thread_registry::add(THREAD_LOGGER);
+    std::vector<char> batch(WRITE_BATCH+log->m_ring_bytes); // 写出去之后一个环的内容一定放得下
+    size_t used=0;
+    uint64_t last_flush=monotonic_ns();
+    std::vector<log_ring *> snapshot;
+    while(1){
+        if(log->m_sink->need_reopen()){
+            if(used>0){
+                log->m_sink->write(batch.data(),used);
+                used=0;
+            }
+            log->m_sink->reopen();
+        }
+        log->m_lock.lock();
+        snapshot=log->m_rings;
+        log->m_lock.unlock();
+        uint64_t got=0;
+        for(size_t i=0;i<snapshot.size();i++){
+            log_ring *r=snapshot[i];
+            uint64_t tail=r->m_tail.load(std::memory_order_relaxed);
+            uint64_t head=r->m_head.load(std::memory_order_acquire);
+            uint64_t n=head-tail;
+            if(n==0){
+                continue;
+            }
+            if(used+n>batch.size()){ // 记录不能拆开，先把攒的写出去
+                log->m_sink->write(batch.data(),used);
+                used=0;
+                last_flush=monotonic_ns();
+            }
+            log->get(r,tail,batch.data()+used,n);
+            used+=n;
+            r->m_tail.store(head,std::memory_order_release); // 拷完才还给生产者
+            got+=n;
+        }
+        log->m_written.fetch_add(got,std::memory_order_relaxed);
+        uint64_t now=monotonic_ns();
+        if(used>=WRITE_BATCH || (used>0 && now-last_flush>=FLUSH_INTERVAL_NS)){
+            log->m_sink->write(batch.data(),used);
+            used=0;
+            last_flush=now;
+        }
+        if(got==0){
+            usleep(IDLE_SLEEP_US);
+        }
+    }
+    return NULL;
+}
+
+bool ring_log::start(log_sink *sink,std::string &err){
+    m_sink=sink;
+    pthread_t tid;
+    if(pthread_create(&tid,NULL,writer,this)!=0){
+        err="create log writer failed";
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+void ring_log::stats(uint64_t &dropped,size_t &threads){
+    dropped=0;
+    m_lock.lock();
+    threads=m_rings.size();
+    for(size_t i=0;i<threads;i++){
+        dropped+=m_rings[i]->m_dropped.load(std::memory_order_relaxed);
+    }
+    m_lock.unlock();
+}
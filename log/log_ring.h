@@ -0,0 +1,78 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+#include <vector>
+
+#include "../lock/locker.h"
+
+/*
+    访问日志和流量捕获共用的记录通道：处理请求的线程把记录写进自己的环（单生产者单消费者，无锁），
+    后台线程把所有环中的记录攒成大块，交给log_sink一次写出去。
+    记录只有拷贝，不格式化，不加锁；环满时丢弃并计数，不会阻塞处理请求的线程
+*/
+
+#define RING_LOG_MAX 4 // 进程中最多的ring_log个数，每个线程为每个ring_log保存一个环
+
+/*
+    单生产者单消费者的字节环，下标一直增长，取模得到位置。生产者写完整条记录才移动m_head，
+    所以m_tail到m_head之间总是完整的记录。两个下标放在不同的缓存行，
+    生产者缓存一份m_tail，只有看起来满了才去读写线程的缓存行
+*/
+struct alignas(64) log_ring{
+    std::atomic<uint64_t> m_head;
+    uint64_t m_cached_tail; // 生产者看到的m_tail
+    std::atomic<uint64_t> m_dropped; // 丢弃的记录数，只有生产者修改
+    uint16_t m_id; // 环的编号，按线程第一次写记录的顺序
+    char *m_data;
+    alignas(64) std::atomic<uint64_t> m_tail;
+
+    explicit log_ring(size_t bytes);
+};
+
+// 写线程把攒好的一批记录交给它
+class log_sink{
+    public:
+        virtual ~log_sink(){}
+        // 写出一批完整的记录，出错时丢掉这一批，不能让环一直满着
+        virtual void write(const char *buf,size_t len)=0;
+        // 每轮开始时调用，返回true时先把攒的记录写出去再调用reopen()（SIGHUP后重新打开文件）
+        virtual bool need_reopen(){ return false; }
+        virtual void reopen(){}
+};
+
+class ring_log{
+    public:
+        // 每个线程的环ring_bytes字节，2的幂，一条记录不能超过它
+        explicit ring_log(size_t ring_bytes);
+        // 启动写线程，必须在写记录的线程开始之前调用
+        bool start(log_sink *sink,std::string &err);
+        /*
+            把head和data连续写进当前线程的环，一共占size字节（多出的是补齐，不清零），
+            环满时丢弃并返回false
+        */
+        bool push(const void *head,size_t head_len,const void *data,size_t data_len,size_t size);
+        // 当前线程的环的编号，线程第一次调用时创建环
+        uint16_t thread_id(){ return local()->m_id; }
+
+        uint64_t written() const { return m_written.load(std::memory_order_relaxed); } // 写线程取走的字节数
+        void stats(uint64_t &dropped,size_t &threads); // 所有环丢弃的记录数和环的个数
+
+    private:
+        log_ring *local();
+        void put(log_ring *r,uint64_t pos,const void *src,size_t len); // 从pos开始拷贝，到结尾时绕回开头
+        void get(const log_ring *r,uint64_t pos,char *dst,size_t len);
+        static void *writer(void *arg);
+
+        size_t m_ring_bytes;
+        int m_index; // 在线程的环表中的下标
+        log_sink *m_sink;
+        locker m_lock;
+        std::vector<log_ring *> m_rings; // 所有线程的环，线程退出后也保留，里面的记录照样写出去
+        std::atomic<uint64_t> m_written;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+    USDT静态探针（provider为webserver），运行中的server.out不用重新编译就能用bpftrace、perf或SystemTap挂上：
+        bpftrace -l 'usdt:./server.out:webserver:*'
+        bpftrace tools/usdt/request_latency.bt -p PID
+    没有挂探针时探针处只是一条nop，参数已经在寄存器或栈上，不需要额外的计算；挂上后nop被换成断点。
+    有<sys/sdt.h>（systemtap-sdt-dev）时用它；没有时在GCC/Clang的x86-64和aarch64上直接生成同样格式的
+    .note.stapsdt段（readelf -n server.out可以看到）；其他平台或者定义了NO_PROBES时探针为空。
+    所有参数都按64位有符号整数传递，指针参数在bpftrace中用str(argN)或str(argN,len)读取。
+
+    探针                 参数
+    conn_accept          fd, 对端IPv4地址（网络字节序）, 对端端口
+    conn_close           fd, 连接上处理的请求数
+    request_parsed       fd, 方法（0 GET，1 POST）, url, url长度
+    response_start       fd, 状态码, 响应字节数（流式响应为头部）, 是否在主线程中处理
+    response_done        fd, 发送的字节数, 从放进输出队列到发完的纳秒数, ACCESS_FLAG
+    pool_enqueue         线程池, 任务, 放入后的队列长度
+    pool_dequeue         线程池, 任务, 取出后的队列长度
+    cache_hit            url, url长度（文件缓存命中）
+    cache_revalidate     url, url长度（缓存过期但文件没变）
+    cache_miss           url, url长度（要打开并映射文件）
+    bundle_hit           url, url长度
+    bundle_miss          url, url长度
+*/
+
+#if defined(NO_PROBES)
+#define WS_PROBES_NONE
+#elif defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define WS_PROBES_SDT
+#endif
+#endif
+
+#if !defined(WS_PROBES_NONE) && !defined(WS_PROBES_SDT) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+#define WS_PROBES_NOTE
+#endif
+
+#if defined(WS_PROBES_SDT)
+
+#include <sys/sdt.h>
+#define WS_PROBE1(name,a) STAP_PROBE1(webserver,name,(long long)(a))
+#define WS_PROBE2(name,a,b) STAP_PROBE2(webserver,name,(long long)(a),(long long)(b))
+#define WS_PROBE3(name,a,b,c) STAP_PROBE3(webserver,name,(long long)(a),(long long)(b),(long long)(c))
+#define WS_PROBE4(name,a,b,c,d) STAP_PROBE4(webserver,name,(long long)(a),(long long)(b),(long long)(c),(long long)(d))
+
+#elif defined(WS_PROBES_NOTE)
+
+/*
+    和sys/sdt.h生成的一样：探针处一条nop，.note.stapsdt段中记下nop的地址、provider、探针名和参数的位置
+    （"-8@%rdi"这样的描述，由编译器填写操作数）。"?"让注释和所在函数放在同一个段组里，
+    模板函数的重复实例被链接器丢掉时注释跟着丢掉。_.stapsdt.base用来在地址被预链接移动后校正
+*/
+#define WS_SDT_ASM(name,args) \
+    "990: nop\n" \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+    ".balign 4\n" \
+    ".4byte 992f-991f,994f-993f,3\n" \
+    "991: .asciz \"stapsdt\"\n" \
+    "992: .balign 4\n" \
+    "993: .8byte 990b\n" \
+    ".8byte _.stapsdt.base\n" \
+    ".8byte 0\n" \
+    ".asciz \"webserver\"\n" \
+    ".asciz \"" #name "\"\n" \
+    ".asciz \"" args "\"\n" \
+    "994: .balign 4\n" \
+    ".popsection\n" \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base,1\n" \
+    ".popsection\n" \
+    ".endif\n"
+#define WS_SDT_ARG(a) "nor"((long long)(a))
+#define WS_PROBE1(name,a) \
+    __asm__ __volatile__(WS_SDT_ASM(name,"-8@%0") :: WS_SDT_ARG(a))
+#define WS_PROBE2(name,a,b) \
+    __asm__ __volatile__(WS_SDT_ASM(name,"-8@%0 -8@%1") :: WS_SDT_ARG(a),WS_SDT_ARG(b))
+#define WS_PROBE3(name,a,b,c) \
+    __asm__ __volatile__(WS_SDT_ASM(name,"-8@%0 -8@%1 -8@%2") :: WS_SDT_ARG(a),WS_SDT_ARG(b),WS_SDT_ARG(c))
+#define WS_PROBE4(name,a,b,c,d) \
+    __asm__ __volatile__(WS_SDT_ASM(name,"-8@%0 -8@%1 -8@%2 -8@%3") \
+                         :: WS_SDT_ARG(a),WS_SDT_ARG(b),WS_SDT_ARG(c),WS_SDT_ARG(d))
+
+#else
+
+#define WS_PROBE1(name,a) do{}while(0)
+#define WS_PROBE2(name,a,b) do{}while(0)
+#define WS_PROBE3(name,a,b,c) do{}while(0)
+#define WS_PROBE4(name,a,b,c,d) do{}while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,252 @@
+#include "./profiler.h"
+#include "./thread_registry.h"
+#include "./stack_trace.h"
+
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <iostream>
+#include <pthread.h>
+
+#include "../lock/locker.h"
+
+#ifndef sigev_notify_thread_id // 旧的glibc没有这个名字
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define MAX_DEPTH 62 // 每个样本最多的栈帧数，样本正好512字节
+#define MAX_THREADS 256
+#define MAX_SAMPLES (1<<16)
+
+struct prof_sample{
+    uint32_t m_thread; // 在prof_threads中的下标
+    uint32_t m_depth; // 0表示没有写完
+    uintptr_t m_pc[MAX_DEPTH]; // m_pc[0]是被打断的指令，之后是各层的返回地址
+};
+
+struct prof_thread{
+    int m_role;
+    uintptr_t m_stack_lo;
+    uintptr_t m_stack_hi;
+};
+
+// 信号处理函数用到的状态，剖析开始前准备好，prof_active为true期间不变
+static std::atomic<bool> prof_active(false);
+static prof_thread prof_threads[MAX_THREADS];
+static int prof_thread_count=0;
+static prof_sample *prof_samples=NULL;
+static uint32_t prof_capacity=0;
+static std::atomic<uint32_t> prof_next(0);
+static std::atomic<uint32_t> prof_dropped(0);
+static std::atomic<bool> prof_running(false); // 同时只能有一个剖析
+
+static void on_sigprof(int,siginfo_t *si,void *uc){
+    if(!prof_active.load(std::memory_order_acquire) || si->si_code!=SI_TIMER){
+        return;
+    }
+    int idx=si->si_value.sival_int;
+    if(idx<0 || idx>=prof_thread_count){
+        return;
+    }
+    uint32_t n=prof_next.fetch_add(1,std::memory_order_relaxed);
+    if(n>=prof_capacity){
+        prof_dropped.fetch_add(1,std::memory_order_relaxed);
+        return;
+    }
+    prof_sample &s=prof_samples[n];
+    s.m_thread=idx;
+    const prof_thread &t=prof_threads[idx];
+    uint32_t depth=stack_trace::unwind(uc,t.m_stack_lo,t.m_stack_hi,s.m_pc,MAX_DEPTH);
+    std::atomic_signal_fence(std::memory_order_release);
+    s.m_depth=depth;
+}
+
+static bool install_handler(std::string &err){
+    static bool installed=false;
+    if(installed){
+        return true;
+    }
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_sigaction=on_sigprof;
+    sa.sa_flags=SA_SIGINFO|SA_RESTART; // 被打断的系统调用尽量重启，epoll_wait、sem_wait仍会返回EINTR
+    sigfillset(&sa.sa_mask);
+    if(sigaction(SIGPROF,&sa,NULL)==-1){
+        err=std::string("sigaction: ")+strerror(errno);
+        return false;
+    }
+    installed=true; // 一直保留，剖析结束后才到达的信号直接返回
+    return true;
+}
+
+static void sleep_ns(uint64_t ns){
+    struct timespec ts;
+    ts.tv_sec=ns/1000000000ull;
+    ts.tv_nsec=ns%1000000000ull;
+    while(nanosleep(&ts,&ts)==-1 && errno==EINTR){
+    }
+}
+
+// 按栈合并样本，每行"角色;最外层;...;最内层 次数"
+static void fold(uint32_t count,std::string &out){
+    std::unordered_map<uintptr_t,std::string> symbols;
+    std::map<std::string,uint64_t> stacks;
+    std::string key;
+    for(uint32_t i=0;i<count;i++){
+        const prof_sample &s=prof_samples[i];
+        if(s.m_depth==0){
+            continue;
+        }
+        key=thread_registry::role_name(prof_threads[s.m_thread].m_role);
+        for(int d=s.m_depth-1;d>=0;d--){
+            // 返回地址是调用指令的下一条，减一落在调用指令上，避免调用noreturn函数时算到下一个函数里
+            uintptr_t pc=d==0?s.m_pc[0]:s.m_pc[d]-1;
+            auto it=symbols.find(pc);
+            if(it==symbols.end()){
+                it=symbols.emplace(pc,stack_trace::symbolize(pc)).first;
+            }
+            key+=';';
+            key+=it->second;
+        }
+        stacks[key]++;
+    }
+    for(auto it=stacks.begin();it!=stacks.end();++it){
+        out+=it->first;
+        out+=' ';
+        out+=std::to_string(it->second);
+        out+='\n';
+    }
+}
+
+bool profiler::run(double seconds,int hz,std::string &out,std::string &err){
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    err="profiling is not supported on this platform";
+    return false;
+#endif
+    if(!(seconds>0 && seconds<=PROFILE_MAX_SECONDS) || hz<=0 || hz>PROFILE_MAX_HZ){
+        err="seconds must be in (0,60], hz in [1,1000]";
+        return false;
+    }
+    bool expected=false;
+    if(!prof_running.compare_exchange_strong(expected,true)){
+        err="another profile is running";
+        return false;
+    }
+    if(!install_handler(err)){
+        prof_running.store(false);
+        return false;
+    }
+
+    std::vector<thread_entry> entries=thread_registry::snapshot();
+    prof_thread_count=0;
+    for(size_t i=0;i<entries.size() && prof_thread_count<MAX_THREADS;i++){
+        prof_thread &t=prof_threads[prof_thread_count++];
+        t.m_role=entries[i].m_role;
+        t.m_stack_lo=entries[i].m_stack_lo;
+        t.m_stack_hi=entries[i].m_stack_hi;
+    }
+    // 样本总数不超过 CPU数*hz*秒数，留一些余量
+    long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t busy=cpus>0 && cpus<prof_thread_count?cpus:prof_thread_count;
+    uint64_t capacity=(uint64_t)(busy*hz*seconds*1.25)+64;
+    prof_capacity=capacity<MAX_SAMPLES?capacity:MAX_SAMPLES;
+    std::vector<prof_sample> samples(prof_capacity); // 值初始化，m_depth为0
+    prof_samples=samples.data();
+    prof_next.store(0,std::memory_order_relaxed);
+    prof_dropped.store(0,std::memory_order_relaxed);
+    prof_active.store(true,std::memory_order_release);
+
+    long interval=1000000000L/hz;
+    std::vector<timer_t> timers;
+    for(int i=0;i<prof_thread_count;i++){
+        clockid_t clock;
+        if(pthread_getcpuclockid(entries[i].m_thread,&clock)!=0){
+            continue;
+        }
+        struct sigevent sev;
+        memset(&sev,0,sizeof(sev));
+        sev.sigev_notify=SIGEV_THREAD_ID; // 信号发给这个线程，回溯的是它自己的栈
+        sev.sigev_signo=SIGPROF;
+        sev.sigev_notify_thread_id=entries[i].m_tid;
+        sev.sigev_value.sival_int=i;
+        timer_t timer;
+        if(timer_create(clock,&sev,&timer)==-1){
+            continue;
+        }
+        struct itimerspec its;
+        its.it_value.tv_sec=interval/1000000000L;
+        its.it_value.tv_nsec=interval%1000000000L;
+        its.it_interval=its.it_value;
+        timer_settime(timer,0,&its,NULL);
+        timers.push_back(timer);
+    }
+
+    sleep_ns((uint64_t)(seconds*1e9));
+
+    for(size_t i=0;i<timers.size();i++){
+        timer_delete(timers[i]);
+    }
+    prof_active.store(false,std::memory_order_release);
+    sleep_ns(10000000); // 等正在执行的信号处理函数返回
+    uint32_t count=prof_next.load(std::memory_order_relaxed);
+    if(count>prof_capacity){
+        count=prof_capacity;
+    }
+    fold(count,out);
+    std::cerr << "profile: " << seconds << "s at " << hz << "Hz, " << timers.size() << " threads, "
+              << count << " samples, " << prof_dropped.load(std::memory_order_relaxed) << " dropped" << std::endl;
+    prof_samples=NULL;
+    prof_running.store(false);
+    return true;
+}
+
+// 剖析线程一次只做一个剖析，submit()和剖析线程之间只交接这一个
+static sem job_ready;
+static std::atomic<bool> job_busy(false); // 从submit()到finish()返回
+static profile_job *job_current=NULL;
+static double job_seconds;
+static int job_hz;
+
+void *profiler::worker(void *){
+    while(1){
+        if(!job_ready.wait()){
+            continue; // 被信号打断
+        }
+        std::string out,err;
+        bool ok=run(job_seconds,job_hz,out,err);
+        profile_job *job=job_current;
+        job_current=NULL;
+        job_busy.store(false,std::memory_order_release); // finish()中可能马上又收到剖析请求
+        job->finish(ok,out,err);
+    }
+    return NULL;
+}
+
+bool profiler::start(std::string &err){
+    pthread_t tid;
+    if(pthread_create(&tid,NULL,worker,NULL)!=0){
+        err="create profiler thread failed";
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+bool profiler::submit(double seconds,int hz,profile_job *job,std::string &err){
+    bool expected=false;
+    if(!job_busy.compare_exchange_strong(expected,true,std::memory_order_acquire)){
+        err="another profile is running";
+        return false;
+    }
+    job_current=job;
+    job_seconds=seconds;
+    job_hz=hz;
+    job_ready.post();
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+
+/*
+    进程内的采样剖析，不需要在主机上挂外部的剖析器。
+    剖析期间给每个登记过的线程（thread_registry）建一个按该线程CPU时间计时的定时器，到时发SIGPROF给这个线程，
+    信号处理函数沿帧指针回溯调用栈，写进预先分配的样本数组（无锁、不分配内存）。
+    结束后在调用者的线程中用dladdr解析符号、按栈合并，输出折叠栈：
+        worker;start_thread;threadpool<http_conn>::work(void*);...;http_conn::process() 123
+    第一段是线程角色，可以直接交给flamegraph.pl或speedscope。
+    只统计CPU时间，阻塞在epoll_wait、信号量上的线程没有样本。
+    回溯依赖帧指针（CMakeLists.txt中加了-fno-omit-frame-pointer），没有帧指针的库函数（libc等）之上可能断开；
+    可执行文件中的static函数没有导出，显示为[server.out+偏移]
+*/
+
+#define PROFILE_MAX_SECONDS 60
+#define PROFILE_MAX_HZ 1000
+
+// 交给剖析线程的剖析，结束后在剖析线程中调用finish()
+class profile_job{
+    public:
+        virtual ~profile_job(){}
+        // ok为false时err为原因；out可以直接拿走
+        virtual void finish(bool ok,std::string &out,const std::string &err)=0;
+};
+
+class profiler{
+    public:
+        // 剖析seconds秒，每个线程每CPU秒采样hz次，折叠栈写入out。
+        // 在调用线程中阻塞到结束；同时只能有一个剖析，失败时err为原因
+        static bool run(double seconds,int hz,std::string &out,std::string &err);
+
+        /*
+            启动专门的剖析线程，之后submit()的剖析在它上面阻塞，不占用事件循环和工作线程。
+            它不登记到thread_registry，自己不被采样，也不受卡顿监视
+        */
+        static bool start(std::string &err);
+        // 交给剖析线程，马上返回；已经有剖析在进行时返回false，不会调用job->finish()
+        static bool submit(double seconds,int hz,profile_job *job,std::string &err);
+
+    private:
+        static void *worker(void *arg); // 剖析线程
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "./stack_trace.h"
+
+#include <ucontext.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// [fp]是上一层的帧指针，[fp+8]是返回地址（x86-64和aarch64相同）
+uint32_t stack_trace::unwind(const void *ucontext,uintptr_t stack_lo,uintptr_t stack_hi,uintptr_t *pcs,uint32_t max){
+    const ucontext_t *ctx=(const ucontext_t *)ucontext;
+    uintptr_t pc,fp;
+#if defined(__x86_64__)
+    pc=ctx->uc_mcontext.gregs[REG_RIP];
+    fp=ctx->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    pc=ctx->uc_mcontext.pc;
+    fp=ctx->uc_mcontext.regs[29];
+#else
+    return 0;
+#endif
+    if(max==0){
+        return 0;
+    }
+    uint32_t depth=0;
+    pcs[depth++]=pc;
+    while(depth<max && fp>=stack_lo && fp+2*sizeof(uintptr_t)<=stack_hi && (fp&(sizeof(uintptr_t)-1))==0){
+        const uintptr_t *frame=(const uintptr_t *)fp;
+        uintptr_t next=frame[0];
+        uintptr_t ret=frame[1];
+        if(ret==0){
+            break;
+        }
+        pcs[depth++]=ret;
+        if(next<=fp){ // 栈向低地址增长，外层的帧一定在更高的地址
+            break;
+        }
+        fp=next;
+    }
+    return depth;
+}
+
+std::string stack_trace::symbolize(uintptr_t pc){
+    Dl_info info;
+    if(dladdr((void *)pc,&info) && info.dli_sname){
+        int status;
+        char *demangled=abi::__cxa_demangle(info.dli_sname,NULL,NULL,&status);
+        std::string name=status==0?demangled:info.dli_sname;
+        free(demangled);
+        return name;
+    }
+    char buf[64];
+    if(info.dli_fname && info.dli_fname[0]){
+        const char *base=strrchr(info.dli_fname,'/');
+        snprintf(buf,sizeof(buf),"[%.40s+0x%lx]",base?base+1:info.dli_fname,(unsigned long)(pc-(uintptr_t)info.dli_fbase));
+    }else{
+        snprintf(buf,sizeof(buf),"[0x%lx]",(unsigned long)pc);
+    }
+    return buf;
+}
@@ -0,0 +1,20 @@
+#ifndef STACK_TRACE_H
+#define STACK_TRACE_H
+
+#include <stdint.h>
+#include <string>
+
+/*
+    沿帧指针回溯调用栈，采样剖析（profiler）和卡顿监视（watchdog）在信号处理函数中使用。
+    只读[stack_lo,stack_hi)范围内的内存，不加锁、不分配内存，可以在信号处理函数中调用；
+    只支持x86-64和aarch64，其他平台返回0
+*/
+class stack_trace{
+    public:
+        // ucontext是信号处理函数的第三个参数。pcs[0]是被打断的指令，之后是各层的返回地址，返回帧数
+        static uint32_t unwind(const void *ucontext,uintptr_t stack_lo,uintptr_t stack_hi,uintptr_t *pcs,uint32_t max);
+        // 地址所在的函数名（C++名字还原），找不到符号时为[模块+偏移]。调用dladdr，不能在信号处理函数中使用
+        static std::string symbolize(uintptr_t pc);
+};
+
+#endif
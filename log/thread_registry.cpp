@@ -0,0 +1,51 @@
+#include "./thread_registry.h"
+#include "./watchdog.h"
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "../lock/locker.h"
+
+static locker registry_lock;
+static std::vector<thread_entry> threads;
+
+void thread_registry::add(int role){
+    thread_entry e;
+    e.m_tid=syscall(SYS_gettid);
+    e.m_thread=pthread_self();
+    e.m_role=role;
+    e.m_stack_lo=0;
+    e.m_stack_hi=0;
+    pthread_attr_t attr;
+    if(pthread_getattr_np(e.m_thread,&attr)==0){ // 主线程的栈大小按RLIMIT_STACK算
+        void *addr;
+        size_t size;
+        if(pthread_attr_getstack(&attr,&addr,&size)==0){
+            e.m_stack_lo=(uintptr_t)addr;
+            e.m_stack_hi=(uintptr_t)addr+size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    heartbeat *h=new heartbeat();
+    h->m_role=role;
+    h->m_tid=e.m_tid;
+    h->m_stack_lo=e.m_stack_lo;
+    h->m_stack_hi=e.m_stack_hi;
+    e.m_heartbeat=h;
+    watchdog::attach(h);
+    registry_lock.lock();
+    threads.push_back(e);
+    registry_lock.unlock();
+}
+
+std::vector<thread_entry> thread_registry::snapshot(){
+    registry_lock.lock();
+    std::vector<thread_entry> copy=threads;
+    registry_lock.unlock();
+    return copy;
+}
+
+const char *thread_registry::role_name(int role){
+    static const char *names[THREAD_ROLE_COUNT]={"reactor","worker","io","logger"};
+    return role>=0 && role<THREAD_ROLE_COUNT?names[role]:"other";
+}
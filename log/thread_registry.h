@@ -0,0 +1,43 @@
+#ifndef THREAD_REGISTRY_H
+#define THREAD_REGISTRY_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <vector>
+
+struct heartbeat;
+
+/*
+    进程中各个长期运行的线程在开始时登记自己的角色、线程号和栈的范围，
+    采样剖析按它给每个线程设置定时器并给样本打上角色，卡顿监视按它检查每个线程的心跳。
+    服务器的线程都不退出，所以只登记不注销
+*/
+
+enum THREAD_ROLE{
+    THREAD_REACTOR=0, // 主线程的事件循环，shared-nothing模式下各个核的事件循环
+    THREAD_WORKER, // 线程池
+    THREAD_IO, // 预读冷文件的I/O线程
+    THREAD_LOGGER, // 访问日志、追踪、流量捕获的写线程
+    THREAD_ROLE_COUNT
+};
+
+struct thread_entry{
+    pid_t m_tid; // 内核线程号
+    pthread_t m_thread;
+    int m_role; // THREAD_ROLE
+    uintptr_t m_stack_lo; // 栈的范围[m_stack_lo,m_stack_hi)，回溯时检查帧指针
+    uintptr_t m_stack_hi;
+    heartbeat *m_heartbeat; // 卡顿监视用的心跳（watchdog）
+};
+
+class thread_registry{
+    public:
+        // 登记当前线程，每个线程调用一次
+        static void add(int role);
+        // 已登记线程的副本
+        static std::vector<thread_entry> snapshot();
+        static const char *role_name(int role);
+};
+
+#endif
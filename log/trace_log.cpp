@@ -0,0 +1,234 @@
+#include "./trace_log.h"
+#include "./access_log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <iostream>
+#include <vector>
+
+#include "../lock/locker.h"
+#include "./thread_registry.h"
+
+#define MAX_PENDING 65536 // 写线程来不及处理时最多积压的样本数
+#define FLUSH_INTERVAL_US 100000 // 写线程每隔这么久取走一次样本
+#define SLOW_LOG_PER_SEC 10 // 每秒最多打印的慢请求数，其余只计数
+
+bool trace_log::m_enabled=false;
+bool trace_log::m_traced=false;
+int trace_log::m_sample_every=0;
+uint64_t trace_log::m_slow_ns=0;
+
+static locker pending_lock;
+static std::vector<trace_sample> pending;
+static FILE *trace_fp=NULL;
+static thread_local int local_tid=0;
+static thread_local int local_count=0;
+static std::atomic<uint64_t> sampled(0);
+static std::atomic<uint64_t> slow(0);
+static std::atomic<uint64_t> dropped(0);
+
+int trace_log::thread_id(){
+    if(local_tid==0){
+        local_tid=syscall(SYS_gettid);
+    }
+    return local_tid;
+}
+
+bool trace_log::sample(){
+    if(!m_traced){
+        return false;
+    }
+    if(++local_count<m_sample_every){
+        return false;
+    }
+    local_count=0;
+    return true;
+}
+
+void trace_log::append(const trace_sample &s){
+    pending_lock.lock();
+    bool ok=pending.size()<MAX_PENDING;
+    if(ok){
+        pending.push_back(s);
+    }
+    pending_lock.unlock();
+    if(!ok){
+        dropped.fetch_add(1,std::memory_order_relaxed);
+    }
+}
+
+static const char *method_name(uint8_t m){
+    return m==1?"POST":"GET";
+}
+
+// 路径可能包含任意字节，按JSON字符串转义
+static void json_escape(const char *p,size_t n,std::string &out){
+    out.clear();
+    for(size_t i=0;i<n;i++){
+        unsigned char c=p[i];
+        if(c=='"' || c=='\\'){
+            out+='\\';
+            out+=c;
+        }else if(c<0x20 || c>=0x7f){
+            char buf[8];
+            snprintf(buf,sizeof(buf),"\\u%04x",c);
+            out+=buf;
+        }else{
+            out+=c;
+        }
+    }
+}
+
+// 一个完整事件（ph为X），时间是微秒
+static void event(FILE *fp,const char *name,uint64_t begin,uint64_t end,int fd){
+    fprintf(fp,"{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+            name,(int)getpid(),fd,begin/1e3,(end>begin?end-begin:0)/1e3);
+}
+
+/*
+    每个连接（fd）一条泳道，请求是一个大事件，各阶段是嵌套在里面的小事件：
+    read（数据到达后等着被解析，交给线程池时包含queue） parse process（交给线程池时包含queue） send
+*/
+static void write_trace(FILE *fp,const trace_sample &s,std::vector<bool> &named){
+    int pid=getpid();
+    if(s.m_fd>=0){
+        if((size_t)s.m_fd>=named.size()){
+            named.resize(s.m_fd+1,false);
+        }
+        if(!named[s.m_fd]){
+            fprintf(fp,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"fd %d\"}},\n",
+                    pid,s.m_fd,s.m_fd);
+            named[s.m_fd]=true;
+        }
+    }
+    uint64_t first=s.first();
+    std::string path;
+    json_escape(s.m_path,s.m_path_len<TRACE_PATH_MAX?s.m_path_len:TRACE_PATH_MAX,path);
+    if(s.m_accept){
+        event(fp,"connect",s.m_accept,first,s.m_fd);
+    }
+    fprintf(fp,"{\"name\":\"%s %s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+               "\"args\":{\"status\":%u,\"bytes\":%llu,\"thread\":%d,\"inline\":%d,\"batched\":%d,\"aborted\":%d,\"slow\":%d}},\n",
+            method_name(s.m_method),path.c_str(),pid,s.m_fd,first/1e3,(s.m_done-first)/1e3,
+            s.m_status,(unsigned long long)s.m_bytes,s.m_thread,(s.m_flags&ACCESS_INLINE)!=0,
+            (s.m_flags&ACCESS_BATCHED)!=0,(s.m_flags&ACCESS_ABORTED)!=0,s.m_slow);
+    if(first<s.m_start){
+        event(fp,"read",s.m_read,s.m_start,s.m_fd);
+    }
+    if(s.m_picked){
+        event(fp,"queue",s.m_dispatched,s.m_picked,s.m_fd);
+    }
+    uint64_t parsed=s.m_parsed?s.m_parsed:s.m_queued; // 解析出错的请求没有请求资源
+    event(fp,"parse",s.m_start,parsed,s.m_fd);
+    event(fp,"process",parsed,s.m_queued,s.m_fd);
+    event(fp,"send",s.m_queued,s.m_done,s.m_fd);
+}
+
+static double ms(uint64_t begin,uint64_t end){
+    return begin && end>begin?(end-begin)/1e6:0.0;
+}
+
+static void print_slow(const trace_sample &s){
+    uint64_t first=s.first();
+    uint64_t parsed=s.m_parsed?s.m_parsed:s.m_queued;
+    double queue=s.m_picked?(s.m_picked-s.m_dispatched)/1e6:0.0;
+    // 排队算在它所在的阶段之外：主线程预算用完时解析之前就交给了线程池，否则是解析之后
+    bool early=s.m_picked && s.m_picked<=s.m_start;
+    double read=ms(first,s.m_start)-(early?queue:0.0);
+    double process=ms(parsed,s.m_queued)-(s.m_picked && !early?queue:0.0);
+    char buf[512];
+    snprintf(buf,sizeof(buf),"slow request: %s %.*s %u fd %d thread %d, %.3fms: read %.3f queue %.3f parse %.3f "
+             "process %.3f send %.3f, %llu bytes%s%s",
+             method_name(s.m_method),(int)(s.m_path_len<TRACE_PATH_MAX?s.m_path_len:TRACE_PATH_MAX),s.m_path,
+             s.m_status,s.m_fd,s.m_thread,ms(first,s.m_done),read,queue,ms(s.m_start,parsed),process,
+             ms(s.m_queued,s.m_done),(unsigned long long)s.m_bytes,
+             (s.m_flags&ACCESS_BATCHED)?", batched":"",(s.m_flags&ACCESS_ABORTED)?", aborted":"");
+    std::cerr << buf << std::endl;
+}
+
+// 写线程：定期取走积压的样本，写追踪文件、打印慢请求
+void *trace_log::writer(void *){
+    thread_registry::add(THREAD_LOGGER);
+    std::vector<trace_sample> batch;
+    std::vector<bool> named;
+    time_t window=0;
+    int printed=0;
+    uint64_t suppressed=0;
+    while(1){
+        usleep(FLUSH_INTERVAL_US);
+        pending_lock.lock();
+        batch.swap(pending);
+        pending_lock.unlock();
+        time_t now=time(NULL);
+        if(now!=window){
+            if(suppressed>0){
+                std::cerr << "slow request: " << suppressed << " more not printed" << std::endl;
+            }
+            window=now;
+            printed=0;
+            suppressed=0;
+        }
+        for(size_t i=0;i<batch.size();i++){
+            const trace_sample &s=batch[i];
+            if(s.m_slow){
+                slow.fetch_add(1,std::memory_order_relaxed);
+                if(printed<SLOW_LOG_PER_SEC){
+                    print_slow(s);
+                    printed++;
+                }else{
+                    suppressed++;
+                }
+            }
+            if(trace_fp){
+                write_trace(trace_fp,s,named);
+            }
+            if(s.m_sampled){
+                sampled.fetch_add(1,std::memory_order_relaxed);
+            }
+        }
+        if(trace_fp && !batch.empty() && fflush(trace_fp)!=0){
+            perror("trace write");
+        }
+        batch.clear();
+    }
+    return NULL;
+}
+
+bool trace_log::open(const std::string &path,int sample_every,double slow_ms,std::string &err){
+    if(!path.empty()){
+        trace_fp=fopen(path.c_str(),"w");
+        if(!trace_fp){
+            err=path+": "+strerror(errno);
+            return false;
+        }
+        // JSON数组格式允许没有结尾的]，进程随时退出文件都能打开
+        fprintf(trace_fp,"[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"webserver\"}},\n",(int)getpid());
+        fflush(trace_fp);
+        m_traced=true;
+    }
+    m_sample_every=sample_every>0?sample_every:1;
+    m_slow_ns=slow_ms>0?(uint64_t)(slow_ms*1e6):0;
+    if(!m_traced && m_slow_ns==0){
+        return true;
+    }
+    pending.reserve(1024);
+    pthread_t tid;
+    if(pthread_create(&tid,NULL,writer,NULL)!=0){
+        err="create trace writer failed";
+        return false;
+    }
+    pthread_detach(tid);
+    m_enabled=true;
+    return true;
+}
+
+void trace_log::report(){
+    std::cerr << "trace: " << sampled.load(std::memory_order_relaxed) << " sampled, "
+              << slow.load(std::memory_order_relaxed) << " slow, "
+              << dropped.load(std::memory_order_relaxed) << " dropped" << std::endl;
+}
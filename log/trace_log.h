@@ -0,0 +1,72 @@
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+#define TRACE_PATH_MAX 64 // 样本中保留的路径前缀长度
+
+/*
+    一个请求各阶段的时间（单调时钟，纳秒），没有经过的阶段为0：
+    accept 建立连接（只有连接上的第一个请求有） -> read 读到请求的数据 -> dispatched/picked 在线程池队列中
+    -> start/parsed 解析 -> queued 响应放进输出队列 -> done 发送完
+*/
+struct trace_sample{
+    uint64_t m_accept;
+    uint64_t m_read;
+    uint64_t m_start;
+    uint64_t m_parsed;
+    uint64_t m_dispatched;
+    uint64_t m_picked;
+    uint64_t m_queued;
+    uint64_t m_done;
+    uint64_t m_bytes; // 响应的字节数
+    int32_t m_fd;
+    int32_t m_thread; // 生成响应的线程（内核的线程号）
+    uint16_t m_status;
+    uint8_t m_method; // 0 GET，1 POST
+    uint8_t m_flags; // ACCESS_FLAG
+    uint8_t m_sampled; // 按间隔选中的样本
+    uint8_t m_slow; // 超过了慢请求的阈值
+    uint16_t m_path_len; // 完整路径的长度
+    char m_path[TRACE_PATH_MAX]; // 路径前缀，不以'\0'结尾
+
+    // 请求开始的时间。请求分几次到达时，第一次尝试解析（m_start）可能早于最后一次读到数据时才记下的m_read
+    uint64_t first() const { return m_read && m_read<m_start?m_read:m_start; }
+};
+
+/*
+    请求的阶段追踪：每隔若干个响应取一个样本，连同超过阈值的慢请求，交给后台线程
+    写成Chrome trace-event格式（JSON数组，可以直接用Perfetto或chrome://tracing打开），
+    慢请求同时在标准错误输出中打印各阶段的耗时（每秒最多几条）。
+    没有被选中的请求只多了几次取时间，样本很少，用一把锁收集就够了
+*/
+class trace_log{
+    public:
+        /*
+            path为空时不写追踪文件，只打印慢请求；sample_every为每个线程每多少个响应取一个样本；
+            slow_ms为0时不检查慢请求。必须在处理请求的线程开始之前调用
+        */
+        static bool open(const std::string &path,int sample_every,double slow_ms,std::string &err);
+        static bool enabled(){ return m_enabled; }
+        // 当前线程的这个响应是否作为样本
+        static bool sample();
+        // 超过这个时间（从读到请求到发完）的请求是慢请求，0表示不检查
+        static uint64_t slow_ns(){ return m_slow_ns; }
+        static bool traced(){ return m_traced; }
+        static int thread_id(); // 当前线程的线程号，缓存在线程局部变量中
+        // 交给写线程，积压太多时丢弃
+        static void append(const trace_sample &s);
+        // 打印样本数、慢请求数和丢弃数
+        static void report();
+
+    private:
+        static void *writer(void *arg);
+        static bool m_enabled;
+        static bool m_traced;
+        static int m_sample_every;
+        static uint64_t m_slow_ns;
+};
+
+#endif
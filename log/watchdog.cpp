@@ -0,0 +1,197 @@
+#include "./watchdog.h"
+#include "./stack_trace.h"
+
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_REPORTS_PER_SECOND 10 // 和慢请求日志一样限制打印的条数
+#define CAPTURE_TIMEOUT_NS 100000000ull // 线程在内核中阻塞（如等磁盘）时信号要等它返回用户态才处理，不一直等
+
+// 栈的抓取状态
+enum CAPTURE_STATE{
+    CAPTURE_IDLE=0,
+    CAPTURE_REQUESTED, // 监视线程已经发了信号
+    CAPTURE_RUNNING, // 信号处理函数正在回溯
+    CAPTURE_DONE
+};
+
+bool watchdog::m_enabled=false;
+uint64_t watchdog::m_threshold_ns=0;
+thread_local heartbeat *watchdog::m_local=NULL;
+
+static int watchdog_signal(){
+    return SIGRTMIN+1;
+}
+
+heartbeat::heartbeat():m_epoch(0),m_busy_since(0),m_fd(-1),m_url(NULL),m_url_len(0),m_capture(CAPTURE_IDLE),
+                       m_capture_epoch(0),m_depth(0),m_req_fd(-1),m_req_len(0),m_role(0),m_tid(0),m_stack_lo(0),m_stack_hi(0){
+}
+
+static void sleep_ns(uint64_t ns){
+    struct timespec ts;
+    ts.tv_sec=ns/1000000000ull;
+    ts.tv_nsec=ns%1000000000ull;
+    while(nanosleep(&ts,&ts)==-1 && errno==EINTR){
+    }
+}
+
+// 在卡住的线程上执行：回溯自己的栈，拷贝正在处理的请求，这些内存此时一定还有效
+void watchdog::on_signal(int,siginfo_t *,void *uc){
+    heartbeat *h=m_local;
+    if(!h){
+        return;
+    }
+    int expected=CAPTURE_REQUESTED;
+    if(!h->m_capture.compare_exchange_strong(expected,CAPTURE_RUNNING,std::memory_order_acquire)){
+        return; // 监视线程已经不等了
+    }
+    if(h->m_epoch.load(std::memory_order_relaxed)==h->m_capture_epoch && h->m_busy_since.load(std::memory_order_relaxed)!=0){
+        h->m_depth=stack_trace::unwind(uc,h->m_stack_lo,h->m_stack_hi,h->m_pcs,WATCHDOG_MAX_DEPTH);
+        h->m_req_fd=h->m_fd.load(std::memory_order_relaxed);
+        uint32_t len=h->m_url_len.load(std::memory_order_relaxed);
+        const char *url=h->m_url.load(std::memory_order_relaxed);
+        if(!url){
+            len=0;
+        }
+        h->m_req_len=len<WATCHDOG_URL_MAX?len:WATCHDOG_URL_MAX;
+        memcpy(h->m_req_url,url,h->m_req_len);
+    }
+    h->m_capture.store(CAPTURE_DONE,std::memory_order_release);
+}
+
+// 让卡住的线程抓栈并打印，最多等CAPTURE_TIMEOUT_NS
+static void report(heartbeat *h,uint64_t epoch,uint64_t busy_ns,uint64_t threshold_ns){
+    h->m_capture_epoch=epoch;
+    h->m_depth=0;
+    h->m_req_fd=-1;
+    h->m_req_len=0;
+    h->m_capture.store(CAPTURE_REQUESTED,std::memory_order_release);
+    bool captured=false;
+    if(syscall(SYS_tgkill,getpid(),h->m_tid,watchdog_signal())==0){
+        uint64_t deadline=monotonic_ns()+CAPTURE_TIMEOUT_NS;
+        while(h->m_capture.load(std::memory_order_acquire)!=CAPTURE_DONE && monotonic_ns()<deadline){
+            sleep_ns(1000000);
+        }
+        int expected=CAPTURE_REQUESTED;
+        if(!h->m_capture.compare_exchange_strong(expected,CAPTURE_IDLE)){
+            while(h->m_capture.load(std::memory_order_acquire)!=CAPTURE_DONE){ // 信号处理函数已经开始，很快结束
+                sleep_ns(100000);
+            }
+            captured=true;
+        }
+    }
+
+    char line[512];
+    int n=snprintf(line,sizeof(line),"stall: %s thread %d busy for %.1fms (threshold %.1fms)",
+                   thread_registry::role_name(h->m_role),(int)h->m_tid,busy_ns/1e6,threshold_ns/1e6);
+    std::string out(line,n<(int)sizeof(line)?n:sizeof(line)-1);
+    if(!captured){
+        out+=", no stack: the thread did not handle the signal (blocked in the kernel?)\n";
+    }else if(h->m_depth==0){
+        out+=", finished before the stack was captured\n";
+    }else{
+        if(h->m_req_fd!=-1){
+            n=snprintf(line,sizeof(line),", fd %d",h->m_req_fd);
+            out.append(line,n);
+            if(h->m_req_len>0){
+                out+=" url ";
+                out.append(h->m_req_url,h->m_req_len);
+            }
+        }
+        out+='\n';
+        for(uint32_t i=0;i<h->m_depth;i++){
+            // 返回地址减一落在调用指令上
+            uintptr_t pc=i==0?h->m_pcs[0]:h->m_pcs[i]-1;
+            n=snprintf(line,sizeof(line),"    #%-2u %s\n",i,stack_trace::symbolize(pc).c_str());
+            out.append(line,n<(int)sizeof(line)?n:sizeof(line)-1);
+        }
+    }
+    h->m_capture.store(CAPTURE_IDLE,std::memory_order_release);
+    std::cerr << out << std::flush;
+}
+
+// 监视线程：每隔阈值的1/4检查一次所有心跳，同一段工作只报告一次
+void *watchdog::monitor(void *){
+    uint64_t period=m_threshold_ns/4;
+    if(period<1000000){
+        period=1000000;
+    }else if(period>100000000){
+        period=100000000;
+    }
+    std::unordered_map<heartbeat *,uint64_t> reported; // 每个心跳上次报告的工作
+    uint64_t window=0; // 限制打印条数的一秒
+    int reports=0;
+    uint64_t suppressed=0;
+    while(1){
+        sleep_ns(period);
+        std::vector<thread_entry> threads=thread_registry::snapshot();
+        for(size_t i=0;i<threads.size();i++){
+            heartbeat *h=threads[i].m_heartbeat;
+            uint64_t since=h->m_busy_since.load(std::memory_order_acquire);
+            uint64_t now=monotonic_ns();
+            if(since==0 || now<since || now-since<m_threshold_ns){
+                continue;
+            }
+            uint64_t epoch=h->m_epoch.load(std::memory_order_relaxed);
+            uint64_t &last=reported[h];
+            if(last==epoch){
+                continue;
+            }
+            last=epoch;
+            if(now-window>=1000000000ull){
+                if(suppressed>0){
+                    std::cerr << "stall: " << suppressed << " reports suppressed" << std::endl;
+                }
+                window=now;
+                reports=0;
+                suppressed=0;
+            }
+            if(reports>=MAX_REPORTS_PER_SECOND){
+                suppressed++;
+                continue;
+            }
+            reports++;
+            report(h,epoch,now-since,m_threshold_ns);
+        }
+    }
+    return NULL;
+}
+
+bool watchdog::start(double threshold_ms,std::string &err){
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_sigaction=on_signal;
+    sa.sa_flags=SA_SIGINFO|SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if(sigaction(watchdog_signal(),&sa,NULL)==-1){
+        err=std::string("sigaction: ")+strerror(errno);
+        return false;
+    }
+    m_threshold_ns=(uint64_t)(threshold_ms*1e6);
+    m_enabled=true;
+    pthread_t tid;
+    if(pthread_create(&tid,NULL,monitor,NULL)!=0){
+        m_enabled=false;
+        err="create watchdog thread failed";
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+void watchdog::collect(hdr_snapshot stalls[THREAD_ROLE_COUNT]){
+    std::vector<thread_entry> threads=thread_registry::snapshot();
+    for(size_t i=0;i<threads.size();i++){
+        const heartbeat *h=threads[i].m_heartbeat;
+        stalls[h->m_role].add(h->m_stalls);
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+
+#include "../http/metrics.h"
+#include "../cpu/busy_poll.h" // monotonic_ns()
+#include "./thread_registry.h"
+
+/*
+    卡顿监视：事件循环的每一轮、线程池的每个任务开始和结束时更新所在线程的心跳，
+    监视线程定期检查，一段工作超过阈值还没结束时（慢的do_request()、冷磁盘上的缺页、阻塞的write()……），
+    用信号让这个线程在自己的栈上回溯，连同它正在处理的连接和请求打印出来，每段工作只报告一次。
+    工作结束时线程自己把超过阈值的时长记进所在角色的直方图，/__stats中可以看到。
+    没有开启（-D）时每次只多一次判断
+*/
+
+#define WATCHDOG_MAX_DEPTH 48
+#define WATCHDOG_URL_MAX 128
+
+// 一个线程的心跳，只有所属线程写（栈的抓取除外），按缓存行对齐
+struct alignas(64) heartbeat{
+    std::atomic<uint64_t> m_epoch; // 每开始一段工作加一
+    std::atomic<uint64_t> m_busy_since; // 这段工作开始的时间，0表示空闲
+    std::atomic<int> m_fd; // 正在处理的连接，-1表示没有
+    std::atomic<const char *> m_url; // 连接上正在处理的请求的URL，在连接自己的读缓冲区中
+    std::atomic<uint32_t> m_url_len;
+    hdr_histogram m_stalls; // 超过阈值的工作的时长（纳秒）
+
+    // 监视线程请求抓栈时填写m_capture_epoch再置m_capture，信号处理函数在这个线程上写结果
+    alignas(64) std::atomic<int> m_capture;
+    uint64_t m_capture_epoch;
+    uint32_t m_depth; // 0表示发信号时那段工作已经结束
+    uintptr_t m_pcs[WATCHDOG_MAX_DEPTH];
+    int m_req_fd;
+    uint32_t m_req_len;
+    char m_req_url[WATCHDOG_URL_MAX];
+
+    int m_role; // THREAD_ROLE
+    pid_t m_tid;
+    uintptr_t m_stack_lo;
+    uintptr_t m_stack_hi;
+
+    heartbeat();
+};
+
+class watchdog{
+    public:
+        // 启动监视线程，一段工作超过threshold_ms毫秒算卡顿
+        static bool start(double threshold_ms,std::string &err);
+        static bool enabled(){ return m_enabled; }
+        // 当前线程登记的心跳，thread_registry::add()时设置
+        static void attach(heartbeat *h){ m_local=h; }
+
+        // 一段工作（事件循环的一轮、一个任务）开始
+        static void begin(){
+            heartbeat *h=m_local;
+            if(!m_enabled || !h){
+                return;
+            }
+            h->m_fd.store(-1,std::memory_order_relaxed);
+            h->m_url_len.store(0,std::memory_order_relaxed);
+            h->m_epoch.store(h->m_epoch.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+            h->m_busy_since.store(monotonic_ns(),std::memory_order_release);
+        }
+        // 一段工作结束，超过阈值时记下时长
+        static void end(){
+            heartbeat *h=m_local;
+            if(!m_enabled || !h){
+                return;
+            }
+            uint64_t since=h->m_busy_since.load(std::memory_order_relaxed);
+            uint64_t busy=monotonic_ns()-since;
+            h->m_busy_since.store(0,std::memory_order_release);
+            if(busy>=m_threshold_ns){
+                h->m_stalls.record(busy);
+            }
+        }
+        // 正在处理的连接和请求
+        static void current(int fd,std::string_view url){
+            heartbeat *h=m_local;
+            if(!m_enabled || !h){
+                return;
+            }
+            // 先清长度，在这个线程上执行的信号处理函数不会读到新指针配旧长度；只需要编译器屏障
+            h->m_url_len.store(0,std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            h->m_fd.store(fd,std::memory_order_relaxed);
+            h->m_url.store(url.data(),std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            h->m_url_len.store(url.size(),std::memory_order_relaxed);
+        }
+        // 各个角色的卡顿时长直方图之和
+        static void collect(hdr_snapshot stalls[THREAD_ROLE_COUNT]);
+
+    private:
+        static void *monitor(void *arg); // 监视线程
+        static void on_signal(int sig,siginfo_t *si,void *uc); // 在卡住的线程上抓栈
+        static bool m_enabled;
+        static uint64_t m_threshold_ns;
+        static thread_local heartbeat *m_local;
+};
+
+#endif
@@ -6,14 +6,31 @@
 #include <arpa/inet.h> // 字节序转换
 #include <signal.h> // 信号相关
 #include <assert.h> // 断言
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h> // CPU亲和性
+#include <vector>
+#include <atomic>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./config/config.h"
+#include "./bundle/bundle.h"
+#include "./cpu/cpu_topology.h"
+#include "./cpu/busy_poll.h"
+#include "./net/tcp_options.h"
+#include "./log/access_log.h"
+#include "./log/trace_log.h"
+#include "./log/capture_log.h"
+#include "./log/thread_registry.h"
+#include "./log/watchdog.h"
+#include "./log/profiler.h"
 
 #define MAX_FD 1024 //最大文件描述符
 #define MAX_EVENT_NUMBER 1000 // 最大事件数
 
 extern void addfd(int epollfd,int fd,bool one_shot,bool et_mode); // 外部声明
+extern void setnonblocking(int fd);
 /*
     int sigaction(int signum, const struct sigaction *act,
                      struct sigaction *oldact);
@@ -27,44 +44,60 @@ extern void addfd(int epollfd,int fd,bool one_shot,bool et_mode); // 外部声
         void     (*sa_restorer)(void); // 通常用于系统在信号处理函数执行后恢复程序状态
     };
 */
-// 默认信号处理函数
-// void sig_handler(int sig){
-
-// }
+// 信号处理函数只把信号值写入管道，真正的处理放到主循环中（统一事件源）
+static int sig_pipefd[2];
+void sig_handler(int sig){
+    int saved_errno=errno; // 保证函数的可重入性
+    char msg=sig;
+    send(sig_pipefd[1],&msg,1,0);
+    errno=saved_errno;
+}
 
 // 捕捉信号并处理
 void sig_ctl(int sig,void(sig_handler)(int),bool restart=true){
     struct sigaction sig_act; // 必须加struct，因为结构体和函数同名
+    memset(&sig_act,0,sizeof(sig_act)); // restart为false时sa_flags也要是0
     sig_act.sa_handler=sig_handler;
     if(restart){
         sig_act.sa_flags=SA_RESTART;
     }
     sigfillset(&sig_act.sa_mask); // 填充信号集，将所有信号添加到该集合中
-    assert(sigaction(sig,&sig_act,NULL)!=-1); // 如果条件为加，断言触发，程序会终止，并在标准错误流中输出相关信息
+    // 不能把sigaction()写在assert()里：定义了NDEBUG时整个调用会被去掉，信号处理函数就没有设置
+    if(sigaction(sig,&sig_act,NULL)==-1){
+        perror("sigaction");
+        exit(1);
+    }
 }
 
-int main(int argc,char *argv[]){
-    sig_ctl(SIGTERM, SIG_DFL);
+// 重新生成固定响应，自定义错误页可能来自新的资源包
+void load_fixed_responses(const config &cfg){
+    std::shared_ptr<const bundle> b=bundle_store::current();
+    fixed_response_store::replace(fixed_response_set::build(cfg.m_doc_root,b.get()));
+}
 
-    if(argc==1){
-        // basename()用于从路径中获取文件名部分
-        std::cerr << "usage: " << basename(argv[0]) << " ip_address port_number" << std::endl;
-        return 1;
+// 加载资源包并替换当前的资源包。加载失败时继续使用旧的
+bool load_bundle(const config &cfg){
+    int flags=0;
+    if(cfg.m_bundle_populate){
+        flags|=BUNDLE_POPULATE;
     }
-    int port=atoi(argv[1]); // 字符串转整数
-
-    // 创建线程池
-    threadpool<http_conn> *pool;
-    try{
-        pool=new threadpool<http_conn>(); // 线程池对象在整个程序的生命周期内都存在，创建在堆上
-    }catch(const std::exception& e){ //?????????????????
-        // 捕获并处理异常
-        std::cerr << "Caught exception: " << e.what() << std::endl;
-        return 1;
+    if(cfg.m_bundle_hugepage){
+        flags|=BUNDLE_HUGEPAGE;
     }
-    
-    http_conn * conns=new http_conn[MAX_FD];
+    std::string err;
+    std::shared_ptr<const bundle> b=bundle::load(cfg.m_bundle_path.c_str(),flags,err);
+    if(!b){
+        std::cerr << "load bundle " << cfg.m_bundle_path << ": " << err << std::endl;
+        return false;
+    }
+    bundle_store::replace(b);
+    std::cerr << "bundle " << cfg.m_bundle_path << ": " << b->size() << " assets, "
+              << b->mapped_size() << " bytes" << std::endl;
+    return true;
+}
 
+// 创建监听套接字，失败返回-1。reuseport为true时设置SO_REUSEPORT，允许多个套接字监听同一个端口
+static int open_listener(int port,bool reuseport,const tcp_options &opt){
 /*
     int socket(int domain, int type, int protocol); 
     - domain: 协议族
@@ -83,7 +116,7 @@ int main(int argc,char *argv[]){
     int listenfd=socket(AF_INET,SOCK_STREAM,0); 
     if(listenfd==-1){
         perror("socket");
-        return 1;
+        return -1;
     }
 
 /*
@@ -99,7 +132,14 @@ int main(int argc,char *argv[]){
     int reuse = 1;
     if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
         perror("set socket option");
-        return 1;
+        close(listenfd);
+        return -1;
+    }
+    // 每个线程各自监听同一个端口，由内核把新连接分散到这些监听套接字上
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+        perror("set SO_REUSEPORT");
+        close(listenfd);
+        return -1;
     }
 /*
     int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen); 
@@ -131,6 +171,7 @@ int main(int argc,char *argv[]){
     int ret =bind(listenfd,(sockaddr *)&server_addr,sizeof(server_addr)); // 先取地址再类型转换
     if(ret==-1){
         perror("bind");
+        close(listenfd);
         return -1;
     }
 
@@ -139,22 +180,319 @@ int main(int argc,char *argv[]){
     - sockfd : 通过socket()函数得到的文件描述符
     - backlog : 未连接的和已经连接的和的最大值
 */
-    // 3.开始监听
-    ret = listen(listenfd,8); 
+    // 3.开始监听。队列太短时突发的连接会溢出，客户端要等1秒重传SYN
+    apply_listen_options(listenfd,opt);
+    ret = listen(listenfd,opt.m_backlog); 
     if(ret==-1){
         perror("listen");
+        close(listenfd);
         return -1;
     }
+    return listenfd;
+}
+
+/*
+    int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen); 阻塞函数
+    - sockfd : 用于监听的文件描述符
+    - addr : 传出参数，记录了连接成功后客户端的地址信息（ip，port）
+    - addrlen : 指定第二个参数的对应的内存大小
+    - 返回值：
+        成功 ：用于通信的文件描述符
+        -1 ： 失败
+*/
+// 内核不支持忙轮询或没有权限（SO_BUSY_POLL需要CAP_NET_ADMIN才能超过系统设置）时只提示一次
+static std::atomic<bool> busy_poll_warned(false);
+static void warn_busy_poll(const char *what){
+    if(!busy_poll_warned.exchange(true)){
+        perror(what);
+    }
+}
+
+// epoll实例开启内核忙轮询（-B）
+static void setup_busy_poll(int epollfd,const config &cfg){
+    if(cfg.m_busy_poll_us>0 && !set_epoll_busy_poll(epollfd,cfg.m_busy_poll_us)){
+        warn_busy_poll("epoll busy poll");
+    }
+}
+
+// 接受一个新连接并开始监听它。连接数或fd超出连接表时直接关闭，出错时只打印，不影响其他连接
+static void accept_conn(int listenfd,int epollfd,http_conn *conns,const config &cfg){
+    sockaddr_in client_addr;
+    socklen_t len=sizeof(client_addr);
+    int connfd=accept(listenfd,(sockaddr *)&client_addr,&len); 
+    if(connfd==-1){
+        if(errno!=EAGAIN && errno!=EWOULDBLOCK){ // 多个线程监听时连接可能已经被别的线程取走
+            perror("accept");
+        }
+        return;
+    }
+    if(connfd>=MAX_FD || http_conn::m_conn_count>=MAX_FD){
+        close(connfd);
+        return;
+    }
+    if(cfg.m_busy_poll_us>0 && !set_socket_busy_poll(connfd,cfg.m_busy_poll_us)){
+        warn_busy_poll("SO_BUSY_POLL");
+    }
+    apply_conn_options(connfd,cfg.m_tcp);
+    conns[connfd].init(connfd,client_addr,epollfd); // 初始化连接
+    // ET只注册一次（边缘触发，同时监听读写）；LT使用EPOLLONESHOT+水平触发
+    bool et=cfg.m_edge_triggered;
+    addfd(epollfd,connfd,!et,et); // 监听这个连接
+    loop_stats::inc(loop_stats::local().m_accepted);
+}
+
+// shared-nothing模式下一个核的事件循环
+struct core_arg{
+    int m_id;
+    int m_cpu; // 绑定的CPU
+    const config *m_cfg;
+    int m_listenfd;
+    pthread_t m_tid;
+    std::atomic<loop_stats *> m_stats; // 在线程中绑定CPU后创建，直方图从本地节点分配
+    std::atomic<busy_poller *> m_poller; // 在线程中创建，统计从本地节点分配
+};
+
+/*
+    每个线程一套完整的服务：自己的SO_REUSEPORT监听套接字、epoll实例、连接表和文件缓存分片。
+    连接从accept到关闭都在这个线程中，解析和发送都直接在事件循环里做，没有线程池和I/O线程。
+    先绑定CPU再分配连接表：内核在第一次访问时从当前CPU所在的NUMA节点分配物理页
+*/
+static void *core_loop(void *arg){
+    core_arg *core=(core_arg *)arg;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core->m_cpu,&set);
+    if(pthread_setaffinity_np(pthread_self(),sizeof(set),&set)!=0){
+        std::cerr << "core " << core->m_id << ": bind cpu " << core->m_cpu << " failed" << std::endl;
+    }
+    // 计数和文件缓存分片都在绑定之后由这个线程创建和第一次写入
+    loop_stats *stats=new loop_stats();
+    loop_stats::attach(stats);
+    core->m_stats.store(stats,std::memory_order_release);
+    thread_registry::add(THREAD_REACTOR);
+    file_cache shard;
+    file_cache::set_local(&shard);
+    http_conn *conns=new http_conn[MAX_FD];
+
+    int listenfd=open_listener(core->m_cfg->m_port,true,core->m_cfg->m_tcp);
+    if(listenfd==-1){
+        exit(1);
+    }
+    setnonblocking(listenfd);
+    if(core->m_cfg->m_tcp.m_incoming_cpu && !set_incoming_cpu(listenfd,core->m_cpu)){
+        perror("set SO_INCOMING_CPU");
+    }
+    core->m_listenfd=listenfd;
+    int epollfd=epoll_create(1);
+    epoll_event ev;
+    ev.data.fd=listenfd;
+    ev.events=EPOLLIN;
+    epoll_ctl(epollfd,EPOLL_CTL_ADD,listenfd,&ev);
+    setup_busy_poll(epollfd,*core->m_cfg);
+
+    busy_poller *poller=new busy_poller(core->m_cfg->spin_us(core->m_id));
+    core->m_poller.store(poller,std::memory_order_release);
+    epoll_event *events=new epoll_event[MAX_EVENT_NUMBER];
+    uint64_t drain_check=0;
+    while(1){
+        int num=poller->wait(epollfd,events,MAX_EVENT_NUMBER,http_conn::drain_wait_ms());
+        if(num==-1){
+            if(errno==EINTR){
+                continue;
+            }
+            perror("epoll wait");
+            exit(1);
+        }
+        watchdog::begin(); // 一轮处理算一段工作，阻塞等待的时间不算
+        for(int i=0;i<num;i++){
+            if(events[i].data.fd==listenfd){
+                accept_conn(listenfd,epollfd,conns,*core->m_cfg);
+            }else{
+                conns[events[i].data.fd].on_event(events[i].events);
+            }
+        }
+        http_conn::expire_draining(conns,MAX_FD,drain_check);
+        watchdog::end();
+    }
+    return NULL;
+}
+
+// 在工作线程的CPU（没有指定时为进程允许使用的CPU）中依次为每个核的线程分配一个，核数多于CPU时轮流使用
+static bool start_cores(const config &cfg,const cpu_plan &plan,std::vector<core_arg *> &cores){
+    cpu_set_t set;
+    if(plan.m_bind_workers){
+        set=plan.m_workers;
+    }else{
+        allowed_cpus(set);
+    }
+    std::vector<int> cpus;
+    for(int c=0;c<CPU_SETSIZE;c++){
+        if(CPU_ISSET(c,&set)){
+            cpus.push_back(c);
+        }
+    }
+    for(int i=0;i<cfg.m_cores;i++){
+        core_arg *core=new core_arg();
+        core->m_id=i;
+        core->m_cpu=cpus[i%cpus.size()];
+        core->m_cfg=&cfg;
+        core->m_listenfd=-1;
+        core->m_poller.store(NULL,std::memory_order_relaxed);
+        core->m_stats.store(NULL,std::memory_order_relaxed);
+        if(pthread_create(&core->m_tid,NULL,core_loop,core)!=0){
+            std::cerr << "create core thread failed" << std::endl;
+            return false;
+        }
+        pthread_detach(core->m_tid);
+        cores.push_back(core);
+    }
+    std::cerr << "shared-nothing: " << cfg.m_cores << " cores" << std::endl;
+    return true;
+}
+
+static void print_core_stats(const std::vector<core_arg *> &cores){
+    for(size_t i=0;i<cores.size();i++){
+        const loop_stats *st=cores[i]->m_stats.load(std::memory_order_acquire);
+        if(!st){ // 线程还没开始
+            continue;
+        }
+        std::cerr << "core " << cores[i]->m_id << " cpu " << cores[i]->m_cpu
+                  << ": accepted " << st->m_accepted.load(std::memory_order_relaxed)
+                  << " requests " << st->m_requests.load(std::memory_order_relaxed) << std::endl;
+        busy_poller *poller=cores[i]->m_poller.load(std::memory_order_acquire);
+        if(poller){
+            std::string name="core "+std::to_string(cores[i]->m_id);
+            report_busy_poll(name.c_str(),poller->stats());
+            report_listen(name.c_str(),cores[i]->m_listenfd); // 线程创建监听套接字之后才设置m_poller
+        }
+    }
+}
+
+int main(int argc,char *argv[]){
+    sig_ctl(SIGTERM, SIG_DFL);
+    sig_ctl(SIGPIPE, SIG_IGN); // 对方关闭后继续写会触发SIGPIPE，忽略它，由writev返回EPIPE处理
+
+    config cfg;
+    if(!cfg.parse_arg(argc,argv)){
+        config::usage(argv[0]);
+        return 1;
+    }
+    int port=cfg.m_port;
+    http_conn::m_doc_root=cfg.m_doc_root;
+    http_conn::m_autoindex=cfg.m_autoindex;
+    http_conn::m_edge_triggered=cfg.m_edge_triggered;
+    http_conn::m_tcp_cork=cfg.m_tcp.m_cork;
+    http_conn::m_max_requests=cfg.m_max_requests;
+    http_conn::m_stats_path=cfg.m_stats_path;
+    http_conn::m_profile_path=cfg.m_profile_path;
+    if(!cfg.m_bundle_path.empty() && !load_bundle(cfg)){
+        return 1;
+    }
+    load_fixed_responses(cfg);
+    if(!cfg.m_access_log.empty()){ // 写线程要在处理请求的线程之前启动
+        std::string err;
+        if(!access_log::open(cfg.m_access_log,(uint64_t)cfg.m_access_log_rotate_mb*1024*1024,err)){
+            std::cerr << "access log: " << err << std::endl;
+            return 1;
+        }
+    }
+    if(!cfg.m_trace_path.empty() || cfg.m_slow_ms>0){
+        std::string err;
+        if(!trace_log::open(cfg.m_trace_path,cfg.m_trace_every,cfg.m_slow_ms,err)){
+            std::cerr << "trace: " << err << std::endl;
+            return 1;
+        }
+    }
+    if(!cfg.m_capture_path.empty()){
+        std::string err;
+        if(!capture_log::open(cfg.m_capture_path,err)){
+            std::cerr << "capture: " << err << std::endl;
+            return 1;
+        }
+    }
+    if(!cfg.m_profile_path.empty()){
+        std::string err;
+        if(!profiler::start(err)){
+            std::cerr << "profiler: " << err << std::endl;
+            return 1;
+        }
+    }
+    if(cfg.m_stall_ms>0){
+        std::string err;
+        if(!watchdog::start(cfg.m_stall_ms,err)){
+            std::cerr << "watchdog: " << err << std::endl;
+            return 1;
+        }
+    }
+
+    // 线程放到哪些CPU上
+    cpu_plan plan;
+    std::string err;
+    if(!make_cpu_plan(cfg.m_reactor_cpus,cfg.m_worker_cpus,cfg.m_nic,plan,err)){
+        std::cerr << err << std::endl;
+        return 1;
+    }
+    report_cpu_plan(plan,cfg.m_cores>0?"cores":"workers");
+    // 主线程先绑定，之后它分配的连接表等内存在第一次访问时从本地节点分配
+    if(plan.m_bind_reactor && !bind_thread(plan.m_reactor)){
+        std::cerr << "bind reactor to cpu " << format_cpu_list(plan.m_reactor) << " failed" << std::endl;
+    }
+    const cpu_set_t *worker_cpus=plan.m_bind_workers?&plan.m_workers:NULL;
+
+    int listenfd=-1;
+    http_conn *conns=NULL;
+    threadpool<http_conn> *pool=NULL;
+    std::vector<core_arg *> cores;
+    if(cfg.m_cores>0){
+        // shared-nothing：每个核一个独立的事件循环，主线程只处理信号
+        if(!start_cores(cfg,plan,cores)){
+            return 1;
+        }
+    }else{
+        // 创建线程池，新线程默认继承主线程的亲和性，所以要明确指定
+        try{
+            pool=new threadpool<http_conn>(8,100000,worker_cpus,cfg.m_worker_spin_us); // 线程池对象在整个程序的生命周期内都存在，创建在堆上
+            if(cfg.m_io_threads>0){
+                http_conn::m_io_pool=new threadpool<prefetch_task>(cfg.m_io_threads,100000,worker_cpus,cfg.m_worker_spin_us,THREAD_IO);
+            }
+        }catch(const std::exception& e){ //?????????????????
+            // 捕获并处理异常
+            std::cerr << "Caught exception: " << e.what() << std::endl;
+            return 1;
+        }
+        http_conn::m_pool=pool;
+        conns=new http_conn[MAX_FD];
+        listenfd=open_listener(port,false,cfg.m_tcp);
+        if(listenfd==-1){
+            return 1;
+        }
+    }
 
     // 4.创建一个epoll实例
     int epollfd= epoll_create(1); // 参数无意义，大于0即可
-    http_conn::m_epollfd=epollfd;
+    if(listenfd!=-1){
+        setup_busy_poll(epollfd,cfg);
+    }
 
     // 5.将监听套接字的文件描述符添加到epoll实例中
     epoll_event ev;
-    ev.data.fd=listenfd;
-    ev.events=EPOLLIN; 
-    epoll_ctl(epollfd,EPOLL_CTL_ADD,listenfd,&ev);
+    if(listenfd!=-1){
+        ev.data.fd=listenfd;
+        ev.events=EPOLLIN; 
+        epoll_ctl(epollfd,EPOLL_CTL_ADD,listenfd,&ev);
+    }
+
+    // 信号管道，读端加入epoll
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,sig_pipefd)==-1){
+        perror("socketpair");
+        return 1;
+    }
+    fcntl(sig_pipefd[1],F_SETFL,fcntl(sig_pipefd[1],F_GETFL)|O_NONBLOCK);
+    ev.data.fd=sig_pipefd[0];
+    ev.events=EPOLLIN;
+    epoll_ctl(epollfd,EPOLL_CTL_ADD,sig_pipefd[0],&ev);
+    sig_ctl(SIGHUP,sig_handler); // 重新加载资源包，重新打开访问日志
+    sig_ctl(SIGUSR1,sig_handler); // 打印每个事件循环的计数和自旋统计
     
 /*
     int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
@@ -182,54 +520,70 @@ int main(int argc,char *argv[]){
     } epoll_data_t;
 */
     epoll_event changed_events[MAX_EVENT_NUMBER];
+    // shared-nothing模式下主线程只处理信号，不自旋
+    busy_poller poller(listenfd!=-1?cfg.spin_us(0):0);
+    thread_registry::add(THREAD_REACTOR);
+    uint64_t drain_check=0;
     // 6.委托内核监听多个文件描述符
     while(1){
-        int num=epoll_wait(epollfd,changed_events,MAX_EVENT_NUMBER,-1); // 阻塞
+        int num=poller.wait(epollfd,changed_events,MAX_EVENT_NUMBER,http_conn::drain_wait_ms()); // 先自旋（-S），再阻塞
         if(num == -1){
+            if(errno==EINTR){ // 被信号打断
+                continue;
+            }
             perror("epoll wait");
             return -1;
         }
+        http_conn::m_inline_budget=cfg.m_inline_budget; // 每轮重新分配快速路径的预算
+        watchdog::begin();
         for(int i=0;i<num;i++){ // 变化的文件描述符的信息存储在数组中
             ev=changed_events[i];
-            if(ev.data.fd==listenfd){ // 有新的客户端连接
-/*
-    int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen); 阻塞函数
-    - sockfd : 用于监听的文件描述符
-    - addr : 传出参数，记录了连接成功后客户端的地址信息（ip，port）
-    - addrlen : 指定第二个参数的对应的内存大小
-    - 返回值：
-        成功 ：用于通信的文件描述符
-        -1 ： 失败
-*/
-                sockaddr_in client_addr;
-                socklen_t len=sizeof(client_addr);
-                int connfd=accept(listenfd,(sockaddr *)&client_addr,&len); 
-                if(connfd==-1){
-                    perror("accept");
-                    return -1;
+            if(listenfd!=-1 && ev.data.fd==listenfd){ // 有新的客户端连接
+                accept_conn(listenfd,epollfd,conns,cfg);
+            }else if(ev.data.fd==sig_pipefd[0]){ // 有信号到达
+                char signals[64];
+                int n=recv(sig_pipefd[0],signals,sizeof(signals),0);
+                for(int j=0;j<n;j++){
+                    if(signals[j]==SIGHUP){
+                        if(!cfg.m_bundle_path.empty()){
+                            load_bundle(cfg);
+                        }
+                        load_fixed_responses(cfg);
+                        access_log::reopen();
+                    }else if(signals[j]==SIGUSR1){
+                        if(listenfd!=-1){
+                            report_busy_poll("reactor",poller.stats());
+                            report_listen("listen",listenfd);
+                        }
+                        print_core_stats(cores);
+                        loop_stats::report();
+                        if(trace_log::enabled()){
+                            trace_log::report();
+                        }
+                        if(access_log::enabled()){
+                            access_log::report();
+                        }
+                        if(capture_log::enabled()){
+                            capture_log::report();
+                        }
+                    }
                 }
-                if(http_conn::m_conn_count>=MAX_FD){ // ????????????
-                    continue;
-                }
-                conns[connfd].init(connfd,client_addr); // 初始化连接
-                addfd(epollfd,connfd,true,true); // 监听这个连接
-            }else if(ev.events & EPOLLIN){ // 客户端发来请求
-                if(conns[ev.data.fd].read()){ // 将请求读入缓冲区
-                    pool->append(conns+ev.data.fd); // 让子线程处理请求
-                }else{
-                    conns[ev.data.fd].close_conn();
-                } 
-            }else if(ev.events & EPOLLOUT){
-                conns[ev.data.fd].write();
+            }else{ // 客户端发来请求，或者没写完的响应可以继续写了
+                conns[ev.data.fd].on_event(ev.events);
             }
         }
+        if(conns){
+            http_conn::expire_draining(conns,MAX_FD,drain_check);
+        }
+        watchdog::end();
     }
 
     close(epollfd);
     close(listenfd);
     delete[] conns;
     delete pool;
+    delete http_conn::m_io_pool;
 
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,194 @@
+#include "./tcp_options.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY、TCP_CORK、TCP_INFO等
+#include <iostream>
+#include <vector>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+tcp_options::tcp_options(){
+    m_backlog=4096;
+    m_defer_accept=0;
+    m_fastopen=0;
+    m_nodelay=true;
+    m_cork=false;
+    m_sndbuf=0;
+    m_rcvbuf=0;
+    m_incoming_cpu=true;
+}
+
+bool tcp_options::parse(const char *spec,std::string &err){
+    std::string s=spec;
+    size_t pos=0;
+    while(pos<=s.size()){
+        size_t comma=s.find(',',pos);
+        if(comma==std::string::npos){
+            comma=s.size();
+        }
+        std::string item=s.substr(pos,comma-pos);
+        pos=comma+1;
+        size_t eq=item.find('=');
+        if(eq==std::string::npos){
+            err="tcp option needs name=value: "+item;
+            return false;
+        }
+        std::string name=item.substr(0,eq);
+        const char *value=item.c_str()+eq+1;
+        char *end;
+        long v=strtol(value,&end,10);
+        if(end==value || *end || v<0 || v>0x7fffffff){
+            err="bad value for tcp option "+name+": "+value;
+            return false;
+        }
+        if(name=="backlog"){
+            m_backlog=v;
+        }else if(name=="defer"){
+            m_defer_accept=v;
+        }else if(name=="fastopen"){
+            m_fastopen=v;
+        }else if(name=="nodelay"){
+            m_nodelay=v!=0;
+        }else if(name=="cork"){
+            m_cork=v!=0;
+        }else if(name=="sndbuf"){
+            m_sndbuf=v;
+        }else if(name=="rcvbuf"){
+            m_rcvbuf=v;
+        }else if(name=="incoming_cpu"){
+            m_incoming_cpu=v!=0;
+        }else{
+            err="unknown tcp option: "+name;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void set_opt(int fd,int level,int name,int value,const char *what){
+    if(setsockopt(fd,level,name,&value,sizeof(value))==-1){
+        perror(what);
+    }
+}
+
+// 读取一行sysctl的整数值，读不到返回-1
+static long read_sysctl(const char *path){
+    FILE *fp=fopen(path,"r");
+    if(!fp){
+        return -1;
+    }
+    long v=-1;
+    if(fscanf(fp,"%ld",&v)!=1){
+        v=-1;
+    }
+    fclose(fp);
+    return v;
+}
+
+void apply_listen_options(int listenfd,const tcp_options &opt){
+    // 接收缓冲区要在listen()之前设置，窗口扩大因子在握手时就确定了
+    if(opt.m_rcvbuf>0){
+        set_opt(listenfd,SOL_SOCKET,SO_RCVBUF,opt.m_rcvbuf,"set SO_RCVBUF");
+    }
+    if(opt.m_sndbuf>0){
+        set_opt(listenfd,SOL_SOCKET,SO_SNDBUF,opt.m_sndbuf,"set SO_SNDBUF");
+    }
+    if(opt.m_defer_accept>0){
+        set_opt(listenfd,IPPROTO_TCP,TCP_DEFER_ACCEPT,opt.m_defer_accept,"set TCP_DEFER_ACCEPT");
+    }
+    if(opt.m_fastopen>0){
+        set_opt(listenfd,IPPROTO_TCP,TCP_FASTOPEN,opt.m_fastopen,"set TCP_FASTOPEN");
+        long mode=read_sysctl("/proc/sys/net/ipv4/tcp_fastopen");
+        if(mode>=0 && !(mode&2)){ // 第2位是服务端开关
+            std::cerr << "tcp: net.ipv4.tcp_fastopen=" << mode << ", server side fast open is disabled" << std::endl;
+        }
+    }
+    long somaxconn=read_sysctl("/proc/sys/net/core/somaxconn");
+    if(somaxconn>0 && opt.m_backlog>somaxconn){
+        std::cerr << "tcp: backlog " << opt.m_backlog << " is capped by net.core.somaxconn=" << somaxconn << std::endl;
+    }
+}
+
+void apply_conn_options(int connfd,const tcp_options &opt){
+    if(opt.m_nodelay){
+        set_opt(connfd,IPPROTO_TCP,TCP_NODELAY,1,"set TCP_NODELAY");
+    }
+}
+
+bool set_incoming_cpu(int listenfd,int cpu){
+    return setsockopt(listenfd,SOL_SOCKET,SO_INCOMING_CPU,&cpu,sizeof(cpu))==0;
+}
+
+void set_cork(int fd,bool on){
+    int v=on;
+    setsockopt(fd,IPPROTO_TCP,TCP_CORK,&v,sizeof(v));
+}
+
+bool read_listen_queue(int listenfd,listen_stats &st){
+    struct tcp_info info;
+    socklen_t len=sizeof(info);
+    if(getsockopt(listenfd,IPPROTO_TCP,TCP_INFO,&info,&len)==-1){
+        return false;
+    }
+    // 对监听套接字，内核用这两个字段返回accept队列的长度和上限
+    st.m_queued=info.tcpi_unacked;
+    st.m_backlog=info.tcpi_sacked;
+    return true;
+}
+
+/*
+    /proc/net/netstat每两行一组：第一行是字段名，第二行是对应的值
+    TcpExt: SyncookiesSent ... ListenOverflows ListenDrops ...
+    TcpExt: 0 ... 12 12 ...
+*/
+bool read_listen_drops(listen_stats &st){
+    FILE *fp=fopen("/proc/net/netstat","r");
+    if(!fp){
+        return false;
+    }
+    bool found=false;
+    std::vector<char> names(16384),values(16384);
+    while(!found && fgets(names.data(),names.size(),fp) && fgets(values.data(),values.size(),fp)){
+        if(strncmp(names.data(),"TcpExt:",7)!=0){
+            continue;
+        }
+        char *ns,*vs;
+        char *n=strtok_r(names.data()," \n",&ns);
+        char *v=strtok_r(values.data()," \n",&vs);
+        while(n && v){
+            if(strcmp(n,"ListenOverflows")==0){
+                st.m_overflows=strtoull(v,NULL,10);
+                found=true;
+            }else if(strcmp(n,"ListenDrops")==0){
+                st.m_drops=strtoull(v,NULL,10);
+            }
+            n=strtok_r(NULL," \n",&ns);
+            v=strtok_r(NULL," \n",&vs);
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+void report_listen(const char *name,int listenfd){
+    listen_stats st;
+    memset(&st,0,sizeof(st));
+    char buf[256];
+    int n=0;
+    if(listenfd!=-1 && read_listen_queue(listenfd,st)){
+        n=snprintf(buf,sizeof(buf),"%s: accept queue %u/%u",name,st.m_queued,st.m_backlog);
+    }else{
+        n=snprintf(buf,sizeof(buf),"%s:",name);
+    }
+    if(read_listen_drops(st)){
+        snprintf(buf+n,sizeof(buf)-n,", listen overflows %llu drops %llu (all sockets)",
+                 (unsigned long long)st.m_overflows,(unsigned long long)st.m_drops);
+    }
+    std::cerr << buf << std::endl;
+}
@@ -0,0 +1,59 @@
+#ifndef TCP_OPTIONS_H
+#define TCP_OPTIONS_H
+
+#include <stdint.h>
+#include <string>
+
+/*
+    监听套接字和连接的TCP选项，命令行-t backlog=4096,defer=1,...设置：
+    - backlog    listen()的队列长度，内核还会按net.core.somaxconn截断
+    - defer      TCP_DEFER_ACCEPT（秒）：握手完成后等到第一个数据包才唤醒accept，0表示不开
+    - fastopen   TCP_FASTOPEN的队列长度：第一次以后的连接可以在SYN里带请求，省一个RTT，0表示不开
+    - nodelay    TCP_NODELAY：响应已经攒成一次writev，不需要Nagle再等ACK
+    - cork       流式响应多次写时用TCP_CORK攒满整包再发，写完或写不动时拔掉
+    - sndbuf/rcvbuf  SO_SNDBUF/SO_RCVBUF（字节），0表示由内核自动调整。设在监听套接字上，连接继承
+    - incoming_cpu   shared-nothing模式下每个核的监听套接字设置SO_INCOMING_CPU，
+                     SO_REUSEPORT优先把连接交给和网卡收包在同一个CPU上的线程
+*/
+struct tcp_options{
+    int m_backlog;
+    int m_defer_accept;
+    int m_fastopen;
+    bool m_nodelay;
+    bool m_cork;
+    int m_sndbuf;
+    int m_rcvbuf;
+    bool m_incoming_cpu;
+
+    tcp_options();
+    // 解析"name=value,..."，失败时err说明原因
+    bool parse(const char *spec,std::string &err);
+};
+
+// 在bind()之后、listen()之前设置监听套接字的选项，设置失败的选项只打印警告
+void apply_listen_options(int listenfd,const tcp_options &opt);
+// 设置新连接的选项
+void apply_conn_options(int connfd,const tcp_options &opt);
+// 监听套接字优先接收在cpu上收到的连接
+bool set_incoming_cpu(int listenfd,int cpu);
+// 打开或拔掉TCP_CORK
+void set_cork(int fd,bool on);
+
+/*
+    监听队列的状态：
+    - 队列当前长度和上限来自监听套接字的TCP_INFO（tcpi_unacked、tcpi_sacked）
+    - 溢出和丢弃来自/proc/net/netstat的TcpExt: ListenOverflows、ListenDrops，是整个网络命名空间的计数
+*/
+struct listen_stats{
+    uint32_t m_queued; // 等待accept的连接数
+    uint32_t m_backlog; // 队列上限
+    uint64_t m_overflows; // 队列满了丢弃的握手
+    uint64_t m_drops; // 所有原因丢弃的SYN（包括溢出）
+};
+
+bool read_listen_queue(int listenfd,listen_stats &st);
+bool read_listen_drops(listen_stats &st);
+// 打印name的监听队列和全局的溢出计数，listenfd为-1时只打印溢出计数
+void report_listen(const char *name,int listenfd);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+    静态文件的GET在稳定状态下不调用malloc。
+    替换malloc系列函数计数，用socketpair模拟一个连接，直接调用on_event()处理请求：
+    第一个请求要stat/mmap并放进文件缓存，之后命中缓存的请求和缓存过期后重新stat的请求都不应该分配内存
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <string>
+
+#include "../http/http_conn.h"
+
+extern "C" void *__libc_malloc(size_t n);
+extern "C" void *__libc_calloc(size_t n,size_t size);
+extern "C" void *__libc_realloc(void *p,size_t n);
+extern "C" void *__libc_memalign(size_t align,size_t n);
+extern "C" void __libc_free(void *p);
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocs(0);
+
+static void count(){
+    if(counting.load(std::memory_order_relaxed)){
+        allocs.fetch_add(1,std::memory_order_relaxed);
+    }
+}
+
+extern "C" void *malloc(size_t n){ count(); return __libc_malloc(n); }
+extern "C" void *calloc(size_t n,size_t size){ count(); return __libc_calloc(n,size); }
+extern "C" void *realloc(void *p,size_t n){ count(); return __libc_realloc(p,n); }
+extern "C" void *memalign(size_t align,size_t n){ count(); return __libc_memalign(align,n); }
+extern "C" void *aligned_alloc(size_t align,size_t n){ count(); return __libc_memalign(align,n); }
+extern "C" int posix_memalign(void **out,size_t align,size_t n){
+    count();
+    *out=__libc_memalign(align,n);
+    return *out?0:ENOMEM;
+}
+extern "C" void free(void *p){ __libc_free(p); }
+
+extern void addfd(int epollfd,int fd,bool one_shot,bool et_mode);
+
+static int failures=0;
+
+// 读完一个带Content-Length的响应，返回状态码
+static int read_response(int fd){
+    std::string data;
+    char buf[4096];
+    size_t head_end=std::string::npos;
+    size_t total=0;
+    while(1){
+        if(head_end!=std::string::npos && data.size()>=total){
+            break;
+        }
+        ssize_t n=read(fd,buf,sizeof(buf));
+        if(n<=0){
+            return -1;
+        }
+        data.append(buf,n);
+        if(head_end==std::string::npos && (head_end=data.find("\r\n\r\n"))!=std::string::npos){
+            const char *cl=strstr(data.c_str(),"Content-Length: ");
+            total=head_end+4+(cl?atol(cl+16):0);
+        }
+    }
+    return atoi(data.c_str()+9);
+}
+
+// 发送一个请求并处理，返回处理期间的分配次数
+static long one_request(http_conn &conn,int client,const char *url,int expect){
+    char req[256];
+    int len=snprintf(req,sizeof(req),"GET %s HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\nIf-None-Match: \"x\"\r\n\r\n",url);
+    if(write(client,req,len)!=len){
+        perror("write");
+        exit(1);
+    }
+    allocs.store(0);
+    counting.store(true);
+    conn.on_event(EPOLLIN);
+    counting.store(false);
+    long n=allocs.load();
+    int status=read_response(client);
+    if(status!=expect){
+        fprintf(stderr,"GET %s: status %d, expected %d\n",url,status,expect);
+        failures++;
+    }
+    return n;
+}
+
+static void expect_zero(const char *what,long n){
+    printf("%-32s %ld allocations\n",what,n);
+    if(n!=0){
+        failures++;
+    }
+}
+
+int main(){
+    char dir[]="/tmp/alloc_test.XXXXXX";
+    if(!mkdtemp(dir)){
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string root=dir;
+    std::string file=root+"/a_somewhat_long_file_name_beyond_sso.html";
+    FILE *fp=fopen(file.c_str(),"w");
+    for(int i=0;i<200;i++){
+        fputs("<p>hello allocation free world</p>\n",fp);
+    }
+    fclose(fp);
+
+    http_conn::m_doc_root=root;
+    fixed_response_store::replace(fixed_response_set::build(root,NULL));
+
+    int fds[2];
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,fds)==-1){
+        perror("socketpair");
+        return 1;
+    }
+    int epollfd=epoll_create(1);
+    http_conn *conn=new http_conn();
+    sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    conn->init(fds[0],addr,epollfd);
+    addfd(epollfd,fds[0],false,true);
+
+    const char *url="/a_somewhat_long_file_name_beyond_sso.html";
+    // 预热：建立文件缓存、线程的计数和各个缓冲区
+    long warm=one_request(*conn,fds[1],url,200);
+    printf("%-32s %ld allocations\n","first GET (stat, mmap, cache)",warm);
+    if(warm==0){ // 第一个请求一定会分配，一次都没数到说明替换malloc没有生效
+        fprintf(stderr,"malloc is not being counted\n");
+        failures++;
+    }
+    one_request(*conn,fds[1],"/missing",404);
+    one_request(*conn,fds[1],url,200);
+
+    expect_zero("cached GET",one_request(*conn,fds[1],url,200));
+    expect_zero("cached GET (again)",one_request(*conn,fds[1],url,200));
+    expect_zero("404",one_request(*conn,fds[1],"/missing",404));
+    sleep(FILE_CACHE_TTL+1); // 缓存过期，重新stat后续用原来的映射
+    expect_zero("revalidated GET",one_request(*conn,fds[1],url,200));
+    expect_zero("cached GET after revalidate",one_request(*conn,fds[1],url,200));
+
+    unlink(file.c_str());
+    rmdir(dir);
+    if(failures){
+        fprintf(stderr,"%d failures\n",failures);
+        return 1;
+    }
+    return 0;
+}
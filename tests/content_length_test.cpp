@@ -0,0 +1,125 @@
+/*
+    Content-Length的检查：负数、超过读缓冲区（包括接近INT_MAX）、不是数字、数字后有多余字符都返回400并关闭连接，
+    不能让请求的边界越界或者溢出；合法的请求体之后流水线上的下一个请求照常处理。
+    空文件（不能映射）返回200和空的正文。
+    和alloc_test一样用socketpair模拟连接，直接调用on_event()
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <string>
+#include <vector>
+
+#include "../http/http_conn.h"
+
+extern void addfd(int epollfd,int fd,bool one_shot,bool et_mode);
+
+static int failures=0;
+
+// 读出连接上的所有响应（按Content-Length切分）直到对端关闭或没有更多数据，返回各个状态码
+static std::vector<int> read_responses(int fd,size_t expect){
+    std::vector<int> status;
+    std::string data;
+    char buf[4096];
+    while(status.size()<expect){
+        size_t head_end=data.find("\r\n\r\n");
+        if(head_end!=std::string::npos){
+            const char *cl=strstr(data.c_str(),"Content-Length: ");
+            size_t total=head_end+4+(cl && cl<data.c_str()+head_end?atol(cl+16):0);
+            if(data.size()>=total){
+                status.push_back(atoi(data.c_str()+9));
+                data.erase(0,total);
+                continue;
+            }
+        }
+        ssize_t n=read(fd,buf,sizeof(buf));
+        if(n<=0){
+            break;
+        }
+        data.append(buf,n);
+    }
+    return status;
+}
+
+// 新建一个连接，发送req并处理一次，检查依次得到的状态码
+static void check(const char *what,const std::string &req,std::vector<int> expect){
+    int fds[2];
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,fds)==-1){
+        perror("socketpair");
+        exit(1);
+    }
+    int epollfd=epoll_create(1);
+    http_conn *conn=new http_conn();
+    sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    conn->init(fds[0],addr,epollfd);
+    addfd(epollfd,fds[0],false,true);
+    if(write(fds[1],req.data(),req.size())!=(ssize_t)req.size()){
+        perror("write");
+        exit(1);
+    }
+    conn->on_event(EPOLLIN);
+    shutdown(fds[1],SHUT_WR); // 服务器保持连接时读到没有更多响应为止
+    conn->on_event(EPOLLIN|EPOLLRDHUP);
+    std::vector<int> got=read_responses(fds[1],expect.size());
+    bool ok=got==expect;
+    printf("%-36s",what);
+    for(size_t i=0;i<got.size();i++){
+        printf(" %d",got[i]);
+    }
+    printf("%s\n",ok?"":"  FAILED");
+    if(!ok){
+        failures++;
+    }
+    close(fds[1]);
+    close(epollfd);
+}
+
+static std::string post(const char *content_length,const char *body){
+    return std::string("POST /a.html HTTP/1.1\r\nHost: test\r\nContent-Length: ")+content_length+"\r\n\r\n"+body;
+}
+
+int main(){
+    char dir[]="/tmp/content_length_test.XXXXXX";
+    if(!mkdtemp(dir)){
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string root=dir;
+    std::string file=root+"/a.html";
+    FILE *fp=fopen(file.c_str(),"w");
+    fputs("<p>hello</p>\n",fp);
+    fclose(fp);
+    std::string empty=root+"/empty.html";
+    fclose(fopen(empty.c_str(),"w"));
+
+    http_conn::m_doc_root=root;
+    fixed_response_store::replace(fixed_response_set::build(root,NULL));
+
+    const char *get="GET /a.html HTTP/1.1\r\nHost: test\r\n\r\n";
+    check("valid body, pipelined GET",post("5","hello")+get,{200,200});
+    check("empty body, pipelined GET",post("0","")+get,{200,200});
+    check("negative",post("-1","")+get,{400});
+    check("negative, large",post("-2147483648","")+get,{400});
+    check("INT_MAX without body",post("2147483647",""),{400});
+    check("beyond long",post("99999999999999999999999",""),{400});
+    check("larger than the read buffer",post("4096",""),{400});
+    check("not a number",post("abc",""),{400});
+    check("empty",post("",""),{400});
+    check("trailing garbage",post("5x","hello"),{400});
+    const char *get_empty="GET /empty.html HTTP/1.1\r\nHost: test\r\n\r\n";
+    check("empty file",get_empty,{200});
+    check("empty file, pipelined",std::string(get_empty)+get_empty+get,{200,200,200});
+
+    unlink(file.c_str());
+    unlink(empty.c_str());
+    rmdir(dir);
+    if(failures){
+        fprintf(stderr,"%d failures\n",failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,581 @@
+/*
+    性能回归检查：ctest -L perf（配置时加-DPERF_TESTS=ON才登记，默认的ctest不跑）。
+    在临时目录放几个文件，启动server.out，用loadgen跑固定的几种负载，每种跑几次取最好的结果，
+    吞吐和p99跟检入的基线文件比较，超出容差就失败。
+    perf_event_open可用时还统计服务器进程（所有线程）每个请求的指令数、缓存未命中数和系统调用数，
+    指令数和系统调用数比吞吐稳定得多，基线里有这两项时同样参与比较；请求数取服务器/__stats的计数，包含预热。
+
+    usage: perf_test [-u] [-n runs] [-d secs] server.out loadgen baseline
+      -u        用这次的结果重写基线（换了机器或者有意改变了性能时记录一次）
+      -n runs   每种负载跑几次（默认3）
+      -d secs   每次测量的时间（默认2，另有0.5秒预热）
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+// 一种固定的负载，参数改了基线就要重新记录
+struct workload{
+    const char *name;
+    const char *scenario; // loadgen -s
+    const char *conns; // loadgen -c
+    const char *path; // loadgen -u
+};
+
+static const workload workloads[]={
+    {"keepalive","keepalive","16","/index.html"},
+    {"pipeline","pipeline","4","/index.html"},
+    {"churn","churn","8","/index.html"},
+    {"large","large","2","/large.bin"},
+    {"post","post","8","/index.html"},
+};
+static const int WORKLOAD_COUNT=sizeof(workloads)/sizeof(workloads[0]);
+
+// 服务器进程的计数器，没有的为-1
+enum COUNTER{
+    COUNTER_INSTRUCTIONS=0,
+    COUNTER_CACHE_MISSES,
+    COUNTER_SYSCALLS,
+    COUNTER_COUNT
+};
+static const char *counter_names[COUNTER_COUNT]={"instructions","cache-misses","syscalls"};
+
+// 一次测量的结果，取不到的值为负数
+struct result{
+    double rps;
+    double p99; // 微秒
+    double per_request[COUNTER_COUNT];
+};
+
+// 基线中的一行，'-'表示没有记录
+struct baseline_row{
+    std::string name;
+    double rps;
+    double p99;
+    double instructions;
+    double syscalls;
+};
+
+// 容差：吞吐最多下降m_rps，其余最多上升对应的比例
+struct tolerance{
+    double m_rps;
+    double m_p99;
+    double m_instructions;
+    double m_syscalls;
+};
+
+static int perf_fd[COUNTER_COUNT]={-1,-1,-1};
+static bool user_only=false; // 不允许统计内核态时只统计用户态
+
+// 基线中记录的计数范围：all包含内核态，user只有用户态，none没有硬件计数器
+static const char *counter_scope(){
+    return perf_fd[COUNTER_INSTRUCTIONS]<0?"none":user_only?"user":"all";
+}
+
+static long perf_event_open(struct perf_event_attr *attr,pid_t pid,int cpu,int group,unsigned long flags){
+    return syscall(SYS_perf_event_open,attr,pid,cpu,group,flags);
+}
+
+// raw_syscalls:sys_enter跟踪点的编号，没有tracefs时返回-1
+static long syscall_tracepoint(){
+    const char *paths[]={"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                         "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+    for(size_t i=0;i<sizeof(paths)/sizeof(paths[0]);i++){
+        FILE *fp=fopen(paths[i],"r");
+        if(fp){
+            long id=-1;
+            if(fscanf(fp,"%ld",&id)!=1){
+                id=-1;
+            }
+            fclose(fp);
+            return id;
+        }
+    }
+    return -1;
+}
+
+static int open_counter(uint32_t type,uint64_t config,pid_t pid,bool exclude_kernel){
+    struct perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size=sizeof(attr);
+    attr.type=type;
+    attr.config=config;
+    attr.inherit=1; // 服务器之后创建的线程也计入
+    attr.exclude_kernel=exclude_kernel;
+    attr.exclude_hv=1;
+    return perf_event_open(&attr,pid,-1,-1,PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+    在服务器exec之前挂上计数器，它创建的所有线程都会继承；
+    读父计数器时内核会把还在运行的子线程的计数加进来
+*/
+static void open_counters(pid_t pid){
+    perf_fd[COUNTER_INSTRUCTIONS]=open_counter(PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS,pid,false);
+    if(perf_fd[COUNTER_INSTRUCTIONS]<0 && (errno==EACCES || errno==EPERM)){
+        // perf_event_paranoid为2时只能统计用户态
+        user_only=true;
+        perf_fd[COUNTER_INSTRUCTIONS]=open_counter(PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS,pid,true);
+    }
+    if(perf_fd[COUNTER_INSTRUCTIONS]<0){
+        fprintf(stderr,"perf_test: instructions counter unavailable: %s\n",strerror(errno));
+    }
+    perf_fd[COUNTER_CACHE_MISSES]=open_counter(PERF_TYPE_HARDWARE,PERF_COUNT_HW_CACHE_MISSES,pid,user_only);
+    if(perf_fd[COUNTER_CACHE_MISSES]<0){
+        fprintf(stderr,"perf_test: cache-misses counter unavailable: %s\n",strerror(errno));
+    }
+    long id=syscall_tracepoint();
+    if(id>=0){
+        perf_fd[COUNTER_SYSCALLS]=open_counter(PERF_TYPE_TRACEPOINT,id,pid,false);
+    }
+    if(perf_fd[COUNTER_SYSCALLS]<0){
+        fprintf(stderr,"perf_test: syscalls counter unavailable: %s\n",id<0?"no raw_syscalls tracepoint":strerror(errno));
+    }
+}
+
+static bool read_counter(int i,uint64_t &v){
+    return perf_fd[i]>=0 && read(perf_fd[i],&v,sizeof(v))==sizeof(v);
+}
+
+// 找一个空闲的端口
+static int free_port(){
+    int fd=socket(AF_INET,SOCK_STREAM,0);
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    socklen_t len=sizeof(addr);
+    if(fd<0 || bind(fd,(struct sockaddr *)&addr,sizeof(addr))!=0 || getsockname(fd,(struct sockaddr *)&addr,&len)!=0){
+        perror("free port");
+        exit(1);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static int connect_to(int port){
+    int fd=socket(AF_INET,SOCK_STREAM,0);
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_port=htons(port);
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    if(fd>=0 && connect(fd,(struct sockaddr *)&addr,sizeof(addr))==0){
+        return fd;
+    }
+    if(fd>=0){
+        close(fd);
+    }
+    return -1;
+}
+
+// 从/__stats取服务器解析过的请求数，失败时返回-1
+static long long server_requests(int port){
+    int fd=connect_to(port);
+    if(fd<0){
+        return -1;
+    }
+    const char *req="GET /__stats?format=json HTTP/1.1\r\nHost: perf\r\nConnection: close\r\n\r\n";
+    if(write(fd,req,strlen(req))!=(ssize_t)strlen(req)){
+        close(fd);
+        return -1;
+    }
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while((n=read(fd,buf,sizeof(buf)))>0){
+        data.append(buf,n);
+    }
+    close(fd);
+    size_t pos=data.find("\"requests\":{\"total\":");
+    return pos==std::string::npos?-1:atoll(data.c_str()+pos+20);
+}
+
+// 在JSON文本中找"key":数字，anchor不为空时从anchor之后找
+static double json_number(const std::string &s,const char *anchor,const char *key){
+    size_t pos=0;
+    if(anchor){
+        pos=s.find(anchor);
+        if(pos==std::string::npos){
+            return -1;
+        }
+    }
+    std::string k=std::string("\"")+key+"\":";
+    pos=s.find(k,pos);
+    return pos==std::string::npos?-1:atof(s.c_str()+pos+k.size());
+}
+
+static bool write_file(const std::string &path,size_t size){
+    std::string data(size,'\0');
+    for(size_t i=0;i<size;i++){
+        data[i]="abcdefghijklmnopqrstuvwxyz\n"[i%27];
+    }
+    FILE *fp=fopen(path.c_str(),"w");
+    if(!fp){
+        perror(path.c_str());
+        return false;
+    }
+    bool ok=fwrite(data.data(),1,size,fp)==size;
+    return fclose(fp)==0 && ok;
+}
+
+// 运行一次loadgen，返回是否成功（没有错误，响应都是2xx）
+static bool run_loadgen(const char *loadgen,const workload &w,int port,double secs,const std::string &json,result &r){
+    std::string port_str=std::to_string(port);
+    std::string secs_str=std::to_string(secs);
+    pid_t pid=fork();
+    if(pid==0){
+        int null=open("/dev/null",O_WRONLY);
+        dup2(null,STDOUT_FILENO);
+        execl(loadgen,loadgen,"-s",w.scenario,"-c",w.conns,"-u",w.path,"-d",secs_str.c_str(),"-w","0.5",
+              "-j",json.c_str(),port_str.c_str(),(char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if(pid<0 || waitpid(pid,&status,0)!=pid || !WIFEXITED(status) || WEXITSTATUS(status)!=0){
+        fprintf(stderr,"perf_test: %s: loadgen failed\n",w.name);
+        return false;
+    }
+    std::ifstream in(json);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string s=ss.str();
+    double requests=json_number(s,NULL,"requests");
+    double ok=json_number(s,"\"status\"","2xx");
+    r.rps=json_number(s,NULL,"rps");
+    r.p99=json_number(s,"\"latency_us\"","p99");
+    if(requests<=0 || ok!=requests || r.rps<=0){
+        fprintf(stderr,"perf_test: %s: %.0f of %.0f responses were 2xx\n",w.name,ok,requests);
+        return false;
+    }
+    return true;
+}
+
+// 读基线文件：tolerance行设容差，其余每行一种负载，#开头的是注释
+static bool load_baseline(const char *path,std::vector<baseline_row> &rows,tolerance &tol,std::string &machine,
+                          std::string &counters){
+    std::ifstream in(path);
+    if(!in){
+        return false;
+    }
+    std::string line;
+    while(std::getline(in,line)){
+        if(line.compare(0,11,"# machine: ")==0){
+            machine=line.substr(11);
+        }
+        if(line.empty() || line[0]=='#'){
+            continue;
+        }
+        std::istringstream ls(line);
+        std::string name,a,b,c,d;
+        ls >> name >> a >> b;
+        if(name=="counters"){
+            counters=a;
+            continue;
+        }
+        if(name=="tolerance"){
+            double v=atof(b.c_str());
+            if(a=="rps"){
+                tol.m_rps=v;
+            }else if(a=="p99"){
+                tol.m_p99=v;
+            }else if(a=="instructions"){
+                tol.m_instructions=v;
+            }else if(a=="syscalls"){
+                tol.m_syscalls=v;
+            }
+            continue;
+        }
+        ls >> c >> d;
+        baseline_row row;
+        row.name=name;
+        row.rps=a=="-"?-1:atof(a.c_str());
+        row.p99=b=="-"?-1:atof(b.c_str());
+        row.instructions=c.empty() || c=="-"?-1:atof(c.c_str());
+        row.syscalls=d.empty() || d=="-"?-1:atof(d.c_str());
+        rows.push_back(row);
+    }
+    return true;
+}
+
+static std::string machine_name(){
+    std::ifstream in("/proc/cpuinfo");
+    std::string line,model="unknown cpu";
+    while(std::getline(in,line)){
+        if(line.compare(0,10,"model name")==0){
+            size_t pos=line.find(": ");
+            model=pos==std::string::npos?line:line.substr(pos+2);
+            break;
+        }
+    }
+    return model+", "+std::to_string(sysconf(_SC_NPROCESSORS_ONLN))+" cpus";
+}
+
+static std::string value(double v,const char *fmt){
+    if(v<0){
+        return "-";
+    }
+    char buf[64];
+    snprintf(buf,sizeof(buf),fmt,v);
+    return buf;
+}
+
+static bool save_baseline(const char *path,const result *results,const tolerance &tol){
+    FILE *fp=fopen(path,"w");
+    if(!fp){
+        perror(path);
+        return false;
+    }
+    time_t now=time(NULL);
+    char date[32];
+    strftime(date,sizeof(date),"%Y-%m-%d",localtime(&now));
+    fprintf(fp,"# perf_test的基线，用perf_test -u记录（%s）。吞吐和p99只在同一台机器上有意义，\n"
+               "# 换了机器先在本机记录一次；指令数和系统调用数跟机器关系不大\n",date);
+    fprintf(fp,"# machine: %s\n",machine_name().c_str());
+    fprintf(fp,"# 容差：吞吐最多下降的比例，其余最多上升的比例\n");
+    fprintf(fp,"tolerance rps %.2f\ntolerance p99 %.2f\ntolerance instructions %.2f\ntolerance syscalls %.2f\n",
+            tol.m_rps,tol.m_p99,tol.m_instructions,tol.m_syscalls);
+    // 只统计用户态时指令数少得多，和包含内核态的基线不能比较
+    fprintf(fp,"counters %s\n",counter_scope());
+    fprintf(fp,"# workload  rps  p99_us  instructions/request  syscalls/request\n");
+    for(int i=0;i<WORKLOAD_COUNT;i++){
+        const result &r=results[i];
+        fprintf(fp,"%s %s %s %s %s\n",workloads[i].name,value(r.rps,"%.0f").c_str(),value(r.p99,"%.1f").c_str(),
+                value(r.per_request[COUNTER_INSTRUCTIONS],"%.0f").c_str(),value(r.per_request[COUNTER_SYSCALLS],"%.2f").c_str());
+    }
+    return fclose(fp)==0;
+}
+
+/*
+    比较一项，higher_is_better时低于基线超过容差算回退，否则高于基线超过容差算回退。
+    基线或本次没有这一项时不比较
+*/
+static bool check(const char *workload,const char *metric,double now,double base,double tol,bool higher_is_better){
+    if(now<0 || base<=0){
+        return true;
+    }
+    double change=(now-base)/base;
+    bool regressed=higher_is_better?change<-tol:change>tol;
+    if(regressed){
+        fprintf(stderr,"REGRESSION %s %s: %.1f vs baseline %.1f (%+.1f%%, tolerance %.0f%%)\n",
+                workload,metric,now,base,change*100,tol*100);
+    }
+    return !regressed;
+}
+
+static const baseline_row *find_row(const std::vector<baseline_row> &rows,const char *name){
+    for(size_t i=0;i<rows.size();i++){
+        if(rows[i].name==name){
+            return &rows[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,"usage: %s [-u] [-n runs] [-d secs] server.out loadgen baseline\n",prog);
+}
+
+int main(int argc,char *argv[]){
+    bool update=false;
+    int runs=3;
+    double secs=2;
+    int opt;
+    while((opt=getopt(argc,argv,"un:d:"))!=-1){
+        switch(opt){
+            case 'u': update=true; break;
+            case 'n': runs=atoi(optarg); break;
+            case 'd': secs=atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(argc-optind!=3 || runs<=0 || secs<=0){
+        usage(argv[0]);
+        return 1;
+    }
+    const char *server=argv[optind];
+    const char *loadgen=argv[optind+1];
+    const char *baseline_path=argv[optind+2];
+
+    std::vector<baseline_row> baseline;
+    tolerance tol={0.2,1.0,0.05,0.05}; // 回环上的吞吐和尾延迟噪声很大，指令数和系统调用数稳定
+    std::string machine,counters;
+    if(!load_baseline(baseline_path,baseline,tol,machine,counters) && !update){
+        fprintf(stderr,"perf_test: cannot read baseline %s (record one with -u)\n",baseline_path);
+        return 1;
+    }
+    if(!update && machine!=machine_name()){
+        fprintf(stderr,"perf_test: baseline was recorded on \"%s\", this is \"%s\"; "
+                       "throughput and p99 may not be comparable\n",machine.c_str(),machine_name().c_str());
+    }
+
+    // 临时的资源目录
+    char root[]="/tmp/perf_test.XXXXXX";
+    if(!mkdtemp(root)){
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir=root;
+    if(!write_file(dir+"/index.html",2704) || !write_file(dir+"/large.bin",1<<20)){
+        return 1;
+    }
+    std::string json=dir+"/result.json";
+
+    // 子进程等计数器挂好之后才exec
+    int port=free_port();
+    int go[2];
+    if(pipe(go)!=0){
+        perror("pipe");
+        return 1;
+    }
+    pid_t pid=fork();
+    if(pid==0){
+        close(go[1]);
+        char c;
+        while(read(go[0],&c,1)<0 && errno==EINTR){
+        }
+        int null=open("/dev/null",O_WRONLY);
+        dup2(null,STDOUT_FILENO);
+        dup2(null,STDERR_FILENO);
+        std::string port_str=std::to_string(port);
+        // -k 0：连接上的请求数不设上限，否则流水线上关闭连接时还没读的请求会被RST丢掉，算成loadgen的错误
+        execl(server,server,"-r",root,"-k","0","-M","/__stats",port_str.c_str(),(char *)NULL);
+        _exit(127);
+    }
+    close(go[0]);
+    if(pid<0){
+        perror("fork");
+        return 1;
+    }
+    open_counters(pid);
+    close(go[1]);
+
+    bool ready=false;
+    for(int i=0;i<100 && !ready;i++){
+        int fd=connect_to(port);
+        if(fd>=0){
+            close(fd);
+            ready=true;
+        }else{
+            usleep(50000);
+        }
+    }
+
+    bool ok=ready;
+    if(!ready){
+        fprintf(stderr,"perf_test: %s did not start on port %d\n",server,port);
+    }
+    result results[WORKLOAD_COUNT];
+    for(int i=0;i<WORKLOAD_COUNT && ok;i++){
+        const workload &w=workloads[i];
+        result &best=results[i];
+        best.rps=-1;
+        best.p99=-1;
+        for(int k=0;k<COUNTER_COUNT;k++){
+            best.per_request[k]=-1;
+        }
+        // 每项取几次中最好的，噪声多半只会让结果变差
+        for(int run=0;run<runs && ok;run++){
+            uint64_t begin[COUNTER_COUNT],end[COUNTER_COUNT];
+            bool counted[COUNTER_COUNT];
+            for(int k=0;k<COUNTER_COUNT;k++){
+                counted[k]=read_counter(k,begin[k]);
+            }
+            long long requests=server_requests(port);
+            result r;
+            if(!run_loadgen(loadgen,w,port,secs,json,r)){
+                ok=false;
+                break;
+            }
+            long long done=server_requests(port)-requests;
+            for(int k=0;k<COUNTER_COUNT;k++){
+                r.per_request[k]=-1;
+                if(counted[k] && read_counter(k,end[k]) && requests>=0 && done>0){
+                    r.per_request[k]=(double)(end[k]-begin[k])/done;
+                }
+            }
+            if(best.rps<0 || r.rps>best.rps){
+                best.rps=r.rps;
+            }
+            if(best.p99<0 || r.p99<best.p99){
+                best.p99=r.p99;
+            }
+            for(int k=0;k<COUNTER_COUNT;k++){
+                if(r.per_request[k]>=0 && (best.per_request[k]<0 || r.per_request[k]<best.per_request[k])){
+                    best.per_request[k]=r.per_request[k];
+                }
+            }
+        }
+    }
+
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+    unlink(json.c_str());
+    unlink((dir+"/index.html").c_str());
+    unlink((dir+"/large.bin").c_str());
+    rmdir(root);
+    if(!ok){
+        return 1;
+    }
+
+    printf("%-10s %10s %10s %10s %10s %14s %14s %14s\n","workload","rps","base","p99 us","base",
+           user_only?"instr/req(u)":"instr/req",counter_names[COUNTER_CACHE_MISSES],"syscalls/req");
+    for(int i=0;i<WORKLOAD_COUNT;i++){
+        const result &r=results[i];
+        const baseline_row *base=find_row(baseline,workloads[i].name);
+        printf("%-10s %10.0f %10s %10.1f %10s %14s %14s %14s\n",workloads[i].name,r.rps,
+               base?value(base->rps,"%.0f").c_str():"-",r.p99,base?value(base->p99,"%.1f").c_str():"-",
+               value(r.per_request[COUNTER_INSTRUCTIONS],"%.0f").c_str(),
+               value(r.per_request[COUNTER_CACHE_MISSES],"%.2f").c_str(),
+               value(r.per_request[COUNTER_SYSCALLS],"%.2f").c_str());
+    }
+    if(update){
+        if(!save_baseline(baseline_path,results,tol)){
+            return 1;
+        }
+        printf("baseline written to %s\n",baseline_path);
+        return 0;
+    }
+
+    bool passed=true;
+    bool same_counters=counters==counter_scope();
+    if(!same_counters && perf_fd[COUNTER_INSTRUCTIONS]>=0){
+        fprintf(stderr,"perf_test: baseline counters are \"%s\", these are \"%s\"; instructions not compared\n",
+                counters.c_str(),counter_scope());
+    }
+    for(int i=0;i<WORKLOAD_COUNT;i++){
+        const result &r=results[i];
+        const baseline_row *base=find_row(baseline,workloads[i].name);
+        if(!base){
+            fprintf(stderr,"perf_test: %s: no baseline, not compared\n",workloads[i].name);
+            continue;
+        }
+        passed&=check(workloads[i].name,"rps",r.rps,base->rps,tol.m_rps,true);
+        passed&=check(workloads[i].name,"p99 us",r.p99,base->p99,tol.m_p99,false);
+        if(same_counters){
+            passed&=check(workloads[i].name,"instructions/request",r.per_request[COUNTER_INSTRUCTIONS],
+                          base->instructions,tol.m_instructions,false);
+        }
+        passed&=check(workloads[i].name,"syscalls/request",r.per_request[COUNTER_SYSCALLS],
+                      base->syscalls,tol.m_syscalls,false);
+    }
+    printf("%s\n",passed?"perf gate passed":"perf gate FAILED");
+    return passed?0:1;
+}
@@ -2,15 +2,23 @@
 #define THREADPOOL_H
 
 #include <pthread.h>
+#include <sched.h> // cpu_set_t
 #include <queue>
 #include "../lock/locker.h"
+#include "../cpu/busy_poll.h"
+#include "../log/probes.h"
+#include "../log/thread_registry.h"
+#include "../log/watchdog.h"
 
 template <typename T> // T是请求队列中的任务类型
 class threadpool{
     public:
-        threadpool(int pool_size=8,int queue_max_size=100000);
+        // cpus不为NULL时所有线程只在这些CPU上运行；spin_us大于0时线程没有任务先自旋这么久再睡眠；
+        // role是线程在thread_registry中登记的角色
+        threadpool(int pool_size=8,int queue_max_size=100000,const cpu_set_t *cpus=NULL,int spin_us=0,int role=THREAD_WORKER);
         ~threadpool();
         bool append(T *request); // 往请求队列中添加任务
+        int queue_depth(); // 请求队列中还没有被取走的任务数
 
     private:
         pthread_t *m_threads; // 描述线程池的数组，pthread_t是线程标识符
@@ -23,6 +31,8 @@ class threadpool{
         sem m_queue_stat; // 请求队列有无任务需要处理
 
         bool m_stop; // 是否结束线程池工作
+        int m_spin_us; // 等任务时先自旋的时间，任务间隔很短时省去睡眠和唤醒
+        int m_role; // THREAD_ROLE
 
         /*
             work()是线程所执行的函数，但实际工作在run()中处理
@@ -32,10 +42,11 @@ class threadpool{
         */
         static void *work(void *arg);
         void run();
+        bool spin_wait(); // 自旋等任务，等到了返回true
 };
 
 template <typename T>
-threadpool<T>::threadpool(int pool_size,int queue_max_size):m_pool_size(pool_size),m_queue_max_size(queue_max_size){
+threadpool<T>::threadpool(int pool_size,int queue_max_size,const cpu_set_t *cpus,int spin_us,int role):m_pool_size(pool_size),m_queue_max_size(queue_max_size),m_spin_us(spin_us),m_role(role){
     if(pool_size<=0 || queue_max_size<=0){ 
         throw std::exception();
     }
@@ -46,19 +57,31 @@ threadpool<T>::threadpool(int pool_size,int queue_max_size):m_pool_size(pool_siz
         throw std::exception();
     }
     
+    // 在创建时就设置好CPU亲和性，线程从一开始就在指定的CPU上运行，栈和线程局部数据都从本地节点分配
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(cpus && pthread_attr_setaffinity_np(&attr,sizeof(cpu_set_t),cpus)!=0){
+        pthread_attr_destroy(&attr);
+        delete[] m_threads;
+        throw std::exception();
+    }
+
     // 创建线程并设置线程分离
     for(int i=0;i<m_pool_size;i++){
         // int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg);
         // pthread_t是线程标识符，attr表示新线程的属性，start_routine是一个指向函数的指针，arg表示传递给start_routine函数的参数
-        if(pthread_create(m_threads+i,NULL,work,this)!=0){ // 要写!=0
+        if(pthread_create(m_threads+i,&attr,work,this)!=0){ // 要写!=0
+            pthread_attr_destroy(&attr);
             delete[] m_threads;
             throw std::exception(); 
         }
         if(pthread_detach(m_threads[i])!=0){
+            pthread_attr_destroy(&attr);
             delete[] m_threads;
             throw std::exception(); 
         }
     }
+    pthread_attr_destroy(&attr);
 
     m_stop=false;
 }
@@ -78,11 +101,20 @@ bool threadpool<T>::append(T *request){
         return false;
     }
     m_request_queue.push(request);
+    WS_PROBE3(pool_enqueue,this,request,m_request_queue.size());
     m_lock.unlock();
     m_queue_stat.post(); // 使信号量计数+1
     return true;
 }
 
+template <typename T>
+int threadpool<T>::queue_depth(){
+    m_lock.lock();
+    int n=m_request_queue.size();
+    m_lock.unlock();
+    return n;
+}
+
 template <typename T>
 void *threadpool<T>::work(void *arg){
     threadpool *self_pool=(threadpool *)arg; // 需要类型转换
@@ -93,14 +125,32 @@ void *threadpool<T>::work(void *arg){
 // 每个线程实际所做的工作：在请求队列中取出任务并处理。单独写一个run()函数避免频繁写self_pool->...
 template <typename T>
 void threadpool<T>::run(){
+    thread_registry::add(m_role);
     while(!m_stop){ // m_stop为false就循环执行下面代码
-        m_queue_stat.wait();
+        if((m_spin_us<=0 || !spin_wait()) && !m_queue_stat.wait()){
+            continue; // 被信号打断（如剖析的SIGPROF），没有取到任务
+        }
         m_lock.lock();
         T *request=m_request_queue.front(); // 从请求队列中取出一个任务
         m_request_queue.pop();
+        WS_PROBE3(pool_dequeue,this,request,m_request_queue.size());
         m_lock.unlock();
+        watchdog::begin();
         request->process(); // 处理任务
+        watchdog::end();
     }
 }
 
+template <typename T>
+bool threadpool<T>::spin_wait(){
+    uint64_t deadline=monotonic_ns()+(uint64_t)m_spin_us*1000;
+    do{
+        if(m_queue_stat.try_wait()){
+            return true;
+        }
+        cpu_relax();
+    }while(monotonic_ns()<deadline);
+    return false;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,280 @@
+// bench：HTTP压测工具，单线程epoll驱动多个keep-alive连接，用来比较LT/ET等配置
+// 用法：bench [-c 连接数] [-d 秒数] [-p 流水线深度] [-a 地址] port path
+//   -p 1：普通keep-alive，收到响应再发下一个请求
+//   -p N：每个连接一次发出N个请求，N个响应都收到后再发下一批
+//   path指向大文件时测的是大文件吞吐
+// 只支持带Content-Length的响应（不支持chunked）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static uint64_t now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+struct bench_conn{
+    int fd;
+    std::string out; // 还没发出去的请求
+    size_t out_off;
+    std::string head; // 正在接收的响应头部
+    uint64_t body_left; // 当前响应还有多少字节正文
+    bool in_body;
+    bool close_after; // 响应带有Connection: close
+    int outstanding; // 已发出还没收到响应的请求数
+    uint64_t sent_at; // 这一批请求的发送时间
+};
+
+struct bench_result{
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t reconnects;
+    std::vector<uint32_t> latency_us;
+};
+
+static sockaddr_in g_addr;
+static std::string g_request;
+static int g_depth=1;
+static int g_epollfd;
+
+static bool connect_conn(bench_conn &c){
+    c.fd=socket(AF_INET,SOCK_STREAM,0);
+    if(c.fd==-1){
+        return false;
+    }
+    int one=1;
+    setsockopt(c.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    if(connect(c.fd,(sockaddr *)&g_addr,sizeof(g_addr))==-1){
+        close(c.fd);
+        c.fd=-1;
+        return false;
+    }
+    fcntl(c.fd,F_SETFL,fcntl(c.fd,F_GETFL)|O_NONBLOCK);
+    c.out.clear();
+    c.out_off=0;
+    c.head.clear();
+    c.in_body=false;
+    c.close_after=false;
+    c.outstanding=0;
+    epoll_event ev;
+    ev.events=EPOLLIN|EPOLLOUT|EPOLLET;
+    ev.data.ptr=&c;
+    epoll_ctl(g_epollfd,EPOLL_CTL_ADD,c.fd,&ev);
+    return true;
+}
+
+static void close_conn(bench_conn &c){
+    if(c.fd!=-1){
+        close(c.fd);
+        c.fd=-1;
+    }
+}
+
+static bool flush_out(bench_conn &c){
+    while(c.out_off<c.out.size()){
+        ssize_t n=send(c.fd,c.out.data()+c.out_off,c.out.size()-c.out_off,MSG_NOSIGNAL);
+        if(n==-1){
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+                return true;
+            }
+            if(errno==EINTR){
+                continue;
+            }
+            return false;
+        }
+        c.out_off+=n;
+    }
+    c.out.clear();
+    c.out_off=0;
+    return true;
+}
+
+// 发出一批请求
+static bool send_batch(bench_conn &c){
+    for(int i=0;i<g_depth;i++){
+        c.out+=g_request;
+    }
+    c.outstanding=g_depth;
+    c.sent_at=now_ns();
+    return flush_out(c);
+}
+
+// 头部收完后取出正文长度，返回false表示响应无法解析
+static bool parse_head(bench_conn &c){
+    if(c.head.compare(0,9,"HTTP/1.1 ")!=0 && c.head.compare(0,9,"HTTP/1.0 ")!=0){
+        return false;
+    }
+    c.body_left=0;
+    c.close_after=false;
+    bool has_length=false;
+    size_t pos=c.head.find("\r\n");
+    while(pos!=std::string::npos && pos+2<c.head.size()){
+        size_t end=c.head.find("\r\n",pos+2);
+        std::string line=c.head.substr(pos+2,end-pos-2);
+        if(strncasecmp(line.c_str(),"Content-Length:",15)==0){
+            c.body_left=strtoull(line.c_str()+15,NULL,10);
+            has_length=true;
+        }else if(strncasecmp(line.c_str(),"Connection:",11)==0){
+            c.close_after=strcasestr(line.c_str()+11,"close")!=NULL;
+        }
+        pos=end;
+    }
+    return has_length;
+}
+
+// 读出所有数据并解析响应，返回false表示连接要重建
+static bool on_readable(bench_conn &c,bench_result &r,bool running){
+    char buf[65536];
+    while(1){
+        ssize_t n=recv(c.fd,buf,sizeof(buf),0);
+        if(n==-1){
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+                return true;
+            }
+            if(errno==EINTR){
+                continue;
+            }
+            return false;
+        }
+        if(n==0){
+            return false;
+        }
+        r.bytes+=n;
+        size_t off=0;
+        while(off<(size_t)n){
+            if(c.in_body){
+                uint64_t take=std::min<uint64_t>(c.body_left,n-off);
+                c.body_left-=take;
+                off+=take;
+            }else{
+                // 逐字节找头部结尾，头部很短
+                c.head.push_back(buf[off++]);
+                size_t len=c.head.size();
+                if(len<4 || memcmp(c.head.data()+len-4,"\r\n\r\n",4)!=0){
+                    continue;
+                }
+                if(!parse_head(c)){
+                    r.errors++;
+                    return false;
+                }
+                c.in_body=true;
+            }
+            if(c.in_body && c.body_left==0){ // 一个响应收完
+                c.in_body=false;
+                c.head.clear();
+                r.requests++;
+                r.latency_us.push_back((now_ns()-c.sent_at)/1000);
+                if(c.close_after){
+                    return false;
+                }
+                if(--c.outstanding==0 && running && !send_batch(c)){
+                    return false;
+                }
+            }
+        }
+    }
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,"usage: %s [-c conns] [-d secs] [-p depth] [-a addr] port path\n",prog);
+}
+
+int main(int argc,char *argv[]){
+    int conns=16;
+    double secs=5;
+    const char *addr="127.0.0.1";
+    int opt;
+    while((opt=getopt(argc,argv,"c:d:p:a:"))!=-1){
+        switch(opt){
+            case 'c': conns=atoi(optarg); break;
+            case 'd': secs=atof(optarg); break;
+            case 'p': g_depth=atoi(optarg); break;
+            case 'a': addr=optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(optind!=argc-2 || conns<=0 || g_depth<=0 || secs<=0){
+        usage(argv[0]);
+        return 1;
+    }
+    g_addr.sin_family=AF_INET;
+    g_addr.sin_port=htons(atoi(argv[optind]));
+    if(inet_pton(AF_INET,addr,&g_addr.sin_addr)!=1){
+        usage(argv[0]);
+        return 1;
+    }
+    g_request=std::string("GET ")+argv[optind+1]+" HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+    g_epollfd=epoll_create1(0);
+    std::vector<bench_conn> cs(conns);
+    bench_result r={0,0,0,0,{}};
+    for(int i=0;i<conns;i++){
+        if(!connect_conn(cs[i]) || !send_batch(cs[i])){
+            perror("connect");
+            return 1;
+        }
+    }
+
+    uint64_t start=now_ns();
+    uint64_t deadline=start+(uint64_t)(secs*1e9);
+    epoll_event events[256];
+    while(1){
+        uint64_t now=now_ns();
+        if(now>=deadline){
+            break;
+        }
+        int n=epoll_wait(g_epollfd,events,256,(int)((deadline-now)/1000000)+1);
+        for(int i=0;i<n;i++){
+            bench_conn &c=*(bench_conn *)events[i].data.ptr;
+            bool ok=true;
+            if(events[i].events & EPOLLOUT){
+                ok=flush_out(c);
+            }
+            if(ok && (events[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))){
+                ok=on_readable(c,r,now_ns()<deadline);
+            }
+            if(!ok){ // 服务器关闭了连接：重连后继续，没收到的响应算作错误
+                r.errors+=c.outstanding>0 && !c.close_after?c.outstanding:0;
+                close_conn(c);
+                r.reconnects++;
+                if(!connect_conn(c) || !send_batch(c)){
+                    perror("reconnect");
+                    return 1;
+                }
+            }
+        }
+    }
+    double elapsed=(now_ns()-start)/1e9;
+    for(int i=0;i<conns;i++){
+        close_conn(cs[i]);
+    }
+
+    std::vector<uint32_t> &lat=r.latency_us;
+    std::sort(lat.begin(),lat.end());
+    uint32_t p50=0,p99=0,pmax=0;
+    if(!lat.empty()){
+        p50=lat[lat.size()/2];
+        p99=lat[std::min(lat.size()-1,lat.size()*99/100)];
+        pmax=lat.back();
+    }
+    // 一行一个结果，方便脚本汇总
+    printf("requests=%llu rps=%.0f MBps=%.1f p50_us=%u p99_us=%u max_us=%u errors=%llu reconnects=%llu\n",
+           (unsigned long long)r.requests,r.requests/elapsed,r.bytes/elapsed/1e6,p50,p99,pmax,
+           (unsigned long long)r.errors,(unsigned long long)r.reconnects);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# 比较LT和ET两种触发模式：分别启动server.out，跑keep-alive、流水线和大文件三种负载
+# 用法：tools/bench_trigger.sh build_dir doc_root [port] [secs] [conns]
+#   doc_root下需要有一个小文件（small_path）和一个大文件（large_path），可以用环境变量指定
+set -e
+
+BUILD=${1:?build_dir}
+ROOT=${2:?doc_root}
+PORT=${3:-9400}
+SECS=${4:-5}
+CONNS=${5:-16}
+SMALL=${small_path:-/index.html}
+LARGE=${large_path:-/large.bin}
+DEPTH=${pipeline_depth:-16}
+
+for mode in LT ET; do
+    "$BUILD/server.out" -m $mode -r "$ROOT" -i 0 $PORT >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    printf "%s keepalive  " $mode
+    "$BUILD/bench" -c $CONNS -d $SECS $PORT "$SMALL"
+    printf "%s pipeline%-2d " $mode $DEPTH
+    "$BUILD/bench" -c $CONNS -d $SECS -p $DEPTH $PORT "$SMALL"
+    printf "%s largefile  " $mode
+    "$BUILD/bench" -c 4 -d $SECS $PORT "$LARGE"
+    kill $pid
+    wait $pid 2>/dev/null || true
+done
@@ -0,0 +1,775 @@
+// loadgen：可重复的HTTP负载生成器，epoll驱动，每个线程一个事件循环，结果用HDR直方图统计
+// 用法：loadgen [选项] port，-h查看选项
+//   闭环（默认）：每个连接保持depth个未完成的请求，收到一个响应再补一个，测的是最大吞吐
+//   开环（-r）：按固定速率发出请求，延迟从计划发送的时间算起。服务器卡住时后面的请求照样"到达"，
+//   排队的时间算进延迟，不会因为客户端跟着停下而漏掉（修正协调遗漏，coordinated omission）
+// 场景：
+//   keepalive 长连接上请求小文件（-D root/请求目录下所有小文件）
+//   churn     每个请求新建连接（Connection: close），另外统计建连时间
+//   pipeline  每个连接流水线发出depth个请求（默认16）
+//   large     大文件下载，关注MB/s
+//   slowread  每个连接限速读取（-R字节/秒），观察服务器在慢客户端下的表现
+//   post      POST表单（-b字节的请求体）
+// 只支持带Content-Length的响应（不支持chunked）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "../http/metrics.h"
+
+#define MAX_HEAD 65536 // 响应头部的最大长度
+#define SMALL_FILE (64*1024) // -D只请求不超过这么大的文件
+#define TICK_NS 10000000ull // 慢读取的节拍
+
+enum SCENARIO{ KEEPALIVE=0, CHURN, PIPELINE, LARGE, SLOWREAD, POST, SCENARIO_COUNT };
+static const char *scenario_names[SCENARIO_COUNT]={"keepalive","churn","pipeline","large","slowread","post"};
+
+// 所有线程共用的参数，启动后只读
+struct lg_config{
+    sockaddr_in addr;
+    int scenario;
+    std::vector<std::string> requests; // 每个路径预先拼好的请求
+    std::vector<std::string> paths;
+    int conns;
+    int threads;
+    double secs;
+    double warmup;
+    double rate; // 0表示闭环
+    int depth;
+    int body;
+    int read_rate; // 慢读取每个连接每秒读的字节数
+    const char *json;
+};
+static lg_config g;
+
+struct lg_conn{
+    int fd;
+    bool connecting;
+    uint64_t connect_start;
+    std::string out; // 还没发出去的请求
+    size_t out_off;
+    std::string head; // 正在接收的响应头部
+    bool in_body;
+    uint64_t body_left;
+    bool close_after; // 响应带有Connection: close
+    int status;
+    std::deque<uint64_t> pending; // 已发出还没收到响应的请求的发送时间（开环为计划时间）
+    bool readable; // 限速读取时socket中还有数据
+};
+
+#define STATUS_CLASSES 6 // 1xx-5xx，其余的归为0
+struct lg_worker{
+    int id;
+    int epollfd;
+    int sched_fd; // 开环发送计划的定时器
+    int tick_fd; // 慢读取的节拍
+    std::vector<lg_conn> conns;
+    std::deque<uint64_t> backlog; // 开环时没有空闲连接可用的请求的计划时间
+    uint64_t interval; // 开环时两个请求的计划间隔
+    uint64_t next_send;
+    uint64_t measure_start; // 预热结束
+    uint64_t deadline;
+    size_t next_conn; // 开环时轮流挑选连接
+    size_t next_path;
+    hdr_histogram latency; // 纳秒
+    hdr_histogram connect;
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t reconnects;
+    uint64_t status[STATUS_CLASSES];
+    uint64_t max_backlog;
+};
+
+static uint64_t now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+static void arm_timer(int fd,uint64_t at){
+    struct itimerspec its;
+    memset(&its,0,sizeof(its));
+    its.it_value.tv_sec=at/1000000000ull;
+    its.it_value.tv_nsec=at%1000000000ull;
+    timerfd_settime(fd,TFD_TIMER_ABSTIME,&its,NULL);
+}
+
+static bool running(const lg_worker &w,uint64_t now){
+    return now<w.deadline;
+}
+
+static bool counting(const lg_worker &w,uint64_t now){
+    return now>=w.measure_start && now<w.deadline;
+}
+
+static void reset_conn(lg_conn &c){
+    c.fd=-1;
+    c.connecting=false;
+    c.out.clear();
+    c.out_off=0;
+    c.head.clear();
+    c.in_body=false;
+    c.body_left=0;
+    c.close_after=false;
+    c.pending.clear();
+    c.readable=false;
+}
+
+// 非阻塞连接，连上（可写）之后才发送
+static bool open_conn(lg_worker &w,lg_conn &c){
+    reset_conn(c);
+    c.fd=socket(AF_INET,SOCK_STREAM|SOCK_NONBLOCK,0);
+    if(c.fd==-1){
+        return false;
+    }
+    int one=1;
+    setsockopt(c.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    if(g.scenario==SLOWREAD){ // 接收缓冲区小，服务器很快就会写不动
+        int rcvbuf=4096;
+        setsockopt(c.fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+    }
+    c.connect_start=now_ns();
+    if(connect(c.fd,(sockaddr *)&g.addr,sizeof(g.addr))==-1 && errno!=EINPROGRESS){
+        close(c.fd);
+        c.fd=-1;
+        return false;
+    }
+    c.connecting=true;
+    epoll_event ev;
+    ev.events=EPOLLIN|EPOLLOUT|EPOLLET|EPOLLRDHUP;
+    ev.data.ptr=&c;
+    epoll_ctl(w.epollfd,EPOLL_CTL_ADD,c.fd,&ev);
+    return true;
+}
+
+static void close_conn(lg_conn &c){
+    if(c.fd!=-1){
+        close(c.fd);
+        c.fd=-1;
+    }
+}
+
+static bool flush_out(lg_conn &c){
+    if(c.connecting){
+        return true;
+    }
+    while(c.out_off<c.out.size()){
+        ssize_t n=send(c.fd,c.out.data()+c.out_off,c.out.size()-c.out_off,MSG_NOSIGNAL);
+        if(n==-1){
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+                return true;
+            }
+            if(errno==EINTR){
+                continue;
+            }
+            return false;
+        }
+        c.out_off+=n;
+    }
+    c.out.clear();
+    c.out_off=0;
+    return true;
+}
+
+// 在连接上排入一个请求，t是发送时间（开环为计划时间）
+static bool enqueue(lg_worker &w,lg_conn &c,uint64_t t){
+    c.out+=g.requests[w.next_path];
+    w.next_path=(w.next_path+1)%g.requests.size();
+    c.pending.push_back(t);
+    return flush_out(c);
+}
+
+// 连接能不能再接一个请求：churn每个连接只发一个请求，用完关闭，空闲的连接位置可以新建
+static bool can_take(const lg_conn &c){
+    if(g.scenario==CHURN){
+        return c.fd==-1;
+    }
+    return c.fd!=-1 && (int)c.pending.size()<g.depth;
+}
+
+// 闭环：把连接补满depth个请求，连接断了先重连
+static bool refill(lg_worker &w,lg_conn &c,uint64_t now){
+    if(c.fd==-1 && !open_conn(w,c)){
+        return false;
+    }
+    while((int)c.pending.size()<g.depth){
+        if(!enqueue(w,c,now)){
+            return false;
+        }
+        if(g.scenario==CHURN){
+            break;
+        }
+    }
+    return true;
+}
+
+// 开环：把积压的请求分给能接的连接
+static bool assign(lg_worker &w,lg_conn &c){
+    while(!w.backlog.empty() && can_take(c)){
+        if(c.fd==-1 && !open_conn(w,c)){
+            return false;
+        }
+        if(!enqueue(w,c,w.backlog.front())){
+            return false;
+        }
+        w.backlog.pop_front();
+    }
+    return true;
+}
+
+static bool parse_head(lg_conn &c){
+    if(c.head.compare(0,9,"HTTP/1.1 ")!=0 && c.head.compare(0,9,"HTTP/1.0 ")!=0){
+        return false;
+    }
+    c.status=atoi(c.head.c_str()+9);
+    c.body_left=0;
+    c.close_after=false;
+    bool has_length=false;
+    size_t pos=c.head.find("\r\n");
+    while(pos!=std::string::npos && pos+2<c.head.size()){
+        size_t end=c.head.find("\r\n",pos+2);
+        const char *line=c.head.c_str()+pos+2;
+        if(strncasecmp(line,"Content-Length:",15)==0){
+            c.body_left=strtoull(line+15,NULL,10);
+            has_length=true;
+        }else if(strncasecmp(line,"Connection:",11)==0){
+            c.close_after=strncasecmp(line+11+strspn(line+11," "),"close",5)==0;
+        }else if(strncasecmp(line,"Transfer-Encoding:",18)==0){
+            return false;
+        }
+        pos=end;
+    }
+    return has_length;
+}
+
+// 一个响应收完。返回false表示连接要关闭（服务器或者场景要求）
+static bool complete(lg_worker &w,lg_conn &c,uint64_t now){
+    uint64_t sent=c.pending.front();
+    c.pending.pop_front();
+    if(counting(w,now)){
+        w.requests++;
+        w.latency.record(now-sent);
+        w.status[c.status>=100 && c.status<600?c.status/100:0]++;
+    }
+    c.in_body=false;
+    c.head.clear();
+    return !c.close_after && g.scenario!=CHURN;
+}
+
+enum READ_RESULT{ READ_OK, READ_CLOSED, READ_ERROR };
+
+// 处理收到的数据，可能包含多个响应
+static READ_RESULT consume(lg_worker &w,lg_conn &c,const char *data,size_t len){
+    size_t off=0;
+    while(off<len){
+        if(!c.in_body){
+            size_t old=c.head.size();
+            c.head.append(data+off,len-off);
+            size_t end=c.head.find("\r\n\r\n",old>=3?old-3:0);
+            if(end==std::string::npos){
+                if(c.head.size()>MAX_HEAD){
+                    return READ_ERROR;
+                }
+                return READ_OK;
+            }
+            off+=end+4-old;
+            c.head.resize(end+4);
+            if(c.pending.empty() || !parse_head(c)){
+                return READ_ERROR;
+            }
+            c.in_body=true;
+        }
+        uint64_t take=c.body_left<len-off?c.body_left:len-off;
+        c.body_left-=take;
+        off+=take;
+        if(c.body_left==0 && !complete(w,c,now_ns())){
+            return READ_CLOSED;
+        }
+    }
+    return READ_OK;
+}
+
+// 读到EAGAIN，或者读够limit字节（慢读取）
+static READ_RESULT read_conn(lg_worker &w,lg_conn &c,size_t limit){
+    char buf[65536];
+    size_t got=0;
+    while(got<limit){
+        size_t want=limit-got<sizeof(buf)?limit-got:sizeof(buf);
+        ssize_t n=recv(c.fd,buf,want,0);
+        if(n==-1){
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+                c.readable=false;
+                return READ_OK;
+            }
+            if(errno==EINTR){
+                continue;
+            }
+            return READ_ERROR;
+        }
+        if(n==0){
+            return c.pending.empty()?READ_CLOSED:READ_ERROR;
+        }
+        got+=n;
+        if(counting(w,now_ns())){
+            w.bytes+=n;
+        }
+        READ_RESULT r=consume(w,c,buf,n);
+        if(r!=READ_OK){
+            return r;
+        }
+    }
+    c.readable=true; // 限额用完，剩下的下一个节拍再读
+    return READ_OK;
+}
+
+// 连接结束：出错时没收到的响应算作错误。闭环补上新的连接，开环只在有积压时新建
+static void finish_conn(lg_worker &w,lg_conn &c,bool error,uint64_t now){
+    if(error && counting(w,now)){
+        w.errors+=c.pending.empty()?1:c.pending.size();
+    }
+    close_conn(c);
+    reset_conn(c);
+    if(!running(w,now)){
+        return;
+    }
+    if(g.scenario!=CHURN){
+        w.reconnects++;
+    }
+    bool ok;
+    if(g.rate>0){
+        ok=g.scenario==CHURN || open_conn(w,c);
+        ok=ok && assign(w,c);
+    }else{
+        ok=refill(w,c,now);
+    }
+    if(!ok){
+        perror("reconnect");
+        w.errors++;
+    }
+}
+
+static void on_event(lg_worker &w,lg_conn &c,uint32_t events){
+    uint64_t now=now_ns();
+    if(c.connecting && (events & (EPOLLOUT|EPOLLERR|EPOLLHUP))){
+        int err=0;
+        socklen_t len=sizeof(err);
+        getsockopt(c.fd,SOL_SOCKET,SO_ERROR,&err,&len);
+        if(err!=0){
+            finish_conn(w,c,true,now);
+            return;
+        }
+        c.connecting=false;
+        if(counting(w,now)){
+            w.connect.record(now-c.connect_start);
+        }
+    }
+    if((events & EPOLLOUT) && !flush_out(c)){
+        finish_conn(w,c,true,now);
+        return;
+    }
+    if(!(events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR))){
+        return;
+    }
+    if(g.scenario==SLOWREAD && !(events & (EPOLLHUP|EPOLLERR))){
+        c.readable=true; // 等节拍再读
+        return;
+    }
+    READ_RESULT r=read_conn(w,c,(size_t)-1);
+    if(r!=READ_OK){
+        finish_conn(w,c,r==READ_ERROR,now);
+        return;
+    }
+    if(!running(w,now)){
+        return;
+    }
+    if(g.rate>0){
+        if(!assign(w,c)){
+            finish_conn(w,c,true,now);
+        }
+    }else if(!refill(w,c,now)){
+        finish_conn(w,c,true,now);
+    }
+}
+
+// 开环：到了计划时间的请求分给能接的连接，没有就积压
+static void schedule(lg_worker &w,uint64_t now){
+    while(w.next_send<=now && running(w,w.next_send)){
+        uint64_t t=w.next_send;
+        w.next_send+=w.interval;
+        if(!w.backlog.empty()){
+            w.backlog.push_back(t);
+            continue;
+        }
+        bool placed=false;
+        for(size_t i=0;i<w.conns.size() && !placed;i++){
+            lg_conn &c=w.conns[(w.next_conn+i)%w.conns.size()];
+            if(!can_take(c)){
+                continue;
+            }
+            w.next_conn=(w.next_conn+i+1)%w.conns.size();
+            placed=true;
+            if((c.fd==-1 && !open_conn(w,c)) || !enqueue(w,c,t)){
+                finish_conn(w,c,true,now);
+            }
+        }
+        if(!placed){
+            w.backlog.push_back(t);
+        }
+    }
+    if(w.backlog.size()>w.max_backlog){
+        w.max_backlog=w.backlog.size();
+    }
+    arm_timer(w.sched_fd,w.next_send);
+}
+
+// 慢读取：每个节拍每个连接最多读read_rate*节拍的字节
+static void tick(lg_worker &w){
+    size_t quota=(size_t)((double)g.read_rate*TICK_NS/1e9);
+    if(quota==0){
+        quota=1;
+    }
+    for(size_t i=0;i<w.conns.size();i++){
+        lg_conn &c=w.conns[i];
+        if(c.fd==-1 || !c.readable){
+            continue;
+        }
+        READ_RESULT r=read_conn(w,c,quota);
+        uint64_t now=now_ns();
+        if(r!=READ_OK){
+            finish_conn(w,c,r==READ_ERROR,now);
+        }else if(running(w,now) && g.rate==0 && !refill(w,c,now)){
+            finish_conn(w,c,true,now);
+        }
+    }
+}
+
+static void *run_worker(void *arg){
+    lg_worker &w=*(lg_worker *)arg;
+    uint64_t start=now_ns();
+    w.measure_start=start+(uint64_t)(g.warmup*1e9);
+    w.deadline=w.measure_start+(uint64_t)(g.secs*1e9);
+    w.epollfd=epoll_create1(0);
+    epoll_event ev;
+    ev.events=EPOLLIN;
+    w.sched_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
+    ev.data.ptr=&w.sched_fd;
+    epoll_ctl(w.epollfd,EPOLL_CTL_ADD,w.sched_fd,&ev);
+    w.tick_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
+    ev.data.ptr=&w.tick_fd;
+    epoll_ctl(w.epollfd,EPOLL_CTL_ADD,w.tick_fd,&ev);
+    if(g.scenario==SLOWREAD){
+        struct itimerspec its;
+        its.it_value.tv_sec=0;
+        its.it_value.tv_nsec=TICK_NS;
+        its.it_interval=its.it_value;
+        timerfd_settime(w.tick_fd,0,&its,NULL);
+    }
+
+    for(size_t i=0;i<w.conns.size();i++){
+        reset_conn(w.conns[i]);
+    }
+    if(g.rate>0){
+        if(g.scenario!=CHURN){
+            for(size_t i=0;i<w.conns.size();i++){
+                if(!open_conn(w,w.conns[i])){
+                    perror("connect");
+                    exit(1);
+                }
+            }
+        }
+        w.next_send=start;
+        schedule(w,start);
+    }else{
+        for(size_t i=0;i<w.conns.size();i++){
+            if(!refill(w,w.conns[i],start)){
+                perror("connect");
+                exit(1);
+            }
+        }
+    }
+
+    epoll_event events[256];
+    while(1){
+        uint64_t now=now_ns();
+        if(now>=w.deadline){
+            break;
+        }
+        int n=epoll_wait(w.epollfd,events,256,(int)((w.deadline-now)/1000000)+1);
+        for(int i=0;i<n;i++){
+            void *p=events[i].data.ptr;
+            uint64_t expirations;
+            if(p==&w.sched_fd){
+                if(read(w.sched_fd,&expirations,sizeof(expirations))>0){
+                    schedule(w,now_ns());
+                }
+            }else if(p==&w.tick_fd){
+                if(read(w.tick_fd,&expirations,sizeof(expirations))>0){
+                    tick(w);
+                }
+            }else{
+                on_event(w,*(lg_conn *)p,events[i].events);
+            }
+        }
+    }
+    // 结束时还在途的请求不计入结果
+    for(size_t i=0;i<w.conns.size();i++){
+        close_conn(w.conns[i]);
+    }
+    close(w.sched_fd);
+    close(w.tick_fd);
+    close(w.epollfd);
+    return NULL;
+}
+
+// dir下所有不超过SMALL_FILE的普通文件，返回相对dir的路径
+static void list_files(const std::string &dir,const std::string &prefix,std::vector<std::string> &out){
+    DIR *d=opendir(dir.c_str());
+    if(!d){
+        return;
+    }
+    struct dirent *de;
+    while((de=readdir(d))!=NULL){
+        if(de->d_name[0]=='.'){
+            continue;
+        }
+        std::string full=dir+"/"+de->d_name;
+        struct stat st;
+        if(stat(full.c_str(),&st)!=0){
+            continue;
+        }
+        if(S_ISDIR(st.st_mode)){
+            list_files(full,prefix+"/"+de->d_name,out);
+        }else if(S_ISREG(st.st_mode) && st.st_size<=SMALL_FILE){
+            out.push_back(prefix+"/"+de->d_name);
+        }
+    }
+    closedir(d);
+}
+
+static std::string build_request(const std::string &path){
+    std::string req=(g.scenario==POST?"POST ":"GET ")+path+" HTTP/1.1\r\nHost: loadgen\r\n";
+    req+=g.scenario==CHURN?"Connection: close\r\n":"Connection: keep-alive\r\n";
+    if(g.scenario==POST){
+        // a=xxx&b=xxx...，总长度为body
+        std::string body;
+        for(int k=0;(int)body.size()<g.body;k++){
+            char field[32];
+            snprintf(field,sizeof(field),"%sf%d=",k?"&":"",k);
+            body+=field;
+            body.append(16,'a'+k%26);
+        }
+        body.resize(g.body);
+        req+="Content-Type: application/x-www-form-urlencoded\r\nContent-Length: "+std::to_string(body.size())+"\r\n\r\n"+body;
+    }else{
+        req+="\r\n";
+    }
+    return req;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,"usage: %s [options] port\n"
+            "  -a addr      server address (default 127.0.0.1)\n"
+            "  -s scenario  keepalive|churn|pipeline|large|slowread|post (default keepalive)\n"
+            "  -u path      request path, may repeat; paths are used in turn (default /)\n"
+            "  -D dir       also request every file up to 64KB under dir, e.g. root\n"
+            "  -c conns     connections, split across threads (default 16)\n"
+            "  -t threads   client threads (default 1)\n"
+            "  -d secs      measured duration (default 10)\n"
+            "  -w secs      warm-up, not measured (default 1)\n"
+            "  -r rate      open loop: total requests/s on a fixed schedule, latency from the intended\n"
+            "               send time; without -r the load is closed loop\n"
+            "  -p depth     requests in flight per connection (default 16 for pipeline, else 1)\n"
+            "  -b bytes     POST body size (default 256)\n"
+            "  -R bytes     slowread: bytes/s read per connection (default 16384)\n"
+            "  -j file      also write the result as JSON to file (- for stdout)\n",prog);
+}
+
+static void print_hist(const char *name,const hdr_snapshot &h){
+    printf("%s us: mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f p99.99 %.1f max %.1f\n",name,
+           h.m_count?h.m_sum/1e3/h.m_count:0.0,h.percentile(0.5)/1e3,h.percentile(0.9)/1e3,h.percentile(0.99)/1e3,
+           h.percentile(0.999)/1e3,h.percentile(0.9999)/1e3,h.m_max/1e3);
+}
+
+static void json_hist(FILE *fp,const char *name,const hdr_snapshot &h){
+    fprintf(fp,"\"%s\":{\"count\":%llu,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"p9999\":%.3f,\"max\":%.3f}",
+            name,(unsigned long long)h.m_count,h.m_count?h.m_sum/1e3/h.m_count:0.0,h.percentile(0.5)/1e3,
+            h.percentile(0.9)/1e3,h.percentile(0.99)/1e3,h.percentile(0.999)/1e3,h.percentile(0.9999)/1e3,h.m_max/1e3);
+}
+
+int main(int argc,char *argv[]){
+    const char *addr="127.0.0.1";
+    std::vector<std::string> dirs;
+    g.scenario=KEEPALIVE;
+    g.conns=16;
+    g.threads=1;
+    g.secs=10;
+    g.warmup=1;
+    g.rate=0;
+    g.depth=0;
+    g.body=256;
+    g.read_rate=16384;
+    g.json=NULL;
+    int opt;
+    while((opt=getopt(argc,argv,"a:s:u:D:c:t:d:w:r:p:b:R:j:h"))!=-1){
+        switch(opt){
+            case 'a': addr=optarg; break;
+            case 's':
+                g.scenario=-1;
+                for(int i=0;i<SCENARIO_COUNT;i++){
+                    if(strcmp(optarg,scenario_names[i])==0){
+                        g.scenario=i;
+                    }
+                }
+                if(g.scenario<0){
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'u': g.paths.push_back(optarg); break;
+            case 'D': dirs.push_back(optarg); break;
+            case 'c': g.conns=atoi(optarg); break;
+            case 't': g.threads=atoi(optarg); break;
+            case 'd': g.secs=atof(optarg); break;
+            case 'w': g.warmup=atof(optarg); break;
+            case 'r': g.rate=atof(optarg); break;
+            case 'p': g.depth=atoi(optarg); break;
+            case 'b': g.body=atoi(optarg); break;
+            case 'R': g.read_rate=atoi(optarg); break;
+            case 'j': g.json=optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(g.depth==0){
+        g.depth=g.scenario==PIPELINE?16:1;
+    }
+    if(g.scenario==CHURN){
+        g.depth=1;
+    }
+    if(optind!=argc-1 || g.threads<=0 || g.conns<g.threads || g.depth<=0 || g.secs<=0 || g.warmup<0
+       || g.rate<0 || g.body<0 || g.read_rate<=0){
+        usage(argv[0]);
+        return 1;
+    }
+    memset(&g.addr,0,sizeof(g.addr));
+    g.addr.sin_family=AF_INET;
+    g.addr.sin_port=htons(atoi(argv[optind]));
+    if(inet_pton(AF_INET,addr,&g.addr.sin_addr)!=1){
+        usage(argv[0]);
+        return 1;
+    }
+    for(size_t i=0;i<dirs.size();i++){
+        std::string d=dirs[i];
+        while(d.size()>1 && d.back()=='/'){
+            d.pop_back();
+        }
+        list_files(d,"",g.paths);
+    }
+    if(g.paths.empty()){
+        g.paths.push_back("/");
+    }
+    for(size_t i=0;i<g.paths.size();i++){
+        g.requests.push_back(build_request(g.paths[i]));
+    }
+
+    std::vector<lg_worker *> workers(g.threads);
+    for(int i=0;i<g.threads;i++){
+        lg_worker *w=new lg_worker();
+        w->id=i;
+        w->conns.resize(g.conns/g.threads+(i<g.conns%g.threads?1:0));
+        w->interval=g.rate>0?(uint64_t)(1e9*g.threads/g.rate):0;
+        w->next_path=(size_t)i*g.paths.size()/g.threads;
+        workers[i]=w;
+    }
+    std::vector<pthread_t> tids(g.threads);
+    for(int i=0;i<g.threads;i++){
+        pthread_create(&tids[i],NULL,run_worker,workers[i]);
+    }
+    for(int i=0;i<g.threads;i++){
+        pthread_join(tids[i],NULL);
+    }
+
+    hdr_snapshot latency,connect;
+    uint64_t requests=0,bytes=0,errors=0,reconnects=0,backlog=0;
+    uint64_t status[STATUS_CLASSES]={0};
+    for(int i=0;i<g.threads;i++){
+        lg_worker &w=*workers[i];
+        latency.add(w.latency);
+        connect.add(w.connect);
+        requests+=w.requests;
+        bytes+=w.bytes;
+        errors+=w.errors;
+        reconnects+=w.reconnects;
+        backlog+=w.max_backlog;
+        for(int k=0;k<STATUS_CLASSES;k++){
+            status[k]+=w.status[k];
+        }
+    }
+
+    printf("%s, %s, %d conns x depth %d, %d threads, %zu paths, %.1fs (+%.1fs warm-up)\n",
+           scenario_names[g.scenario],g.rate>0?"open loop":"closed loop",g.conns,g.depth,g.threads,
+           g.paths.size(),g.secs,g.warmup);
+    if(g.rate>0){
+        printf("target %.0f req/s, max backlog %llu\n",g.rate,(unsigned long long)backlog);
+    }
+    printf("requests %llu (%.0f/s), %.1f MB/s, errors %llu, reconnects %llu\n",(unsigned long long)requests,
+           requests/g.secs,bytes/g.secs/1e6,(unsigned long long)errors,(unsigned long long)reconnects);
+    printf("status");
+    for(int k=1;k<STATUS_CLASSES;k++){
+        if(status[k]){
+            printf(" %dxx %llu",k,(unsigned long long)status[k]);
+        }
+    }
+    if(status[0]){
+        printf(" other %llu",(unsigned long long)status[0]);
+    }
+    printf("\n");
+    print_hist("latency",latency);
+    if(connect.m_count){
+        print_hist("connect",connect);
+    }
+
+    if(g.json){
+        FILE *fp=strcmp(g.json,"-")==0?stdout:fopen(g.json,"w");
+        if(!fp){
+            perror(g.json);
+            return 1;
+        }
+        fprintf(fp,"{\"scenario\":\"%s\",\"mode\":\"%s\",\"conns\":%d,\"depth\":%d,\"threads\":%d,\"paths\":%zu,"
+                   "\"duration_s\":%.3f,\"warmup_s\":%.3f,\"target_rate\":%.1f,\"max_backlog\":%llu,"
+                   "\"requests\":%llu,\"rps\":%.1f,\"bytes\":%llu,\"MBps\":%.3f,\"errors\":%llu,\"reconnects\":%llu,",
+                scenario_names[g.scenario],g.rate>0?"open":"closed",g.conns,g.depth,g.threads,g.paths.size(),
+                g.secs,g.warmup,g.rate,(unsigned long long)backlog,(unsigned long long)requests,requests/g.secs,
+                (unsigned long long)bytes,bytes/g.secs/1e6,(unsigned long long)errors,(unsigned long long)reconnects);
+        fprintf(fp,"\"status\":{");
+        for(int k=0;k<STATUS_CLASSES;k++){
+            fprintf(fp,"%s\"%s\":%llu",k?",":"",k?std::to_string(k).append("xx").c_str():"other",(unsigned long long)status[k]);
+        }
+        fprintf(fp,"},");
+        json_hist(fp,"latency_us",latency);
+        fprintf(fp,",");
+        json_hist(fp,"connect_us",connect);
+        fprintf(fp,"}\n");
+        if(fp!=stdout){
+            fclose(fp);
+        }
+    }
+    return errors>0?2:0;
+}
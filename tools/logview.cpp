@@ -0,0 +1,113 @@
+// logview：把二进制访问日志（server.out -a）渲染成文本，每个请求一行
+// 用法：logview [-H] file...
+//   -H：路径按哈希输出（路径超过记录中保留的长度时，前缀后面总是带上哈希）
+// 每行：时间 客户端 fd 方法 路径 状态码 字节数 解析/排队/处理/发送/总耗时 标志
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../log/access_log.h"
+
+static void print_us(char *out,size_t size,const char *name,uint64_t ns){
+    snprintf(out,size," %s=%.1fus",name,ns/1000.0);
+}
+
+static void render(const access_record &r,bool hash_only){
+    char when[64];
+    time_t sec=r.m_time_ns/1000000000ull;
+    struct tm tm;
+    gmtime_r(&sec,&tm);
+    size_t n=strftime(when,sizeof(when),"%Y-%m-%dT%H:%M:%S",&tm);
+    snprintf(when+n,sizeof(when)-n,".%06lluZ",(unsigned long long)(r.m_time_ns%1000000000ull/1000));
+
+    char peer[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    addr.s_addr=r.m_peer_ip;
+    inet_ntop(AF_INET,&addr,peer,sizeof(peer));
+
+    char path[ACCESS_LOG_PATH_MAX+32];
+    size_t kept=r.m_path_len<ACCESS_LOG_PATH_MAX?r.m_path_len:ACCESS_LOG_PATH_MAX;
+    if(hash_only){
+        snprintf(path,sizeof(path),"#%016llx",(unsigned long long)r.m_path_hash);
+    }else if(kept<r.m_path_len){
+        snprintf(path,sizeof(path),"%.*s...#%016llx",(int)kept,r.m_path,(unsigned long long)r.m_path_hash);
+    }else if(kept==0){
+        snprintf(path,sizeof(path),"-");
+    }else{
+        snprintf(path,sizeof(path),"%.*s",(int)kept,r.m_path);
+    }
+
+    char times[160];
+    size_t t=0;
+    print_us(times+t,sizeof(times)-t,"parse",r.m_parse_ns);
+    t=strlen(times);
+    print_us(times+t,sizeof(times)-t,"queue",r.m_queue_ns);
+    t=strlen(times);
+    print_us(times+t,sizeof(times)-t,"process",r.m_process_ns);
+    t=strlen(times);
+    print_us(times+t,sizeof(times)-t,"send",r.m_send_ns);
+    t=strlen(times);
+    print_us(times+t,sizeof(times)-t,"total",r.m_parse_ns+r.m_queue_ns+r.m_process_ns+r.m_send_ns);
+
+    static const char *names[]={"keep-alive","http/1.1","gzip","inline","batched","aborted"};
+    char flags[96]="";
+    for(int i=0;i<6;i++){
+        if(r.m_flags & (1<<i)){
+            if(flags[0]){
+                strcat(flags,",");
+            }
+            strcat(flags,names[i]);
+        }
+    }
+    printf("%s %s:%u fd=%d t%u %s %s %u %llu%s %s\n",when,peer,ntohs(r.m_peer_port),r.m_fd,r.m_thread,
+           r.m_method==0?"GET":"POST",path,r.m_status,(unsigned long long)r.m_bytes,times,flags[0]?flags:"-");
+}
+
+static bool dump(const char *file,bool hash_only){
+    FILE *fp=fopen(file,"rb");
+    if(!fp){
+        perror(file);
+        return false;
+    }
+    access_log_header h;
+    if(fread(&h,sizeof(h),1,fp)!=1 || memcmp(h.m_magic,ACCESS_LOG_MAGIC,8)!=0
+        || h.m_version!=ACCESS_LOG_VERSION || h.m_record_size!=sizeof(access_record)){
+        fprintf(stderr,"%s: not an access log (or a different version)\n",file);
+        fclose(fp);
+        return false;
+    }
+    access_record recs[256];
+    size_t n;
+    while((n=fread(recs,sizeof(access_record),256,fp))>0){
+        for(size_t i=0;i<n;i++){
+            render(recs[i],hash_only);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc,char *argv[]){
+    bool hash_only=false;
+    int opt;
+    while((opt=getopt(argc,argv,"H"))!=-1){
+        if(opt=='H'){
+            hash_only=true;
+        }else{
+            fprintf(stderr,"usage: logview [-H] file...\n");
+            return 1;
+        }
+    }
+    if(optind>=argc){
+        fprintf(stderr,"usage: logview [-H] file...\n");
+        return 1;
+    }
+    bool ok=true;
+    for(int i=optind;i<argc;i++){
+        ok=dump(argv[i],hash_only) && ok;
+    }
+    return ok?0:1;
+}
@@ -0,0 +1,263 @@
+// packer：把doc root打包成资源包，格式见bundle/bundle.h
+// 用法：packer [-z] doc_root output.bundle
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../bundle/bundle.h"
+
+struct pack_item{
+    std::string path; // url路径
+    std::string data;
+    std::string gzip; // 预压缩版本，可能为空
+    std::string mime;
+    std::string etag;
+};
+
+static bool read_file(const std::string &file,std::string &out){
+    FILE *fp=fopen(file.c_str(),"rb");
+    if(!fp){
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    out.clear();
+    while((n=fread(buf,1,sizeof(buf),fp))>0){
+        out.append(buf,n);
+    }
+    bool ok=!ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+/*
+    调用系统的gzip压缩，不引入zlib依赖。
+    文件名作为单独的参数传给execvp，不经过shell，文件名中有引号、空格或以'-'开头都没有问题
+*/
+static bool gzip_file(const std::string &file,std::string &out){
+    int fds[2];
+    if(pipe(fds)==-1){
+        perror("pipe");
+        return false;
+    }
+    pid_t pid=fork();
+    if(pid==-1){
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if(pid==0){
+        dup2(fds[1],STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        const char *argv[]={"gzip","-9","-n","-c","--",file.c_str(),NULL};
+        execvp("gzip",(char *const *)argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    char buf[65536];
+    ssize_t n;
+    out.clear();
+    bool ok=true;
+    while((n=read(fds[0],buf,sizeof(buf)))!=0){
+        if(n==-1){
+            if(errno==EINTR){
+                continue;
+            }
+            ok=false;
+            break;
+        }
+        out.append(buf,n);
+    }
+    close(fds[0]);
+    int status;
+    while(waitpid(pid,&status,0)==-1){
+        if(errno!=EINTR){
+            return false;
+        }
+    }
+    return ok && WIFEXITED(status) && WEXITSTATUS(status)==0;
+}
+
+static bool compressible(const std::string &mime){
+    return mime.compare(0,5,"text/")==0 || mime=="application/javascript"
+        || mime=="application/json" || mime=="application/xml" || mime=="image/svg+xml";
+}
+
+static bool has_suffix(const std::string &s,const char *suffix){
+    size_t n=strlen(suffix);
+    return s.size()>=n && s.compare(s.size()-n,n,suffix)==0;
+}
+
+// 递归收集目录下的普通文件，url为相对于doc root的路径
+static bool collect(const std::string &root,const std::string &url,std::vector<std::string> &files){
+    DIR *dir=opendir((root+url).c_str());
+    if(!dir){
+        perror((root+url).c_str());
+        return false;
+    }
+    struct dirent *de;
+    while((de=readdir(dir))!=NULL){
+        if(de->d_name[0]=='.'){ // 跳过隐藏文件和./..
+            continue;
+        }
+        std::string child=url+"/"+de->d_name;
+        struct stat st;
+        if(stat((root+child).c_str(),&st)!=0){
+            continue;
+        }
+        if(S_ISDIR(st.st_mode)){
+            if(!collect(root,child,files)){
+                closedir(dir);
+                return false;
+            }
+        }else if(S_ISREG(st.st_mode)){
+            files.push_back(child);
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+static uint64_t align_up(uint64_t v,uint64_t a){
+    return (v+a-1)/a*a;
+}
+
+int main(int argc,char *argv[]){
+    bool compress=false;
+    int opt;
+    while((opt=getopt(argc,argv,"z"))!=-1){
+        if(opt=='z'){
+            compress=true;
+        }else{
+            fprintf(stderr,"usage: %s [-z] doc_root output.bundle\n",argv[0]);
+            return 1;
+        }
+    }
+    if(optind+2!=argc){
+        fprintf(stderr,"usage: %s [-z] doc_root output.bundle\n",argv[0]);
+        return 1;
+    }
+    std::string root=argv[optind];
+    std::string output=argv[optind+1];
+    while(root.size()>1 && root.back()=='/'){
+        root.pop_back();
+    }
+
+    std::vector<std::string> files;
+    if(!collect(root,"",files)){
+        return 1;
+    }
+    std::sort(files.begin(),files.end());
+
+    std::vector<pack_item> items;
+    for(size_t i=0;i<files.size();i++){
+        // x.gz与x同时存在时，x.gz作为x的预压缩版本
+        if(has_suffix(files[i],".gz")
+            && std::binary_search(files.begin(),files.end(),files[i].substr(0,files[i].size()-3))){
+            continue;
+        }
+        pack_item item;
+        item.path=files[i];
+        if(!read_file(root+files[i],item.data)){
+            perror(files[i].c_str());
+            return 1;
+        }
+        item.mime=bundle_mime_type(files[i].c_str());
+        char etag[32];
+        snprintf(etag,sizeof(etag),"\"%016llx\"",(unsigned long long)bundle_hash(item.data.data(),item.data.size()));
+        item.etag=etag;
+
+        if(std::binary_search(files.begin(),files.end(),files[i]+".gz")){
+            read_file(root+files[i]+".gz",item.gzip);
+        }else if(compress && compressible(item.mime)){
+            gzip_file(root+files[i],item.gzip);
+        }
+        if(item.gzip.size()>=item.data.size()){ // 压缩后没有变小就不要了
+            item.gzip.clear();
+        }
+        items.push_back(item);
+    }
+
+    // 字符串区
+    std::string strings;
+    std::vector<bundle_entry> entries(items.size());
+    for(size_t i=0;i<items.size();i++){
+        memset(&entries[i],0,sizeof(bundle_entry));
+        entries[i].path_off=strings.size();
+        entries[i].path_len=items[i].path.size();
+        strings+=items[i].path;
+        entries[i].mime_off=strings.size();
+        entries[i].mime_len=items[i].mime.size();
+        strings+=items[i].mime;
+        entries[i].etag_off=strings.size();
+        entries[i].etag_len=items[i].etag.size();
+        strings+=items[i].etag;
+    }
+
+    bundle_header header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,BUNDLE_MAGIC,8);
+    header.version=BUNDLE_VERSION;
+    header.entry_count=items.size();
+    header.index_offset=sizeof(bundle_header);
+    header.strings_offset=header.index_offset+entries.size()*sizeof(bundle_entry);
+    header.strings_size=strings.size();
+    header.data_offset=align_up(header.strings_offset+header.strings_size,BUNDLE_PAGE_SIZE);
+
+    // 数据区布局
+    uint64_t off=header.data_offset;
+    for(size_t i=0;i<items.size();i++){
+        entries[i].data_off=off;
+        entries[i].data_size=items[i].data.size();
+        off=align_up(off+items[i].data.size(),BUNDLE_DATA_ALIGN);
+        if(!items[i].gzip.empty()){
+            entries[i].gzip_off=off;
+            entries[i].gzip_size=items[i].gzip.size();
+            off=align_up(off+items[i].gzip.size(),BUNDLE_DATA_ALIGN);
+        }
+    }
+    header.file_size=align_up(off,BUNDLE_PAGE_SIZE);
+
+    std::string image(header.file_size,'\0');
+    memcpy(&image[0],&header,sizeof(header));
+    if(!entries.empty()){
+        memcpy(&image[header.index_offset],&entries[0],entries.size()*sizeof(bundle_entry));
+    }
+    memcpy(&image[header.strings_offset],strings.data(),strings.size());
+    for(size_t i=0;i<items.size();i++){
+        memcpy(&image[entries[i].data_off],items[i].data.data(),items[i].data.size());
+        if(entries[i].gzip_size){
+            memcpy(&image[entries[i].gzip_off],items[i].gzip.data(),items[i].gzip.size());
+        }
+    }
+
+    // 先写临时文件再rename，服务器重新加载时不会读到写了一半的包
+    std::string tmp=output+".tmp";
+    FILE *fp=fopen(tmp.c_str(),"wb");
+    if(!fp){
+        perror(tmp.c_str());
+        return 1;
+    }
+    if(fwrite(image.data(),1,image.size(),fp)!=image.size() || fclose(fp)!=0){
+        perror(tmp.c_str());
+        unlink(tmp.c_str());
+        return 1;
+    }
+    if(rename(tmp.c_str(),output.c_str())!=0){
+        perror("rename");
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("packed %zu assets into %s (%llu bytes)\n",items.size(),output.c_str(),(unsigned long long)header.file_size);
+    return 0;
+}
@@ -0,0 +1,800 @@
+// replay：重放server.out -C捕获的流量。按原来的连接结构（哪些请求在同一个连接上、连接何时建立和关闭）
+// 和时间间隔（可以加速）把捕获的字节原样发给服务器，按URL类别统计延迟
+// 用法：replay [选项] capture port，-h查看选项
+//   每个数据块在它原来的到达时间（除以加速倍数）发出，不等前面的响应，服务器变慢时请求照样"到达"；
+//   延迟从请求的最后一个字节写进socket算起，到收完响应为止
+//   捕获中连接末尾不完整的请求不发送；服务器关闭连接时还没收到响应的请求算作错误
+// URL类别：去掉查询串，保留前-g层目录，文件名换成*加扩展名，例如/img/a/b.png -> /img/*.png，
+// 不超过-g层又没有扩展名的路径保留原样（/__stats），GET以外的方法加在前面（POST /login）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "../http/metrics.h"
+#include "../log/capture_log.h"
+#include "../cpu/busy_poll.h" // monotonic_ns()
+
+#define MAX_HEAD 65536 // 响应头部的最大长度
+
+// 捕获中的一个请求
+struct rp_request{
+    size_t end; // 在连接的字节流中的结束位置
+    int cls; // URL类别
+    bool head; // HEAD请求的响应没有正文
+    uint64_t sent; // 最后一个字节写进socket的时间
+};
+
+// 一次recv()读到的数据：到time时字节流的前end字节都已经到达
+struct rp_chunk{
+    uint64_t time;
+    size_t end;
+};
+
+// 响应解析的状态
+enum BODY_STATE{ BODY_HEAD=0, BODY_LENGTH, BODY_CHUNK_SIZE, BODY_CHUNK_DATA, BODY_TRAILER, BODY_UNTIL_CLOSE };
+
+struct rp_conn{
+    uint32_t id;
+    uint64_t open_time;
+    bool has_close;
+    uint64_t close_time;
+    std::string data; // 连接上收到的全部字节
+    std::vector<rp_chunk> chunks;
+    std::vector<rp_request> requests;
+
+    // 重放时的状态
+    int fd;
+    bool connecting;
+    bool close_wanted; // 到了原来关闭的时间，收完响应就关闭
+    bool done;
+    size_t avail; // 到目前为止应该已经到达的字节
+    size_t sent;
+    size_t next_sent; // 下一个还没发完的请求
+    size_t next_resp; // 下一个等待响应的请求
+    int state; // BODY_STATE
+    std::string line; // 正在接收的响应头部或者块长度行
+    uint64_t left; // 正文或者当前块还剩的字节
+    int status;
+    bool closing; // 服务器的响应带了Connection: close，之后的请求不会有响应
+};
+
+enum EVENT_TYPE{ EVENT_OPEN=0, EVENT_DATA, EVENT_CLOSE };
+
+struct rp_event{
+    uint64_t time;
+    uint32_t conn; // 在conns中的下标
+    uint32_t chunk;
+    uint8_t type; // EVENT_TYPE
+};
+
+#define STATUS_CLASSES 6 // 1xx-5xx，其余的归为0
+struct rp_class{
+    std::string name;
+    hdr_histogram latency; // 纳秒
+    uint64_t status[STATUS_CLASSES];
+    uint64_t errors;
+
+    rp_class():status(),errors(0){}
+};
+
+static std::vector<rp_conn> conns;
+static std::vector<rp_class *> classes;
+static std::map<std::string,int> class_index;
+static sockaddr_in server_addr;
+static int epollfd;
+static uint64_t unanswered=0; // 发出了但连接关闭时还没收到响应
+static uint64_t unsent=0; // 服务器关闭连接时还没来得及发，或者发在Connection: close的响应之后（原来也不会有响应）
+static uint64_t connect_errors=0;
+
+static void arm_timer(int fd,uint64_t at){
+    struct itimerspec its;
+    memset(&its,0,sizeof(its));
+    its.it_value.tv_sec=at/1000000000ull;
+    its.it_value.tv_nsec=at%1000000000ull;
+    timerfd_settime(fd,TFD_TIMER_ABSTIME,&its,NULL);
+}
+
+static std::string url_class(const std::string &method,std::string url,int depth){
+    size_t q=url.find_first_of("?#");
+    if(q!=std::string::npos){
+        url.resize(q);
+    }
+    std::vector<std::string> parts;
+    size_t pos=1;
+    while(pos<=url.size()){
+        size_t slash=url.find('/',pos);
+        if(slash==std::string::npos){
+            slash=url.size();
+        }
+        parts.push_back(url.substr(pos,slash-pos));
+        pos=slash+1;
+    }
+    std::string file=parts.empty()?"":parts.back();
+    size_t dot=file.rfind('.');
+    std::string cls;
+    if(url.empty() || url[0]!='/'){
+        cls=url.empty()?"(empty)":"(other)";
+    }else if(dot==std::string::npos && (int)parts.size()<=depth){
+        cls=url;
+    }else{
+        for(int i=0;i<depth && i+1<(int)parts.size();i++){
+            cls+="/"+parts[i];
+        }
+        cls+="/*";
+        if(dot!=std::string::npos){
+            cls+=file.substr(dot);
+        }
+    }
+    return method=="GET"?cls:method+" "+cls;
+}
+
+static int class_of(const std::string &name){
+    std::map<std::string,int>::iterator it=class_index.find(name);
+    if(it!=class_index.end()){
+        return it->second;
+    }
+    rp_class *c=new rp_class();
+    c->name=name;
+    classes.push_back(c);
+    class_index[name]=classes.size()-1;
+    return classes.size()-1;
+}
+
+// 把连接的字节流切成请求（请求行+头部+Content-Length的请求体），末尾不完整的丢掉
+static void split_requests(rp_conn &c,int depth){
+    size_t pos=0;
+    while(pos<c.data.size()){
+        while(pos+1<c.data.size() && c.data[pos]=='\r' && c.data[pos+1]=='\n'){ // 请求之间多余的空行
+            pos+=2;
+        }
+        size_t head_end=c.data.find("\r\n\r\n",pos);
+        if(head_end==std::string::npos){
+            break;
+        }
+        size_t line_end=c.data.find("\r\n",pos);
+        std::string line=c.data.substr(pos,line_end-pos);
+        size_t sp1=line.find(' ');
+        size_t sp2=sp1==std::string::npos?std::string::npos:line.find(' ',sp1+1);
+        std::string method=sp1==std::string::npos?"":line.substr(0,sp1);
+        std::string url=sp1==std::string::npos?"":line.substr(sp1+1,sp2==std::string::npos?std::string::npos:sp2-sp1-1);
+        size_t body=0;
+        size_t p=line_end;
+        while(p<head_end){
+            const char *h=c.data.c_str()+p+2;
+            if(strncasecmp(h,"Content-Length:",15)==0){
+                body=strtoull(h+15,NULL,10);
+            }
+            p=c.data.find("\r\n",p+2);
+        }
+        rp_request r;
+        r.end=head_end+4+body;
+        if(r.end>c.data.size()){
+            break;
+        }
+        r.cls=method.empty()?class_of("(bad)"):class_of(url_class(method,url,depth));
+        r.head=method=="HEAD";
+        r.sent=0;
+        c.requests.push_back(r);
+        pos=r.end;
+    }
+    // 只发到最后一个完整的请求为止
+    size_t limit=c.requests.empty()?0:c.requests.back().end;
+    while(!c.chunks.empty() && c.chunks.back().end>limit){
+        if(c.chunks.size()>1 && c.chunks[c.chunks.size()-2].end>=limit){
+            c.chunks.pop_back();
+        }else{
+            c.chunks.back().end=limit;
+            break;
+        }
+    }
+    if(limit==0){
+        c.chunks.clear();
+    }
+}
+
+// 文件中的一条记录，数据在raw中的位置
+struct rp_record{
+    capture_record r;
+    size_t off;
+};
+
+/*
+    一个连接可能先后在主线程和工作线程中读，记录分在不同线程的环里，写进文件的顺序不一定是时间顺序，
+    先按时间排好再拼成每个连接的字节流
+*/
+static bool load(const char *path,int depth){
+    FILE *fp=fopen(path,"rb");
+    if(!fp){
+        perror(path);
+        return false;
+    }
+    capture_header h;
+    if(fread(&h,sizeof(h),1,fp)!=1 || memcmp(h.m_magic,CAPTURE_MAGIC,8)!=0 || h.m_version!=CAPTURE_VERSION){
+        fprintf(stderr,"%s: not a capture file\n",path);
+        fclose(fp);
+        return false;
+    }
+    std::vector<rp_record> records;
+    std::string raw;
+    rp_record rec;
+    while(fread(&rec.r,sizeof(rec.r),1,fp)==1){
+        size_t padded=capture_size(rec.r.m_len)-sizeof(rec.r);
+        rec.off=raw.size();
+        raw.resize(raw.size()+padded);
+        if(padded>0 && fread(&raw[rec.off],padded,1,fp)!=1){ // 服务器还在写，最后一条不完整
+            fprintf(stderr,"%s: truncated record, stopping there\n",path);
+            break;
+        }
+        records.push_back(rec);
+    }
+    fclose(fp);
+    std::stable_sort(records.begin(),records.end(),[](const rp_record &a,const rp_record &b){
+        return a.r.m_time_ns<b.r.m_time_ns;
+    });
+
+    std::map<uint32_t,size_t> index;
+    for(size_t i=0;i<records.size();i++){
+        const capture_record &r=records[i].r;
+        std::map<uint32_t,size_t>::iterator it=index.find(r.m_conn);
+        if(it==index.end()){ // 环满时可能丢了OPEN，从第一条记录开始算
+            rp_conn c;
+            c.id=r.m_conn;
+            c.open_time=r.m_time_ns;
+            c.has_close=false;
+            c.close_time=0;
+            conns.push_back(c);
+            it=index.insert(std::make_pair(r.m_conn,conns.size()-1)).first;
+        }
+        rp_conn &c=conns[it->second];
+        if(r.m_type==CAPTURE_DATA){
+            c.data.append(raw,records[i].off,r.m_len);
+            rp_chunk ch;
+            ch.time=r.m_time_ns;
+            ch.end=c.data.size();
+            c.chunks.push_back(ch);
+        }else if(r.m_type==CAPTURE_CLOSE){
+            c.has_close=true;
+            c.close_time=r.m_time_ns;
+        }
+    }
+    for(size_t i=0;i<conns.size();i++){
+        split_requests(conns[i],depth);
+    }
+    return true;
+}
+
+static void finish(rp_conn &c){
+    if(c.fd!=-1){
+        close(c.fd);
+        c.fd=-1;
+    }
+    c.done=true;
+}
+
+// 服务器关闭了连接或者出错：没收到响应的请求算作错误
+static void abort_conn(rp_conn &c){
+    if(c.closing){
+        unsent+=c.requests.size()-c.next_resp;
+        finish(c);
+        return;
+    }
+    for(size_t i=c.next_resp;i<c.next_sent;i++){
+        classes[c.requests[i].cls]->errors++;
+    }
+    unanswered+=c.next_sent-c.next_resp;
+    unsent+=c.requests.size()-c.next_sent;
+    finish(c);
+}
+
+// 原来的连接已经关闭，或者捕获中的数据已经发完，收完所有响应就可以关闭了
+static void maybe_close(rp_conn &c){
+    bool all_released=c.chunks.empty() || c.avail>=c.chunks.back().end;
+    if((c.close_wanted || (!c.has_close && all_released)) && c.sent==c.avail && c.next_resp==c.next_sent){
+        finish(c);
+    }
+}
+
+static bool flush(rp_conn &c,uint64_t now){
+    if(c.connecting || c.fd==-1){
+        return true;
+    }
+    while(c.sent<c.avail){
+        ssize_t n=send(c.fd,c.data.data()+c.sent,c.avail-c.sent,MSG_NOSIGNAL);
+        if(n==-1){
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+                break;
+            }
+            if(errno==EINTR){
+                continue;
+            }
+            return false;
+        }
+        c.sent+=n;
+    }
+    while(c.next_sent<c.requests.size() && c.requests[c.next_sent].end<=c.sent){
+        c.requests[c.next_sent].sent=now;
+        c.next_sent++;
+    }
+    return true;
+}
+
+static bool open_conn(rp_conn &c){
+    c.fd=socket(AF_INET,SOCK_STREAM|SOCK_NONBLOCK,0);
+    if(c.fd==-1){
+        return false;
+    }
+    int one=1;
+    setsockopt(c.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    if(connect(c.fd,(sockaddr *)&server_addr,sizeof(server_addr))==-1 && errno!=EINPROGRESS){
+        close(c.fd);
+        c.fd=-1;
+        return false;
+    }
+    c.connecting=true;
+    epoll_event ev;
+    ev.events=EPOLLIN|EPOLLOUT|EPOLLET|EPOLLRDHUP;
+    ev.data.ptr=&c;
+    epoll_ctl(epollfd,EPOLL_CTL_ADD,c.fd,&ev);
+    return true;
+}
+
+// 一个响应收完
+static void complete(rp_conn &c,uint64_t now){
+    rp_request &r=c.requests[c.next_resp++];
+    rp_class &cls=*classes[r.cls];
+    cls.latency.record(now-r.sent);
+    cls.status[c.status>=100 && c.status<600?c.status/100:0]++;
+    c.state=BODY_HEAD;
+    c.line.clear();
+}
+
+// 响应头部收完，决定正文怎么结束
+static bool start_body(rp_conn &c,uint64_t now){
+    const std::string &h=c.line;
+    if(h.compare(0,9,"HTTP/1.1 ")!=0 && h.compare(0,9,"HTTP/1.0 ")!=0){
+        return false;
+    }
+    c.status=atoi(h.c_str()+9);
+    if(c.status>=100 && c.status<200){ // 临时响应，后面还有正式的
+        c.line.clear();
+        return true;
+    }
+    bool has_length=false,chunked=false;
+    c.left=0;
+    size_t pos=h.find("\r\n");
+    while(pos!=std::string::npos && pos+2<h.size()){
+        const char *line=h.c_str()+pos+2;
+        if(strncasecmp(line,"Content-Length:",15)==0){
+            c.left=strtoull(line+15,NULL,10);
+            has_length=true;
+        }else if(strncasecmp(line,"Transfer-Encoding:",18)==0){
+            chunked=strstr(line,"chunked")!=NULL;
+        }else if(strncasecmp(line,"Connection:",11)==0){
+            c.closing=strncasecmp(line+11+strspn(line+11," "),"close",5)==0;
+        }
+        pos=h.find("\r\n",pos+2);
+    }
+    c.line.clear();
+    if(c.requests[c.next_resp].head || c.status==204 || c.status==304 || (has_length && c.left==0 && !chunked)){
+        complete(c,now);
+    }else if(chunked){
+        c.state=BODY_CHUNK_SIZE;
+    }else if(has_length){
+        c.state=BODY_LENGTH;
+    }else{
+        c.state=BODY_UNTIL_CLOSE;
+    }
+    return true;
+}
+
+// 处理收到的数据，可能包含多个响应
+static bool consume(rp_conn &c,const char *data,size_t len,uint64_t now){
+    size_t off=0;
+    while(off<len){
+        switch(c.state){
+            case BODY_HEAD:{
+                if(c.next_resp>=c.next_sent){ // 没有请求在等的响应
+                    return false;
+                }
+                size_t old=c.line.size();
+                c.line.append(data+off,len-off);
+                size_t end=c.line.find("\r\n\r\n",old>=3?old-3:0);
+                if(end==std::string::npos){
+                    return c.line.size()<=MAX_HEAD;
+                }
+                off+=end+4-old;
+                c.line.resize(end+4);
+                if(!start_body(c,now)){
+                    return false;
+                }
+                break;
+            }
+            case BODY_LENGTH:
+            case BODY_CHUNK_DATA:{
+                uint64_t take=c.left<len-off?c.left:len-off;
+                c.left-=take;
+                off+=take;
+                if(c.left==0){
+                    if(c.state==BODY_LENGTH){
+                        complete(c,now);
+                    }else{
+                        c.state=BODY_CHUNK_SIZE;
+                    }
+                }
+                break;
+            }
+            case BODY_CHUNK_SIZE:
+            case BODY_TRAILER:{
+                const char *nl=(const char *)memchr(data+off,'\n',len-off);
+                size_t take=nl?nl-(data+off)+1:len-off;
+                c.line.append(data+off,take);
+                off+=take;
+                if(!nl){
+                    if(c.line.size()>MAX_HEAD){
+                        return false;
+                    }
+                    break;
+                }
+                if(c.state==BODY_CHUNK_SIZE){
+                    uint64_t size=strtoull(c.line.c_str(),NULL,16);
+                    c.line.clear();
+                    if(size==0){
+                        c.state=BODY_TRAILER;
+                    }else{
+                        c.left=size+2; // 块后面的\r\n
+                        c.state=BODY_CHUNK_DATA;
+                    }
+                }else{
+                    bool empty=c.line=="\r\n" || c.line=="\n";
+                    c.line.clear();
+                    if(empty){
+                        complete(c,now);
+                    }
+                }
+                break;
+            }
+            case BODY_UNTIL_CLOSE:
+                off=len;
+                break;
+        }
+    }
+    return true;
+}
+
+static void on_event(rp_conn &c,uint32_t events,uint64_t now){
+    if(c.done){
+        return;
+    }
+    if(c.connecting && (events & (EPOLLOUT|EPOLLERR|EPOLLHUP))){
+        int err=0;
+        socklen_t len=sizeof(err);
+        getsockopt(c.fd,SOL_SOCKET,SO_ERROR,&err,&len);
+        if(err!=0){
+            connect_errors++;
+            abort_conn(c);
+            return;
+        }
+        c.connecting=false;
+    }
+    if((events & EPOLLOUT) && !flush(c,now)){
+        abort_conn(c);
+        return;
+    }
+    if(events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)){
+        char buf[65536];
+        while(1){
+            ssize_t n=recv(c.fd,buf,sizeof(buf),0);
+            if(n==-1){
+                if(errno==EAGAIN || errno==EWOULDBLOCK){
+                    break;
+                }
+                if(errno==EINTR){
+                    continue;
+                }
+                abort_conn(c);
+                return;
+            }
+            if(n==0){
+                if(c.state==BODY_UNTIL_CLOSE && c.next_resp<c.next_sent){ // 以关闭连接表示正文结束
+                    complete(c,now);
+                }
+                abort_conn(c);
+                return;
+            }
+            if(!consume(c,buf,n,now)){
+                abort_conn(c);
+                return;
+            }
+        }
+    }
+    maybe_close(c);
+}
+
+static void run_event(const rp_event &e,uint64_t now){
+    rp_conn &c=conns[e.conn];
+    if(c.done && e.type!=EVENT_OPEN){
+        return;
+    }
+    switch(e.type){
+        case EVENT_OPEN:
+            if(!open_conn(c)){
+                connect_errors++;
+                abort_conn(c);
+            }
+            break;
+        case EVENT_DATA:
+            c.avail=c.chunks[e.chunk].end;
+            if(!flush(c,now)){
+                abort_conn(c);
+                return;
+            }
+            maybe_close(c);
+            break;
+        case EVENT_CLOSE:
+            c.close_wanted=true;
+            maybe_close(c);
+            break;
+    }
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,"usage: %s [options] capture port\n"
+            "  -a addr    server address (default 127.0.0.1)\n"
+            "  -x speed   time acceleration, 2 replays twice as fast; 0 sends everything in order\n"
+            "             without waiting (default 1)\n"
+            "  -g depth   directory levels kept in a URL class (default 1): /img/a/b.png -> /img/*.png\n"
+            "  -w secs    after the last event, wait this long for outstanding responses (default 5)\n"
+            "  -j file    also write the result as JSON to file (- for stdout)\n",prog);
+}
+
+static void print_row(const char *name,const hdr_snapshot &h,const uint64_t *status,uint64_t errors){
+    printf("%-32s %9llu %7llu %7llu %7llu %7llu %6llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",name,(unsigned long long)h.m_count,
+           (unsigned long long)status[2],(unsigned long long)status[3],(unsigned long long)status[4],
+           (unsigned long long)status[5],(unsigned long long)errors,h.percentile(0.5)/1e3,h.percentile(0.9)/1e3,
+           h.percentile(0.99)/1e3,h.percentile(0.999)/1e3,h.m_max/1e3);
+}
+
+// JSON字符串，类别名来自请求行，可能有任意字节
+static void json_string(FILE *fp,const std::string &s){
+    fputc('"',fp);
+    for(size_t i=0;i<s.size();i++){
+        unsigned char c=s[i];
+        if(c=='"' || c=='\\'){
+            fprintf(fp,"\\%c",c);
+        }else if(c<0x20 || c>=0x7f){
+            fprintf(fp,"\\u%04x",c);
+        }else{
+            fputc(c,fp);
+        }
+    }
+    fputc('"',fp);
+}
+
+static void json_class(FILE *fp,const std::string &name,const hdr_snapshot &h,const uint64_t *status,uint64_t errors){
+    fprintf(fp,"{\"class\":");
+    json_string(fp,name);
+    fprintf(fp,",\"requests\":%llu,\"errors\":%llu,\"status\":{",(unsigned long long)h.m_count,(unsigned long long)errors);
+    for(int k=0;k<STATUS_CLASSES;k++){
+        fprintf(fp,"%s\"%s\":%llu",k?",":"",k?std::to_string(k).append("xx").c_str():"other",(unsigned long long)status[k]);
+    }
+    fprintf(fp,"},\"latency_us\":{\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}}",
+            h.m_count?h.m_sum/1e3/h.m_count:0.0,h.percentile(0.5)/1e3,h.percentile(0.9)/1e3,h.percentile(0.99)/1e3,
+            h.percentile(0.999)/1e3,h.m_max/1e3);
+}
+
+int main(int argc,char *argv[]){
+    const char *addr="127.0.0.1";
+    double speed=1;
+    int depth=1;
+    double wait_secs=5;
+    const char *json=NULL;
+    int opt;
+    while((opt=getopt(argc,argv,"a:x:g:w:j:h"))!=-1){
+        switch(opt){
+            case 'a': addr=optarg; break;
+            case 'x': speed=atof(optarg); break;
+            case 'g': depth=atoi(optarg); break;
+            case 'w': wait_secs=atof(optarg); break;
+            case 'j': json=optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(argc-optind!=2 || speed<0 || depth<0 || wait_secs<0){
+        usage(argv[0]);
+        return 1;
+    }
+    memset(&server_addr,0,sizeof(server_addr));
+    server_addr.sin_family=AF_INET;
+    server_addr.sin_port=htons(atoi(argv[optind+1]));
+    if(inet_pton(AF_INET,addr,&server_addr.sin_addr)!=1){
+        usage(argv[0]);
+        return 1;
+    }
+    if(!load(argv[optind],depth)){
+        return 1;
+    }
+
+    // 所有连接的事件按原来的时间排好，同一时间的保持文件中的顺序
+    std::vector<rp_event> events;
+    uint64_t total_requests=0;
+    for(size_t i=0;i<conns.size();i++){
+        rp_conn &c=conns[i];
+        c.fd=-1;
+        c.connecting=false;
+        c.close_wanted=false;
+        c.done=c.requests.empty(); // 没有完整请求的连接不重放
+        c.avail=c.sent=c.next_sent=c.next_resp=0;
+        c.state=BODY_HEAD;
+        c.left=0;
+        c.status=0;
+        c.closing=false;
+        if(c.done){
+            continue;
+        }
+        total_requests+=c.requests.size();
+        rp_event e;
+        e.conn=i;
+        e.chunk=0;
+        e.time=c.open_time;
+        e.type=EVENT_OPEN;
+        events.push_back(e);
+        for(size_t k=0;k<c.chunks.size();k++){
+            e.time=c.chunks[k].time;
+            e.chunk=k;
+            e.type=EVENT_DATA;
+            events.push_back(e);
+        }
+        if(c.has_close){
+            e.time=c.close_time;
+            e.type=EVENT_CLOSE;
+            events.push_back(e);
+        }
+    }
+    std::stable_sort(events.begin(),events.end(),[](const rp_event &a,const rp_event &b){ return a.time<b.time; });
+    if(events.empty()){
+        fprintf(stderr,"%s: no complete requests to replay\n",argv[optind]);
+        return 1;
+    }
+
+    epollfd=epoll_create1(0);
+    int timer_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
+    epoll_event ev;
+    ev.events=EPOLLIN;
+    ev.data.ptr=NULL;
+    epoll_ctl(epollfd,EPOLL_CTL_ADD,timer_fd,&ev);
+
+    uint64_t base=events[0].time;
+    uint64_t start=monotonic_ns();
+    auto scheduled=[&](const rp_event &e){ return start+(speed>0?(uint64_t)((e.time-base)/speed):0); };
+    hdr_histogram lag; // 事件实际执行比计划晚了多久，太大说明重放跟不上
+    size_t next=0;
+    uint64_t deadline=0;
+    epoll_event ready[256];
+    while(1){
+        uint64_t now=monotonic_ns();
+        while(next<events.size() && scheduled(events[next])<=now){
+            lag.record(now-scheduled(events[next]));
+            run_event(events[next],now);
+            next++;
+        }
+        if(next<events.size()){
+            arm_timer(timer_fd,scheduled(events[next]));
+        }else{
+            if(deadline==0){
+                deadline=now+(uint64_t)(wait_secs*1e9);
+            }
+            bool all_done=true;
+            for(size_t i=0;i<conns.size() && all_done;i++){
+                all_done=conns[i].done;
+            }
+            if(all_done || now>=deadline){
+                break;
+            }
+            arm_timer(timer_fd,deadline);
+        }
+        int n=epoll_wait(epollfd,ready,256,-1);
+        now=monotonic_ns();
+        for(int i=0;i<n;i++){
+            if(ready[i].data.ptr==NULL){
+                uint64_t expirations;
+                while(read(timer_fd,&expirations,sizeof(expirations))>0){
+                }
+                continue;
+            }
+            on_event(*(rp_conn *)ready[i].data.ptr,ready[i].events,now);
+        }
+    }
+    double elapsed=(monotonic_ns()-start)/1e9;
+    for(size_t i=0;i<conns.size();i++){ // 等到最后还没收到的响应
+        if(!conns[i].done){
+            abort_conn(conns[i]);
+        }
+    }
+
+    hdr_snapshot all;
+    uint64_t all_status[STATUS_CLASSES]={0};
+    uint64_t all_errors=0;
+    std::vector<hdr_snapshot> snaps(classes.size());
+    for(size_t i=0;i<classes.size();i++){
+        snaps[i].add(classes[i]->latency);
+        all.add(classes[i]->latency);
+        for(int k=0;k<STATUS_CLASSES;k++){
+            all_status[k]+=classes[i]->status[k];
+        }
+        all_errors+=classes[i]->errors;
+    }
+    // 按请求数从多到少
+    std::vector<int> order(classes.size());
+    for(size_t i=0;i<order.size();i++){
+        order[i]=i;
+    }
+    std::sort(order.begin(),order.end(),[&](int a,int b){
+        uint64_t ca=snaps[a].m_count,cb=snaps[b].m_count;
+        return ca!=cb?ca>cb:classes[a]->name<classes[b]->name;
+    });
+    hdr_snapshot lag_snap;
+    lag_snap.add(lag);
+
+    size_t replayed=0;
+    for(size_t i=0;i<conns.size();i++){
+        replayed+=!conns[i].requests.empty();
+    }
+    printf("%s: %zu connections, %llu requests, %.2fs, %s\n",argv[optind],replayed,(unsigned long long)total_requests,
+           elapsed,speed>0?("speed "+std::to_string(speed).erase(std::to_string(speed).find_last_not_of("0.")+1)+"x").c_str()
+                          :"no waiting");
+    printf("schedule lag us: p50 %.1f p99 %.1f max %.1f\n",lag_snap.percentile(0.5)/1e3,lag_snap.percentile(0.99)/1e3,
+           lag_snap.m_max/1e3);
+    printf("errors: %llu unanswered, %llu connect failures; %llu not sent or after Connection: close\n",
+           (unsigned long long)unanswered,(unsigned long long)connect_errors,(unsigned long long)unsent);
+    printf("%-32s %9s %7s %7s %7s %7s %6s %9s %9s %9s %9s %9s\n","class","requests","2xx","3xx","4xx","5xx","errors",
+           "p50 us","p90 us","p99 us","p99.9 us","max us");
+    for(size_t i=0;i<order.size();i++){
+        rp_class &c=*classes[order[i]];
+        print_row(c.name.c_str(),snaps[order[i]],c.status,c.errors);
+    }
+    print_row("all",all,all_status,all_errors);
+
+    if(json){
+        FILE *fp=strcmp(json,"-")==0?stdout:fopen(json,"w");
+        if(!fp){
+            perror(json);
+            return 1;
+        }
+        fprintf(fp,"{\"capture\":");
+        json_string(fp,argv[optind]);
+        fprintf(fp,",\"connections\":%zu,\"requests\":%llu,\"speed\":%g,\"elapsed_s\":%.3f,"
+                   "\"unanswered\":%llu,\"unsent\":%llu,\"connect_errors\":%llu,"
+                   "\"lag_us\":{\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f},\"classes\":[",
+                replayed,(unsigned long long)total_requests,speed,elapsed,(unsigned long long)unanswered,
+                (unsigned long long)unsent,(unsigned long long)connect_errors,lag_snap.percentile(0.5)/1e3,
+                lag_snap.percentile(0.99)/1e3,lag_snap.m_max/1e3);
+        for(size_t i=0;i<order.size();i++){
+            if(i){
+                fprintf(fp,",");
+            }
+            json_class(fp,classes[order[i]]->name,snaps[order[i]],classes[order[i]]->status,classes[order[i]]->errors);
+        }
+        fprintf(fp,"],\"all\":");
+        json_class(fp,"all",all,all_status,all_errors);
+        fprintf(fp,"}\n");
+        if(fp!=stdout){
+            fclose(fp);
+        }
+    }
+    return unanswered+connect_errors>0?2:0;
+}